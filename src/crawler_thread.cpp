@@ -6,6 +6,8 @@
 #include <glibmm/ustring.h> //utf-8 strings
 #include <glibmm/convert.h> //Glib::ConvertError
 #include <thread>
+#include <functional>
+#include <algorithm>
 
 #include "crawler_thread.hpp"
 #include "parser.hpp"
@@ -15,6 +17,8 @@
 #include "page_data.hpp"
 #include "ipc_common.hpp"
 #include "memory_mgr.hpp"
+#include "host_scheduler.hpp"
+#include "host_table.hpp"
 #include "debug.hpp"
 
 //
@@ -22,28 +26,64 @@
 #define CREDIT_TAX_PERCENT 10
 #define CREDIT_TAX_ALL 100
 
-//Time in *microseconds* between aborting crawls due to domain crawl_delay
-//before thread should start to implement sleep time. This stops thread from
-//spinning in situations where the work queue is dominatied by one (or few)
-//domains.
-#define TOO_MANY_RETRIES_TIME 1000
+//Work items held by the thread's scheduler before it stops taking more from
+//the master. Only once this many items are waiting on their domains'
+//crawl_delay will the thread sleep.
+#define SCHEDULER_MAX_ITEMS 1024
+
+//how long an item waits when another thread holds its page or robots object
+#define LOCKED_RETRY std::chrono::milliseconds(100)
+
+//longest a thread sleeps before asking the master for work again
+#define IPC_RETRY std::chrono::seconds(1)
+
+//pages a thread fetches at once, and how long it waits on them, ms, when
+//it can start no more
+#define MAX_FETCHES 32
+#define FETCH_POLL  100
 
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
 using std::chrono::seconds;
 
+//runs a function when leaving scope, however that happens
+class scope_exit
+{
+    public:
+    scope_exit(std::function<void(void)> f): f(f) {}
+    ~scope_exit(void)
+    {
+        f();
+    }
+
+    private:
+    std::function<void(void)> f;
+};
+
 //
 //public
-crawler_thread::crawler_thread(ipc_client* ipc_obj)
+crawler_thread::crawler_thread(ipc_client* ipc_obj, memory_mgr<page_data_c>* page_mgr,
+                               memory_mgr<robots_txt>* robots_mgr, host_table* host_state)
 {
     //set to idle on entry to main loop
     thread_status = SLEEP;
     ipc = ipc_obj;
+    pages = page_mgr;
+    robots_store = robots_mgr;
+    hosts = host_state;
+    netio_obj = 0;
+    profile = 0;
 }
 
 crawler_thread::~crawler_thread(void)
 {
+    //the thread uses everything below
+    stop();
+    if(main_thread.joinable())
+        main_thread.join();
+
     delete netio_obj;
+    delete profile;
 }
 
 //try and get config via ipc_client
@@ -51,6 +91,7 @@ void crawler_thread::start(void)
 {
     cfg = ipc->get_config();
     netio_obj = new netio(cfg.user_agent);
+    profile = new parse_profile(cfg.parse_param);
 
     launch_thread();
 }
@@ -60,13 +101,14 @@ void crawler_thread::start(worker_config_s& config)
 {
     cfg = config;
     netio_obj = new netio(cfg.user_agent);
+    profile = new parse_profile(cfg.parse_param);
 
     launch_thread();
 }
 
 void crawler_thread::stop(void)
 {
-    thread_status = STOP;
+    set_status(STOP);
 }
 
 worker_status_e crawler_thread::status(void)
@@ -76,6 +118,14 @@ worker_status_e crawler_thread::status(void)
 
 //
 //private
+
+//sets the thread's status, unless it has been told to stop or died
+void crawler_thread::set_status(worker_status_e s)
+{
+    worker_status_e current = thread_status;
+    while(current > STOP && !thread_status.compare_exchange_weak(current, s));
+}
+
 void crawler_thread::launch_thread(void)
 {
     main_thread = std::thread(&crawler_thread::thread, this);
@@ -84,140 +134,270 @@ void crawler_thread::launch_thread(void)
     //main_thread.detatch()
 }
 
-void crawler_thread::thread() throw(std::underflow_error)
+void crawler_thread::thread(void)
 {
-    mmgr_config page_mgr_cfg = {
-        .database_path = cfg.db_path,
-        .object_table = cfg.page_table,
-        .user_agent = cfg.user_agent
-    };
-    mmgr_config robots_mgr_cfg = {
-        .database_path = cfg.db_path,
-        .object_table = cfg.robots_table,
-        .user_agent = cfg.user_agent
-    };
-    memory_mgr<page_data_c> page_mgr(page_mgr_cfg);
-    memory_mgr<robots_txt> robots_mgr(robots_mgr_cfg);
-    std::chrono::system_clock::time_point last_backoff = std::chrono::system_clock::now();
-    microseconds sleep_time(TOO_MANY_RETRIES_TIME);
-
     while(thread_status > STOP) {
+        microseconds wait(0);
         try {
-            thread_status = IDLE;
+            set_status(IDLE);
 
-            //get next work item from process queue
-            queue_node_s work_item = ipc->get_item();
-            thread_status = ACTIVE;
-            dbg<<"got work_item\n";
+            //fetches completed meanwhile are parsed, freeing their domains
+            if(netio_obj->pending())
+                netio_obj->perform(0);
+
+            if(netio_obj->pending() >= MAX_FETCHES) {
+                set_status(ACTIVE);
+                netio_obj->perform(FETCH_POLL);
+                continue;
+            }
+
+            //get next work item from a domain that is ready to be crawled
+            queue_node_s work_item;
+            std::string root_url;
+            if(!work_queue.pop(work_item, root_url, wait)) {
+                //no ready domain, take more work from the master. Only wait
+                //on it with nothing else to do, queued domains may become
+                //ready or fetches complete first
+                queue_node_s new_item;
+                bool got_item = false;
+                if(!work_queue.size() && !netio_obj->pending()) {
+                    new_item = ipc->get_item();
+                    got_item = true;
+                } else if(work_queue.size() < SCHEDULER_MAX_ITEMS) {
+                    got_item = ipc->try_get_item(new_item);
+                }
 
-            //get memory
-            page_data_c* page = page_mgr.get_object_nblk(work_item.url);
-            std::string root_url(work_item.url, 0, root_domain(work_item.url));
+                if(got_item) {
+                    std::string new_root(new_item.url, 0, root_domain(new_item.url));
+                    work_queue.push(new_item, new_root);
+
+                    //load from disk whilst the item waits its turn
+                    std::vector<std::string> urls = {new_item.url};
+                    std::vector<std::string> roots = {new_root};
+                    pages->prefetch(urls);
+                    robots_store->prefetch(roots);
+                } else {
+                    //queue is full of domains under crawl_delay or being
+                    //fetched, or the master's next batch is on its way
+                    if(!wait.count() || (work_queue.size() < SCHEDULER_MAX_ITEMS && wait > IPC_RETRY))
+                        wait = IPC_RETRY;
+                    dbg<<"no domain ready, sleeping "<<wait.count()<<"us\n";
+                    set_status(SLEEP);
+
+                    //a completed fetch frees its domain, so wakes us
+                    if(netio_obj->pending())
+                        netio_obj->perform(wait.count()/1000+1);
+                    else
+                        std::this_thread::sleep_for(wait);
+                }
+                continue;
+            }
+            set_status(ACTIVE);
+            dbg<<"got work_item\n";
             std::cout<<"root_url ["<<root_url<<"]\n";
 
-            robots_txt* robots = robots_mgr.get_object_nblk(root_url);
+            //when the domain may next be crawled, by default straight away.
+            //It is busy until completed, whether or not the item is. Once
+            //a fetch is started, it completes the domain instead
+            struct fetch_s* started = 0;
+            host_scheduler::time_point_t ready_at = std::chrono::steady_clock::now();
+            scope_exit completed([&]() { if(!started) work_queue.complete(root_url, ready_at); });
+
+            //another thread may be working on this domain's robots.txt
+            robots_txt* robots;
+            try {
+                robots = robots_store->get_object_nblk(root_url);
+            } catch(memory_exception& e) {
+                dbg<<e.what()<<", deferring ["<<work_item.url<<"]\n";
+                work_queue.push_front(work_item, root_url);
+                ready_at += LOCKED_RETRY;
+                continue;
+            }
             robots->configure(cfg.user_agent, root_url, netio_obj);
 
             //robots.txt checks
             seconds robots_refresh_time(ROBOTS_REFRESH);
             std::chrono::system_clock::time_point now_time = std::chrono::system_clock::now();
+            bool robots_changed = false;
 
             if(duration_cast<seconds> (now_time - robots->last_visit())
                >= robots_refresh_time) {
                 dbg<<"refreshing robots_txt\n";
                 robots->fetch();
+                robots_changed = true;
                 //robots last_visit time is updated automatically
             }
 
             //can we crawl this page?
             if(!robots->exclude(work_item.url)) {
-                //measures to prevent excessive crawling
-                std::chrono::hours one_day(24);
-
-                //domain crawl timeout is enforced via the (domain) root page
-                page_data_c* root_page;
-                if(work_item.url != root_url)
-                    root_page = page_mgr.get_object_nblk(root_url);
-                else
-                    root_page = page;
-
-                //if a page from the root domain has been recently crawled or,
-                // *this* page has been crawled too often already (past 24hrs)
-                //then, we requeue the work order and get on with something
-                //else to avoid stalling.
-                if((duration_cast<seconds>(now_time - root_page->last_crawl)
-                   >= robots->crawl_delay()) and (page->crawl_count < cfg.day_max_crawls)) {
-
-                    //special case
-                    if(duration_cast<std::chrono::hours> (now_time - page->last_crawl)
-                       >= one_day) {
-                        dbg<<"page->last_visit > 24 hours, resetting count & crawling\n";
-                        page->crawl_count = 0;
+                //domain crawl timeout is enforced via the host table, which
+                //never touches page storage
+                host_state_s& host = hosts->get(root_url);
+                scope_exit released([&]() { if(!started) hosts->release(root_url); });
+                host.crawl_delay = robots->crawl_delay().count();
+
+                //if the domain has been recently crawled it is deferred in the
+                //scheduler and the item retried once its crawl_delay has passed
+                if(!hosts->ready(host)) {
+                    dbg<<"root domain ["<<root_url<<"] has recently been visited, deferring ["<<work_item.url<<"]\n";
+                    work_queue.push_front(work_item, root_url);
+                    ready_at = hosts->next_fetch(host);
+
+                    //another thread's fetch may be in flight a while
+                    if(host.in_flight.load())
+                        ready_at = std::max(ready_at, std::chrono::steady_clock::now()+LOCKED_RETRY);
+
+                } else {
+                    page_data_c* page;
+                    try {
+                        page = pages->get_object_nblk(work_item.url);
+                    } catch(memory_exception& e) {
+                        //same url queued by another thread
+                        dbg<<e.what()<<", deferring ["<<work_item.url<<"]\n";
+                        page = 0;
+                        work_queue.push_front(work_item, root_url);
+                        ready_at += LOCKED_RETRY;
                     }
 
-                    dbg<<"crawling page ["<<work_item.url<<"]\n";
-                    crawl(work_item, page, robots);
-                    //reset to default
-                    sleep_time = microseconds(TOO_MANY_RETRIES_TIME);
+                    if(page) {
+                        //unchanged pages need not be written back
+                        bool page_changed = false;
+
+                        //measures to prevent excessive crawling
+                        std::chrono::hours one_day(24);
+                        if(duration_cast<std::chrono::hours> (now_time - page->last_crawl)
+                           >= one_day) {
+                            dbg<<"page->last_visit > 24 hours, resetting count\n";
+                            page->crawl_count = 0;
+                            page_changed = true;
+                        }
 
-                } else {
-                    dbg<<"page ["<<work_item.url<<"] has either been recently crawled or root domain ["<<root_url<<"] has recently been visited\n";
-                    dbg_2<<"crawl count: "<<page->crawl_count<<std::endl;
-                    dbg_2<<"root domain last crawl time: "<<std::chrono::system_clock::to_time_t(root_page->last_crawl)<<std::endl;
-                    dbg_2<<"delta to now: "<<duration_cast<seconds>(now_time - root_page->last_crawl).count()<<std::endl;
-                    dbg_2<<"crawl delay: "<<robots->crawl_delay().count()<<std::endl;
-
-                    //heuristic back-off
-                    if((duration_cast<seconds>(now_time - root_page->last_crawl)
-                       < robots->crawl_delay()) and (duration_cast<microseconds>
-                       (now_time - last_backoff) >= microseconds(TOO_MANY_RETRIES_TIME)))
-                    {
-                        sleep_time += duration_cast<microseconds>(seconds(1));
-
-                        if(duration_cast<seconds>(sleep_time) > robots_refresh_time) {
-                            sleep_time = duration_cast<microseconds>(robots_refresh_time);
+                        //if *this* page has been crawled too often already (past
+                        //24hrs) it goes back to the master.
+                        if(page->crawl_count >= cfg.day_max_crawls) {
+                            dbg<<"page ["<<work_item.url<<"] has been crawled too often, requeueing\n";
+                            dbg_2<<"crawl count: "<<page->crawl_count<<std::endl;
+
+                            //re-queue page for later processing
+                            ipc->send_item(work_item);
+
+                        } else if(!hosts->begin_fetch(host)) {
+                            //lost the domain to another thread, whose fetch
+                            //may be in flight a while
+                            work_queue.push_front(work_item, root_url);
+                            ready_at += LOCKED_RETRY;
+
+                        } else {
+                            //page and robots are put back once fetched
+                            dbg<<"crawling page ["<<work_item.url<<"]\n";
+                            started = new fetch_s{work_item, root_url, page, page_changed,
+                                robots, robots_changed, &host};
                         }
-                        dbg<<"upping backoff, sleep_time now "<<sleep_time.count()<<std::endl;
-                    }
-                    last_backoff = std::chrono::system_clock::now();
 
-                    //re-queue page for later processing
-                    ipc->send_item(work_item);
+                        if(!started) {
+                            ready_at = std::max(ready_at, hosts->next_fetch(host));
+                            pages->put_object_nblk(page, work_item.url, page_changed);
+                        }
+                    }
                 }
 
-                page_mgr.put_object_nblk(page, work_item.url);
-                if(work_item.url != root_url)
-                    page_mgr.put_object_nblk(root_page, root_url);
-
             //domains robots.txt lists this page as now excluded, so we
             //remove it from the database.
             } else {
                 dbg<<"page ["<<work_item.url<<"] excluded, removing from database & memory\n";
-
-                //send all page credit to tax
-                page->rank = tax(work_item.credit + page->rank, CREDIT_TAX_ALL);
-                page_mgr.delete_object_nblk(page, work_item.url);
+                try {
+                    page_data_c* page = pages->get_object_nblk(work_item.url);
+
+                    //send all page credit to tax
+                    page->rank = tax(work_item.credit + page->rank, CREDIT_TAX_ALL);
+                    pages->delete_object_nblk(page, work_item.url);
+                } catch(memory_exception& e) {
+                    //whoever holds the page will find it excluded too
+                    dbg<<e.what()<<", dropping ["<<work_item.url<<"]\n";
+                }
             }
 
-            //robots_txt no longer needed
-            robots_mgr.put_object_nblk(robots, root_url);
+            //robots_txt no longer needed, unless held by the fetch
+            if(started)
+                start_fetch(started);
+            else
+                robots_store->put_object_nblk(robots, root_url, robots_changed);
 
             dbg<<">done.\n";
-            thread_status = IDLE;
-            std::this_thread::sleep_for(sleep_time);
-        } catch(std::underflow_error& e) {
-            thread_status = ZOMBIE;
-            std::cerr<<"ipc work queue underrun: "<<e.what()<<std::endl;
-            throw std::underflow_error("ipc_client::get_item reports empty");
+            set_status(IDLE);
+        } catch(ipc_exception& e) {
+            //master has no work or could not be reached, try again later
+            std::cerr<<"crawler_thread ipc error: "<<e.what()<<std::endl;
+            set_status(SLEEP);
+            std::this_thread::sleep_for(wait.count() ? std::min<microseconds>(wait, IPC_RETRY) : IPC_RETRY);
+        } catch(std::exception& e) {
+            //the item is lost, but not the thread
+            std::cerr<<"crawler_thread error: "<<e.what()<<std::endl;
         }
     }
+
+    //pages in flight are parsed and their objects put back
+    netio_obj->run();
+
+    //work not yet crawled goes back to the master
+    std::vector<queue_node_s> unfinished;
+    work_queue.drain(unfinished);
+    dbg<<"returning "<<unfinished.size()<<" work items to master\n";
+    try {
+        for(auto& item: unfinished)
+            ipc->send_item(item);
+        ipc->flush();
+    } catch(ipc_exception& e) {
+        std::cerr<<"crawler_thread failed to return work to master: "<<e.what()<<std::endl;
+    }
+
+    thread_status = ZOMBIE;
+}
+
+void crawler_thread::start_fetch(struct fetch_s* f)
+{
+    netio_obj->fetch_async(f->work_item.url, [this, f](std::string& url, std::string& data, bool ok)
+        {
+            fetched(f, data, ok);
+        });
+}
+
+//completes start_fetch(), from netio_obj->perform() on this thread. Nothing
+//may be thrown back into netio
+void crawler_thread::fetched(struct fetch_s* f, std::string& data, bool ok)
+{
+    host_scheduler::time_point_t ready_at = std::chrono::steady_clock::now();
+
+    try {
+        hosts->end_fetch(*f->host, ok);
+        ready_at = hosts->next_fetch(*f->host);
+
+        if(!ok)
+            std::cerr<<"failed to fetch ["<<f->work_item.url<<"]: "<<data<<std::endl;
+        else if(crawl(f->work_item, f->page, data))
+            f->page_changed = true;
+
+        pages->put_object_nblk(f->page, f->work_item.url, f->page_changed);
+        robots_store->put_object_nblk(f->robots, f->root_url, f->robots_changed);
+    } catch(std::exception& e) {
+        //the item is lost, but not its domain
+        std::cerr<<"crawler_thread error: "<<e.what()<<std::endl;
+    }
+
+    hosts->release(f->root_url);
+    work_queue.complete(f->root_url, ready_at);
+    delete f;
 }
 
-void crawler_thread::crawl(queue_node_s& work_item, page_data_c* page, robots_txt* robots)
+//extracts data from the fetched page, returns false if it could not be parsed
+bool crawler_thread::crawl(queue_node_s& work_item, page_data_c* page, std::string& data)
 {
-    //parse page
-    parser page_parser(work_item.url);
-    page_parser.parse(cfg.parse_param);
+    page_parser.reset(work_item.url, *profile);
+    if(!page_parser.parse_chunk(data.data(), data.size())) {
+        std::cerr<<"failed to parse ["<<work_item.url<<"]"<<std::endl;
+        return false;
+    }
+    page_parser.parse(*profile);
 
     if(!page_parser.data.empty()) {
         //will be replaced by new data from parser
@@ -297,6 +477,8 @@ void crawler_thread::crawl(queue_node_s& work_item, page_data_c* page, robots_tx
             }
         }
     }
+
+    return true;
 }
 
 unsigned int crawler_thread::tax(unsigned int credit, unsigned int percent)
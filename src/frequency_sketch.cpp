@@ -0,0 +1,75 @@
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "frequency_sketch.hpp"
+#include "debug.hpp"
+
+//per row multipliers spreading one hash over the table
+static const uint64_t row_seed[SKETCH_DEPTH] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+    0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+};
+
+frequency_sketch::frequency_sketch(size_t capacity)
+{
+    //one word of 16 counters per cached key, rounded up to a power of 2
+    size_t width = 1;
+    while(width < capacity)
+        width <<= 1;
+
+    table.assign(width, 0);
+    mask = width-1;
+    sample_size = SKETCH_SAMPLE_RATIO*(capacity ? capacity : 1);
+    additions = 0;
+}
+
+size_t frequency_sketch::index_of(size_t hash, int row)
+{
+    uint64_t h = ((uint64_t)hash + row_seed[row])*row_seed[row];
+    h += h>>32;
+    return (size_t)h & mask;
+}
+
+void frequency_sketch::increment(size_t hash)
+{
+    bool added = false;
+
+    for(int i = 0; i < SKETCH_DEPTH; ++i) {
+        //each row uses its own group of 4 counters in the word
+        unsigned int offset = (i<<2) + ((hash>>(i<<3)) & 3);
+        uint64_t& word = table[index_of(hash, i)];
+
+        if(((word>>(offset<<2)) & 0xf) < 0xf) {
+            word += 1ULL<<(offset<<2);
+            added = true;
+        }
+    }
+
+    if(added && ++additions >= sample_size)
+        reset();
+}
+
+unsigned int frequency_sketch::frequency(size_t hash)
+{
+    unsigned int f = 0xf;
+
+    for(int i = 0; i < SKETCH_DEPTH; ++i) {
+        unsigned int offset = (i<<2) + ((hash>>(i<<3)) & 3);
+        unsigned int count = (table[index_of(hash, i)]>>(offset<<2)) & 0xf;
+        if(count < f)
+            f = count;
+    }
+
+    return f;
+}
+
+//ages all counters
+void frequency_sketch::reset(void)
+{
+    dbg_1<<"halving sketch counters after "<<additions<<" additions\n";
+
+    for(auto& word: table)
+        word = (word>>1) & 0x7777777777777777ULL;
+    additions /= 2;
+}
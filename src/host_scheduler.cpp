@@ -0,0 +1,138 @@
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <chrono>
+
+#include "host_scheduler.hpp"
+#include "ipc_common.hpp"
+#include "debug.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+host_scheduler::host_scheduler(void)
+{
+    items = 0;
+    pops = 0;
+}
+
+void host_scheduler::push(struct queue_node_s& item, std::string& host)
+{
+    std::unordered_map<std::string, struct host_queue_s>::iterator it = hosts.find(host);
+    if(it == hosts.end()) {
+        struct host_queue_s q;
+        q.ready_at = std::chrono::steady_clock::now();
+        q.busy = false;
+        q.scheduled = false;
+        it = hosts.insert(std::make_pair(host, q)).first;
+        dbg_1<<"scheduler: new host ["<<host<<"]\n";
+    }
+
+    it->second.items.push_back(item);
+    ++items;
+    schedule(it->first, it->second);
+}
+
+void host_scheduler::push_front(struct queue_node_s& item, std::string& host)
+{
+    struct host_queue_s& q = hosts[host];
+    q.items.push_front(item);
+    ++items;
+}
+
+bool host_scheduler::pop(struct queue_node_s& item, std::string& host, microseconds& wait)
+{
+    time_point_t now = std::chrono::steady_clock::now();
+    wait = microseconds(0);
+
+    if(++pops%SCHEDULER_PRUNE_INTERVAL == 0)
+        prune();
+
+    while(!ready_heap.empty()) {
+        heap_entry_t top = ready_heap.top();
+        std::unordered_map<std::string, struct host_queue_s>::iterator it = hosts.find(top.second);
+
+        //stale entry
+        if(it == hosts.end() || it->second.ready_at != top.first || it->second.busy
+           || it->second.items.empty()) {
+            ready_heap.pop();
+            if(it != hosts.end() && it->second.ready_at == top.first)
+                it->second.scheduled = false;
+            continue;
+        }
+
+        if(top.first > now) {
+            wait = duration_cast<microseconds>(top.first - now);
+            dbg_1<<"scheduler: no host ready, next in "<<wait.count()<<"us\n";
+            return false;
+        }
+
+        ready_heap.pop();
+        struct host_queue_s& q = it->second;
+        q.scheduled = false;
+        q.busy = true;
+
+        item = q.items.front();
+        q.items.pop_front();
+        --items;
+        host = it->first;
+
+        dbg_1<<"scheduler: host ["<<host<<"] ready, "<<q.items.size()<<" items left for host\n";
+        return true;
+    }
+
+    return false;
+}
+
+void host_scheduler::complete(std::string& host, time_point_t ready_at)
+{
+    std::unordered_map<std::string, struct host_queue_s>::iterator it = hosts.find(host);
+    if(it == hosts.end())
+        return;
+
+    it->second.busy = false;
+    it->second.ready_at = ready_at;
+    it->second.scheduled = false;
+    schedule(it->first, it->second);
+}
+
+void host_scheduler::drain(std::vector<struct queue_node_s>& drained)
+{
+    for(auto& h: hosts) {
+        drained.insert(drained.end(), h.second.items.begin(), h.second.items.end());
+        h.second.items.clear();
+    }
+    items = 0;
+}
+
+size_t host_scheduler::size(void)
+{
+    return items;
+}
+
+//adds a heap entry for @q, if it has work and is not already waiting in the heap
+void host_scheduler::schedule(const std::string& host, struct host_queue_s& q)
+{
+    if(q.busy || q.scheduled || q.items.empty())
+        return;
+
+    ready_heap.push(heap_entry_t(q.ready_at, host));
+    q.scheduled = true;
+}
+
+//forgets hosts with no work whose ready time has passed, a later push treats
+//them as new (and so ready) which is then equivalent
+void host_scheduler::prune(void)
+{
+    time_point_t now = std::chrono::steady_clock::now();
+
+    for(std::unordered_map<std::string, struct host_queue_s>::iterator it = hosts.begin(); it != hosts.end();) {
+        if(!it->second.busy && it->second.items.empty() && it->second.ready_at <= now)
+            it = hosts.erase(it);
+        else
+            ++it;
+    }
+    dbg_1<<"scheduler: pruned idle hosts, "<<hosts.size()<<" remain\n";
+}
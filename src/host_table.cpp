@@ -0,0 +1,133 @@
+#include <iostream>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+#include "host_table.hpp"
+#include "debug.hpp"
+
+host_table::host_table(void)
+{
+    for(auto& shard: shards)
+        shard.lookups = 0;
+}
+
+struct host_state_s& host_table::get(std::string& host)
+{
+    struct shard_s& shard = shard_of(host);
+
+    std::lock_guard<std::mutex> lock(shard.lock);
+    if(++shard.lookups%HOST_PRUNE_INTERVAL == 0)
+        prune(shard);
+
+    struct host_state_s& state = shard.hosts[host];
+    ++state.users;
+    return state;
+}
+
+void host_table::release(std::string& host)
+{
+    struct shard_s& shard = shard_of(host);
+
+    std::lock_guard<std::mutex> lock(shard.lock);
+    std::unordered_map<std::string, struct host_state_s>::iterator it = shard.hosts.find(host);
+    if(it != shard.hosts.end() && it->second.users > 0)
+        --it->second.users;
+}
+
+host_table::time_point_t host_table::next_fetch(struct host_state_s& host)
+{
+    long long last = host.last_fetch.load();
+    if(last == 0)
+        return std::chrono::steady_clock::now();
+
+    return time_point_t(std::chrono::steady_clock::duration(last)) + delay(host);
+}
+
+bool host_table::ready(struct host_state_s& host)
+{
+    //a host never fetched from is ready, whatever the clock now reads
+    time_point_t now = std::chrono::steady_clock::now();
+    return host.in_flight.load() == 0 && (host.last_fetch.load() == 0 || next_fetch(host) <= now);
+}
+
+bool host_table::begin_fetch(struct host_state_s& host)
+{
+    //claimed first, so that only one thread gets past whatever the delay
+    unsigned int idle = 0;
+    if(!host.in_flight.compare_exchange_strong(idle, 1)) {
+        dbg_1<<"host fetch claimed by another thread\n";
+        return false;
+    }
+
+    //last_fetch is only moved on by the claim holder
+    time_point_t now = std::chrono::steady_clock::now();
+    if(host.last_fetch.load() != 0 && next_fetch(host) > now) {
+        --host.in_flight;
+        return false;
+    }
+    host.last_fetch = now.time_since_epoch().count();
+
+    return true;
+}
+
+void host_table::end_fetch(struct host_state_s& host, bool ok)
+{
+    --host.in_flight;
+    if(ok)
+        host.errors = 0;
+    else
+        ++host.errors;
+}
+
+size_t host_table::size(void)
+{
+    size_t n = 0;
+    for(auto& shard: shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        n += shard.hosts.size();
+    }
+    return n;
+}
+
+struct host_table::shard_s& host_table::shard_of(std::string& host)
+{
+    std::hash<std::string> h;
+    return shards[h(host)%HOST_TABLE_SHARDS];
+}
+
+//crawl delay, backed off after errors
+std::chrono::seconds host_table::delay(struct host_state_s& host)
+{
+    long long base = host.crawl_delay.load();
+    unsigned int backoff = host.errors.load();
+    if(!backoff)
+        return std::chrono::seconds(base);
+
+    if(backoff > HOST_MAX_BACKOFF)
+        backoff = HOST_MAX_BACKOFF;
+    if(base < HOST_BACKOFF_BASE)
+        base = HOST_BACKOFF_BASE;
+    return std::chrono::seconds(base << backoff);
+}
+
+//drops hosts of @shard not in use and idle for HOST_IDLE_DELAYS of their
+//delay. Shard lock held
+void host_table::prune(struct shard_s& shard)
+{
+    time_point_t now = std::chrono::steady_clock::now();
+
+    for(std::unordered_map<std::string, struct host_state_s>::iterator it = shard.hosts.begin(); it != shard.hosts.end();) {
+        struct host_state_s& h = it->second;
+        long long last = h.last_fetch.load();
+
+        if(!h.users && !h.in_flight.load() &&
+           (last == 0 || time_point_t(std::chrono::steady_clock::duration(last)) + HOST_IDLE_DELAYS*delay(h) <= now))
+            it = shard.hosts.erase(it);
+        else
+            ++it;
+    }
+    dbg_1<<"host table: pruned idle hosts, "<<shard.hosts.size()<<" remain in shard\n";
+}
@@ -2,44 +2,138 @@
 #define CACHE_H
 
 #include <iostream>
-#include <map>
 #include <unordered_map>
 #include <mutex>
-#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 
 #include "page_data.hpp"
 #include "robots_txt.hpp"
+#include "frequency_sketch.hpp"
 #include "debug.hpp"
 
-//total number of objects stored in cache
-#define CACHE_MAX   10*1024
-//TO DO: number of entries to keep free
+//default memory budget of a cache, KiB
+#define CACHE_MAX   32*1024
+//default part of the budget kept free, KiB
 #define CACHE_RES   0
-//total cache size is thus CACHE_MAX - CACHE_RES
+//objects are thus cached up to CACHE_MAX - CACHE_RES
 
+//number of independently locked cache partitions, power of 2
+#define CACHE_SHARDS 16
+
+//W-TinyLFU segment sizes, percent of a shard
+#define CACHE_WINDOW_PERCENT    1
+#define CACHE_PROTECTED_PERCENT 80  //of the main (non window) area
+
+/**
+ * result of a cache lookup
+ */
+enum cache_result_e {
+    cache_miss,     //no entry for key
+    cache_hit,      //entry found and locked for the caller
+    cache_locked    //entry found but already locked by another caller
+};
+
+/**
+ * admission and eviction policy of a cache instance
+ */
+enum cache_policy_e {
+    cache_lru,      //admit everything, evict least recently used
+    cache_tinylfu   //W-TinyLFU, see cache class
+};
+
+/**
+ * cache counters, summed over all shards
+ */
+struct cache_stats_s {
+    size_t bytes;               //estimated footprint of cached objects
+    size_t dirty_bytes;         //of which not yet written back
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long rejected;     //new objects refused admission (tinylfu)
+};
+
+/**
+ * Caches are shared by every crawler thread of a worker, so a cached object
+ * is only ever handed to one caller at a time: lookups lock the object
+ * (@T::lock()) and put_object() unlocks it. Locked objects are never evicted.
+ *
+ * Keys are spread over CACHE_SHARDS shards, each with its own lock and
+ * least recently used lists, so that threads working on different keys
+ * rarely contend. The memory budget is split evenly between shards.
+ *
+ * Objects are accounted by @T::footprint(), taken when they enter the cache
+ * and whenever they are put back. Objects fill the budget less its reserve,
+ * the reserve leaves room for locked objects (which cannot be evicted) to
+ * grow.
+ *
+ * Objects put back as dirty are written back by flush(), through the
+ * handlers set with on_writeback_many() or on_writeback(). Until then they
+ * are not evicted either, writing them back would hold up the shard, so a
+ * shard over budget is trimmed once flush() has written them.
+ *
+ * With cache_tinylfu, new objects enter a small LRU window. Objects leaving
+ * the window only replace the oldest object of the main segmented LRU if
+ * their estimated access frequency is higher, so long scans of one-off keys
+ * cannot flush frequently used ones. Objects hit in the main area's
+ * probation segment are promoted to its protected segment. cache_lru is the
+ * same structure with a window spanning the whole shard.
+ */
 template<class T> class cache
 {
     public:
-    cache(void);
+    /**
+     * persists a dirty object, may throw
+     */
+    typedef std::function<void(T* t, std::string& key)> writeback_handler;
+
+    /**
+     * persists many dirty objects at once, throws if any failed
+     */
+    typedef std::function<void(std::vector<T*>& objects, std::vector<std::string>& keys)> batch_writeback_handler;
+
+    cache(cache_policy_e policy = cache_lru, size_t max_bytes = CACHE_MAX*1024,
+          size_t res_bytes = CACHE_RES*1024);
+
+    /**
+     * Frees all cached objects. Objects still held by callers must not be
+     * used afterwards.
+     */
+    ~cache(void);
 
     /**
      * Blocking synchronous call to retrieve object from cache. Automatically
      * locks entry to prevent concurrent access.
      *
      * If @key entry exists in cache, @t* will point to valid memory and
-     * method returns true. If no entry exists method returns false, @t*
-     * is undefined and should not be used.
+     * method returns cache_hit, or cache_locked if another caller holds the
+     * object (which must then not be used). If no entry exists method returns
+     * cache_miss, @t* is undefined and should not be used.
+     */
+    cache_result_e get_object(T** t, std::string& key);
+
+    /**
+     * Inserts newly allocated (unlocked) @t* at @key, locked for the caller,
+     * unless another caller inserted @key first. In that case @t* is freed
+     * and replaced by the cached object, as if get_object() had been called.
+     *
+     * Returns cache_hit or cache_locked, as get_object().
      */
-    bool get_object(T** t, std::string& key);
+    cache_result_e add_object(T** t, std::string& key);
 
     /**
      * Blocking call to put object into cache. If object was previously
      * retrieved by this session its entry is unlocked afterwards. Concurrent
      * writes should not occure and method behaviour is then undefined.
      *
-     * Will return true if @t made it to cache.
+     * Will return true if @t made it to cache. If @dirty is set the object
+     * is marked as needing write back, it stays marked until written.
      */
-    bool put_object(T* t, std::string& key);
+    bool put_object(T* t, std::string& key, bool dirty = false);
 
     /**
      * Blocking method to remove an entry from cache. This will not delete
@@ -48,145 +142,584 @@ template<class T> class cache
      */
     void delete_object(std::string& key);
 
+    /**
+     * returns hit, miss and eviction counts since creation
+     */
+    struct cache_stats_s stats(void);
+
+    /**
+     * Changes the memory budget and reserve, evicting objects if the cache
+     * is now over budget. May be called whilst the cache is in use.
+     */
+    void resize(size_t max_bytes, size_t res_bytes);
+
+    /**
+     * sets the handler used to write back dirty objects
+     */
+    void on_writeback(writeback_handler handler);
+
+    /**
+     * Sets the handler flush() writes back each shard's dirty objects with,
+     * all in one call. If it throws they are all marked dirty again. Without
+     * one flush() uses the on_writeback() handler, an object at a time.
+     */
+    void on_writeback_many(batch_writeback_handler handler);
+
+    /**
+     * true if @key is cached, does not count as an access
+     */
+    bool contains(std::string& key);
+
+    /**
+     * Writes back all dirty objects not held by a caller, locking each
+     * whilst it is written, then evicts down to budget. Returns the number
+     * of objects written.
+     */
+    unsigned int flush(void);
+
+    /**
+     * estimated bytes of dirty objects, does not block
+     */
+    size_t dirty_bytes(void);
+
     private:
-    typedef std::chrono::steady_clock::time_point time_point_t;
-    typedef std::map<time_point_t, std::string> access_map_t;
+    enum segment_e {
+        seg_window,
+        seg_probation,
+        seg_protected,
+        seg_count
+    };
 
+    //entries are linked into one of their shard's LRU lists in place, list
+    //heads are the most recently used entries.
     struct cache_entry_s {
         T* t;
-        time_point_t timestamp;
-        // semaphore access counter
+        const std::string* key;     //owned by the map node holding this entry
+        size_t hash;
+        size_t size;                //footprint when last put
+        bool dirty;
+        bool flushing;              //locked by flush(), not by a caller
+        segment_e segment;
+        struct cache_entry_s* prev;
+        struct cache_entry_s* next;
     };
     typedef std::unordered_map<std::string, struct cache_entry_s> data_map_t;
 
-    data_map_t obj_map;
-    access_map_t obj_access;
-    std::mutex rw_mutex;
-    int fill;
+    struct lru_list_s {
+        struct cache_entry_s* head;
+        struct cache_entry_s* tail;
+        size_t bytes;
+    };
 
-    //non-threaded
-    void prune_cache(void);
-    void update_timestamp(std::string& key, time_point_t new_time);
+    struct cache_shard_s {
+        std::mutex rw_mutex;
+        std::condition_variable flushed;    //signalled as flush() releases objects
+        data_map_t obj_map;
+        struct lru_list_s lists[seg_count];
+        frequency_sketch* sketch;   //0 for cache_lru
+        struct cache_stats_s counters;
+        size_t dirty_bytes;
+
+        //budget in bytes, per segment
+        size_t window_max;
+        size_t main_max;            //probation + protected
+        size_t protected_max;
+    };
+
+    struct cache_shard_s shards[CACHE_SHARDS];
+    cache_policy_e policy;
+    std::hash<std::string> key_hash;
+    writeback_handler writeback;
+    batch_writeback_handler writeback_many;
+    std::atomic<size_t> total_dirty;
+
+    struct cache_shard_s& shard_of(std::string& key, size_t& hash);
+
+    //non-threaded, called with the shard's rw_mutex held
+    void set_budget(struct cache_shard_s& s, size_t shard_bytes);
+    void set_dirty(struct cache_shard_s& s, struct cache_entry_s* e, bool dirty);
+    typename data_map_t::iterator find(struct cache_shard_s& s, std::unique_lock<std::mutex>& lock, std::string& key);
+    void link_front(struct cache_shard_s& s, struct cache_entry_s* e, segment_e seg);
+    void unlink(struct cache_shard_s& s, struct cache_entry_s* e);
+    void touch(struct cache_shard_s& s, struct cache_entry_s* e);
+    struct cache_entry_s* insert(struct cache_shard_s& s, T* t, std::string& key, size_t hash);
+    void balance(struct cache_shard_s& s, struct cache_entry_s* keep);
+    struct cache_entry_s* oldest_unlocked(struct cache_shard_s& s, segment_e seg, struct cache_entry_s* keep);
+    void evict(struct cache_shard_s& s, struct cache_entry_s* e);
+    cache_result_e lock_entry(T* t);
 };
 
-template<class T> cache<T>::cache(void)
+template<class T> cache<T>::cache(cache_policy_e policy, size_t max_bytes, size_t res_bytes)
 {
-    fill = 0;
+    size_t shard_bytes = (max_bytes - std::min(res_bytes, max_bytes))/CACHE_SHARDS;
+    this->policy = policy;
+    total_dirty = 0;
+
+    for(auto& s: shards) {
+        for(auto& l: s.lists) {
+            l.head = 0;
+            l.tail = 0;
+            l.bytes = 0;
+        }
+
+        //sketch width follows the number of average sized pages that fit
+        s.sketch = (policy == cache_tinylfu) ? new frequency_sketch(shard_bytes/1024 + 1) : 0;
+        s.counters = cache_stats_s();
+        s.dirty_bytes = 0;
+        set_budget(s, shard_bytes);
+    }
 }
 
-template<class T> void cache<T>::update_timestamp(std::string& key, time_point_t new_time)
+template<class T> void cache<T>::set_budget(struct cache_shard_s& s, size_t shard_bytes)
 {
-    //delete old timestamp from access map
-    time_point_t old_time = obj_map.at(key).timestamp;
-    obj_access.erase(obj_access.find(old_time));
+    if(policy == cache_tinylfu) {
+        s.window_max = shard_bytes*CACHE_WINDOW_PERCENT/100;
+        s.main_max = shard_bytes - s.window_max;
+        s.protected_max = s.main_max*CACHE_PROTECTED_PERCENT/100;
+    } else {
+        s.window_max = shard_bytes;
+        s.main_max = 0;
+        s.protected_max = 0;
+    }
+}
 
-    //update data timestamp
-    obj_map.at(key).timestamp = new_time;
+template<class T> cache<T>::~cache(void)
+{
+    for(auto& s: shards) {
+        for(auto& entry: s.obj_map)
+            delete entry.second.t;
+        delete s.sketch;
+    }
+}
 
-    //update access time
-    obj_access.insert(std::pair<time_point_t, std::string>(new_time, key));
+template<class T> typename cache<T>::cache_shard_s& cache<T>::shard_of(std::string& key, size_t& hash)
+{
+    //upper hash bits, the map buckets use the lower ones
+    hash = key_hash(key);
+    return shards[(hash>>(sizeof(size_t)*8 - 8)) & (CACHE_SHARDS-1)];
+}
+
+template<class T> void cache<T>::link_front(struct cache_shard_s& s, struct cache_entry_s* e, segment_e seg)
+{
+    struct lru_list_s& l = s.lists[seg];
+
+    e->segment = seg;
+    e->prev = 0;
+    e->next = l.head;
+    if(l.head)
+        l.head->prev = e;
+    l.head = e;
+    if(!l.tail)
+        l.tail = e;
+    l.bytes += e->size;
 }
 
-template<class T> bool cache<T>::get_object(T** t, std::string& key)
+template<class T> void cache<T>::unlink(struct cache_shard_s& s, struct cache_entry_s* e)
 {
-    bool in_cache = false;
+    struct lru_list_s& l = s.lists[e->segment];
+
+    if(e->prev)
+        e->prev->next = e->next;
+    else
+        l.head = e->next;
+
+    if(e->next)
+        e->next->prev = e->prev;
+    else
+        l.tail = e->prev;
+    l.bytes -= e->size;
+}
 
-    rw_mutex.lock();
-    try {
-        //will throw exception if page is not in cache
-        *t = obj_map.at(key).t;
-        update_timestamp(key, std::chrono::steady_clock::now());
-        in_cache = true;
+//moves a hit entry to the head of its list, promoting probation entries
+template<class T> void cache<T>::touch(struct cache_shard_s& s, struct cache_entry_s* e)
+{
+    segment_e seg = e->segment;
+    unlink(s, e);
 
-        dbg<<"object ["<<key<<"] in cache\n";
-    } catch(const std::out_of_range& e) {
-        dbg_1<<"object ["<<key<<"] not in cache\n";
+    if(seg != seg_probation) {
+        link_front(s, e, seg);
+        return;
     }
-    rw_mutex.unlock();
 
-    return in_cache;
+    link_front(s, e, seg_protected);
+
+    //protected overflow goes back on probation, nothing is evicted
+    while(s.lists[seg_protected].bytes > s.protected_max) {
+        struct cache_entry_s* demoted = s.lists[seg_protected].tail;
+        unlink(s, demoted);
+        link_front(s, demoted, seg_probation);
+    }
 }
 
-template<class T> bool cache<T>::put_object(T* t, std::string& key)
+//called with rw_mutex held, so that checking and taking the object lock
+//cannot race with other callers
+template<class T> cache_result_e cache<T>::lock_entry(T* t)
 {
-    time_point_t new_time = std::chrono::steady_clock::now();
+    if(t->is_locked())
+        return cache_locked;
 
-    rw_mutex.lock();
-    try {
-        //updating timestamp accesses object in cache (we will need to update
-        //timestamp of existing objects anyway). throws exception for new objects
-        update_timestamp(key, new_time);
-        dbg<<"object ["<<key<<"] already in cache, updating\n";
-    } catch(const std::out_of_range& e) {
-        access_map_t::iterator pos = obj_access.end();
-        struct cache_entry_s entry;
-        entry.t = t;
-        entry.timestamp = new_time;
+    t->lock();
+    return cache_hit;
+}
+
+template<class T> cache_result_e cache<T>::get_object(T** t, std::string& key)
+{
+    cache_result_e ret = cache_miss;
+    size_t hash;
+    struct cache_shard_s& s = shard_of(key, hash);
 
-        if(fill < CACHE_MAX) {
-            //when there's room to fill cache, fill!
-            dbg<<"space in cache to insert object ["<<key<<"]\n";
-            obj_map.insert(std::pair<std::string, struct cache_entry_s>(key, entry));
+    std::unique_lock<std::mutex> lock(s.rw_mutex);
+    //misses count too, that is how a new key earns admission
+    if(s.sketch)
+        s.sketch->increment(hash);
 
-            dbg_1<<"updating access map\n";
-            obj_access.insert(pos, std::pair<time_point_t, std::string>(new_time, key));
+    typename data_map_t::iterator it = find(s, lock, key);
+    if(it != s.obj_map.end()) {
+        struct cache_entry_s* e = &it->second;
+        touch(s, e);
+        ++s.counters.hits;
 
-            ++fill;
+        *t = e->t;
+        ret = lock_entry(*t);
 
-            //usually un-needed, but a number of entries in a mature cache
-            //could be deleted.
-            prune_cache();
-        } else {
-            std::string oldest_key = obj_access.begin()->second;
+        dbg<<"object ["<<key<<"] in cache\n";
+    } else {
+        ++s.counters.misses;
+        dbg_1<<"object ["<<key<<"] not in cache\n";
+    }
 
-            //we do not know the object type, and whilst page objects have
-            //a rank field, robots do not.
-            dbg<<"replacing ["<<oldest_key<<"] in cache for ["<<key<<"]\n";
-            obj_access.erase(obj_map.at(oldest_key).timestamp);
-            obj_map.erase(obj_map.find(oldest_key));
+    return ret;
+}
 
-            obj_map.insert(std::pair<std::string, struct cache_entry_s>(key, entry));
-            obj_access.insert(std::pair<time_point_t, std::string>(new_time, key));
-        }
+template<class T> cache_result_e cache<T>::add_object(T** t, std::string& key)
+{
+    cache_result_e ret;
+    size_t hash;
+    struct cache_shard_s& s = shard_of(key, hash);
+
+    std::unique_lock<std::mutex> lock(s.rw_mutex);
+    typename data_map_t::iterator it = find(s, lock, key);
+    if(it != s.obj_map.end()) {
+        //lost the race to another caller, use their copy
+        dbg<<"object ["<<key<<"] added concurrently, discarding copy\n";
+        delete *t;
+
+        struct cache_entry_s* e = &it->second;
+        touch(s, e);
+        *t = e->t;
+    } else {
+        insert(s, *t, key, hash);
     }
-    rw_mutex.unlock();
+    ret = lock_entry(*t);
+
+    return ret;
+}
+
+template<class T> bool cache<T>::put_object(T* t, std::string& key, bool dirty)
+{
+    size_t hash;
+    struct cache_shard_s& s = shard_of(key, hash);
+
+    s.rw_mutex.lock();
+    typename data_map_t::iterator it = s.obj_map.find(key);
+    if(it != s.obj_map.end()) {
+        dbg<<"object ["<<key<<"] already in cache, updating\n";
+        struct cache_entry_s* e = &it->second;
+
+        //object may have grown whilst held by the caller
+        bool was_dirty = e->dirty;
+        set_dirty(s, e, false);
+        unlink(s, e);
+        e->size = t->footprint();
+        link_front(s, e, e->segment);
+        set_dirty(s, e, was_dirty || dirty);
+        touch(s, e);
+        balance(s, e);
+    } else {
+        //not looked up through get_object()
+        if(s.sketch)
+            s.sketch->increment(hash);
+        set_dirty(s, insert(s, t, key, hash), dirty);
+    }
+
+    //unlocked under rw_mutex, see lock_entry()
+    if(t->is_locked())
+        t->unlock();
+    s.rw_mutex.unlock();
 
     dbg<<"done\n";
     return true;
 }
 
+template<class T> typename cache<T>::cache_entry_s* cache<T>::insert(struct cache_shard_s& s, T* t, std::string& key, size_t hash)
+{
+    dbg<<"inserting object ["<<key<<"]\n";
+    std::pair<typename data_map_t::iterator, bool> r =
+        s.obj_map.insert(std::pair<std::string, struct cache_entry_s>(key, cache_entry_s()));
+
+    //map nodes do not move on rehash, so the entry may point at its own key
+    struct cache_entry_s* e = &r.first->second;
+    e->t = t;
+    e->key = &r.first->first;
+    e->hash = hash;
+    e->size = t->footprint();
+    e->dirty = false;
+    e->flushing = false;
+    link_front(s, e, seg_window);
+
+    //the caller still needs the new object
+    balance(s, e);
+    return e;
+}
+
 /**
- * Helper function to remove excess (>CACHE_MAX) entries from cache and
- * cache maps
+ * Moves objects overflowing the window into the main area, where each
+ * candidate competes with the main area's oldest objects for room. If every
+ * object is in use or dirty the shard grows, and is trimmed back by later
+ * puts or flush().
+ * @keep is never evicted.
  */
-template<class T> void cache<T>::prune_cache(void)
+template<class T> void cache<T>::balance(struct cache_shard_s& s, struct cache_entry_s* keep)
 {
-    while(fill-(CACHE_MAX-CACHE_RES) > 0) {
-        dbg_1<<"objects to prune "<<(fill-(CACHE_MAX-CACHE_RES))<<std::endl;
+    while(s.lists[seg_window].bytes > s.window_max) {
+        struct cache_entry_s* candidate = oldest_unlocked(s, seg_window, keep);
+        if(!candidate)
+            break;
+
+        unlink(s, candidate);
+        link_front(s, candidate, seg_probation);
+
+        while(s.lists[seg_probation].bytes + s.lists[seg_protected].bytes > s.main_max) {
+            struct cache_entry_s* victim = oldest_unlocked(s, seg_probation, candidate);
+            if(!victim)
+                victim = oldest_unlocked(s, seg_protected, candidate);
+
+            //ties go to the resident object, one-off keys never displace it
+            if(victim && s.sketch->frequency(candidate->hash) > s.sketch->frequency(victim->hash)) {
+                evict(s, victim);
+            } else {
+                if(victim)
+                    ++s.counters.rejected;
+                evict(s, candidate);
+                break;
+            }
+        }
+    }
+
+    //objects grown or budget shrunk in the main area
+    while(s.lists[seg_probation].bytes + s.lists[seg_protected].bytes > s.main_max) {
+        struct cache_entry_s* victim = oldest_unlocked(s, seg_probation, keep);
+        if(!victim)
+            victim = oldest_unlocked(s, seg_protected, keep);
+        if(!victim)
+            break;
+
+        evict(s, victim);
+    }
+}
 
-        delete obj_map.at(obj_access.begin()->second).t;
-        obj_map.erase(obj_map.find(obj_access.begin()->second));
-        obj_access.erase(obj_access.begin());
-        --fill;
+//oldest entry which may be evicted, dirty ones wait for flush()
+template<class T> typename cache<T>::cache_entry_s* cache<T>::oldest_unlocked(struct cache_shard_s& s, segment_e seg, struct cache_entry_s* keep)
+{
+    for(struct cache_entry_s* e = s.lists[seg].tail; e; e = e->prev) {
+        if(e != keep && !e->dirty && !e->t->is_locked())
+            return e;
     }
+
+    return 0;
+}
+
+//frees an object not held by any caller, nor dirty
+template<class T> void cache<T>::evict(struct cache_shard_s& s, struct cache_entry_s* e)
+{
+    //we do not know the object type, and whilst page objects have
+    //a rank field, robots do not.
+    dbg<<"evicting ["<<*e->key<<"] from cache\n";
+
+    unlink(s, e);
+    delete e->t;
+    s.obj_map.erase(s.obj_map.find(*e->key));
+    ++s.counters.evictions;
 }
 
 template<class T> void cache<T>::delete_object(std::string& key)
 {
     dbg<<"deleting object at ["<<key<<"]\n";
+    size_t hash;
+    struct cache_shard_s& s = shard_of(key, hash);
 
-    rw_mutex.lock();
-    try {
-        //reverse lookup access map entries (ame)
-        time_point_t ame = obj_map.at(key).timestamp;
-
+    s.rw_mutex.lock();
+    typename data_map_t::iterator it = s.obj_map.find(key);
+    if(it != s.obj_map.end()) {
         dbg<<"removing page ["<<key<<"]\n";
-        obj_access.erase(obj_access.find(ame));
-        obj_map.erase(key);
-    } catch(const std::exception& e) {
+        set_dirty(s, &it->second, false);
+        unlink(s, &it->second);
+        s.obj_map.erase(it);
+    } else {
         dbg<<"cannot delete page - not in cache\n";
     }
-    rw_mutex.unlock();
+    s.rw_mutex.unlock();
+}
+
+template<class T> struct cache_stats_s cache<T>::stats(void)
+{
+    struct cache_stats_s total = cache_stats_s();
+
+    for(auto& s: shards) {
+        s.rw_mutex.lock();
+        for(auto& l: s.lists)
+            total.bytes += l.bytes;
+        total.dirty_bytes += s.dirty_bytes;
+        total.hits += s.counters.hits;
+        total.misses += s.counters.misses;
+        total.evictions += s.counters.evictions;
+        total.rejected += s.counters.rejected;
+        s.rw_mutex.unlock();
+    }
+
+    return total;
+}
+
+template<class T> void cache<T>::resize(size_t max_bytes, size_t res_bytes)
+{
+    size_t shard_bytes = (max_bytes - std::min(res_bytes, max_bytes))/CACHE_SHARDS;
+    dbg<<"resizing cache to "<<max_bytes<<" bytes, reserving "<<res_bytes<<std::endl;
+
+    for(auto& s: shards) {
+        s.rw_mutex.lock();
+        set_budget(s, shard_bytes);
+        balance(s, 0);
+        s.rw_mutex.unlock();
+    }
+}
+
+//looks up @key, waiting out any flush() of it: a write back is short and
+//should not look to callers like the object is in use. Called with @lock held
+template<class T> typename cache<T>::data_map_t::iterator cache<T>::find(struct cache_shard_s& s, std::unique_lock<std::mutex>& lock, std::string& key)
+{
+    typename data_map_t::iterator it = s.obj_map.find(key);
+
+    while(it != s.obj_map.end() && it->second.flushing) {
+        s.flushed.wait(lock);
+
+        //entry may have gone whilst unlocked
+        it = s.obj_map.find(key);
+    }
+
+    return it;
+}
+
+//keeps shard and cache dirty byte counts in step with an entry's flag
+template<class T> void cache<T>::set_dirty(struct cache_shard_s& s, struct cache_entry_s* e, bool dirty)
+{
+    if(e->dirty == dirty)
+        return;
+
+    e->dirty = dirty;
+    if(dirty) {
+        s.dirty_bytes += e->size;
+        total_dirty += e->size;
+    } else {
+        s.dirty_bytes -= e->size;
+        total_dirty -= e->size;
+    }
+}
+
+template<class T> void cache<T>::on_writeback(writeback_handler handler)
+{
+    writeback = handler;
+}
+
+template<class T> void cache<T>::on_writeback_many(batch_writeback_handler handler)
+{
+    writeback_many = handler;
+}
+
+template<class T> bool cache<T>::contains(std::string& key)
+{
+    size_t hash;
+    struct cache_shard_s& s = shard_of(key, hash);
+
+    std::lock_guard<std::mutex> lock(s.rw_mutex);
+    return s.obj_map.find(key) != s.obj_map.end();
+}
+
+template<class T> size_t cache<T>::dirty_bytes(void)
+{
+    return total_dirty;
+}
+
+template<class T> unsigned int cache<T>::flush(void)
+{
+    unsigned int written = 0;
+
+    for(auto& s: shards) {
+        std::vector<struct cache_entry_s*> batch;
+
+        //claim the shard's dirty objects, so that writing them does not
+        //hold up other threads
+        s.rw_mutex.lock();
+        if(s.dirty_bytes) {
+            for(auto& entry: s.obj_map) {
+                struct cache_entry_s* e = &entry.second;
+                if(e->dirty && lock_entry(e->t) == cache_hit) {
+                    set_dirty(s, e, false);
+                    e->flushing = true;
+                    batch.push_back(e);
+                }
+            }
+        }
+        s.rw_mutex.unlock();
+
+        if(batch.empty())
+            continue;
+
+        //locked entries cannot be evicted or deleted, so stay valid
+        std::vector<bool> failed(batch.size(), false);
+        if(writeback_many) {
+            std::vector<T*> objects;
+            std::vector<std::string> keys;
+            for(auto e: batch) {
+                objects.push_back(e->t);
+                keys.push_back(*e->key);
+            }
+
+            try {
+                writeback_many(objects, keys);
+                written += batch.size();
+            } catch(std::exception& ex) {
+                std::cerr<<"failed to write back "<<batch.size()<<" objects: "<<ex.what()<<std::endl;
+                failed.assign(batch.size(), true);
+            }
+        } else {
+            for(size_t i = 0; i < batch.size(); ++i) {
+                std::string key = *batch[i]->key;
+                try {
+                    writeback(batch[i]->t, key);
+                    ++written;
+                } catch(std::exception& ex) {
+                    std::cerr<<"failed to write back ["<<*batch[i]->key<<"]: "<<ex.what()<<std::endl;
+                    failed[i] = true;
+                }
+            }
+        }
+
+        s.rw_mutex.lock();
+        for(size_t i = 0; i < batch.size(); ++i) {
+            if(failed[i])
+                set_dirty(s, batch[i], true);
+            batch[i]->flushing = false;
+            batch[i]->t->unlock();
+        }
+
+        //objects kept only because they were dirty may go now
+        balance(s, 0);
+        s.rw_mutex.unlock();
+        s.flushed.notify_all();
+    }
+
+    dbg_1<<"flushed "<<written<<" objects\n";
+    return written;
 }
 
 #endif
@@ -3,24 +3,39 @@
 
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <iomanip>
 #include <string>
 #include <sstream>
+#include <functional>
 #include <boost/asio.hpp>
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
 #include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
 
 #include "ipc_common.hpp"
+#include "wire_format.hpp"
+
+//most queued messages sent by one gathered write
+#define CONNECTION_GATHER_MAX   64
 
 /**
  * Message class, this abstracts communications and is what is actually
  * sent down the line.
  *
  * Messages always contain a type which signifies the message contents and
- * a payload - the data type of which was specified earlier.
- * 
+ * a payload - the data type of which was specified earlier. See
+ * wire_format.hpp for the layout on the wire.
+ *
+ * Reads and writes are independent, one read and any number of writes may
+ * be outstanding at once. Messages given to async_send() are encoded
+ * straight away and queued, those waiting when a write completes go out
+ * together in one gathered write. Each may carry a request id, which a
+ * reply echoes, so that callers can tell replies apart when several
+ * requests are in flight.
+ *
+ * Not thread safe, all calls must be made from the thread running the
+ * io_service.
+ *
  * For type definition see data_type_e.
  * Payload types may be
  *  - queue_node_s
@@ -32,16 +47,12 @@
 class connection
 {
     public:
+    typedef std::function<void(const boost::system::error_code& ec)> write_handler;
+
     connection(boost::asio::io_service& io_service): socket_(io_service)
     {
-        std::string s;
-        std::ostringstream oss;
-        boost::archive::binary_oarchive arch(oss);
-        arch<<header;
-
-        s = oss.str();
-        header_raw_size = s.size();
-        rx_header.resize(header_raw_size);
+        header = wire_header_s();
+        tx_sending = 0;
     }
 
     boost::asio::ip::tcp::socket& socket()
@@ -49,64 +60,77 @@ class connection
         return socket_;
     }
 
-    //set data type prior to transmittion
-    void wdata_type(data_type_e t)
-    {
-        header.data_type  = t;
-    }
-
     //get transmitted data type
     data_type_e rdata_type(void)
     {
-        return header.data_type;
+        return (data_type_e)header.type;
     }
 
-    //serealize data prior to transmittion
-    template<typename T> void wdata(T t)
+    //get request id of the message read, 0 if none
+    uint64_t rrequest_id(void)
     {
-        std::ostringstream oss;
-        boost::archive::binary_oarchive arch(oss);
-        arch<<t;
+        return header.request_id;
+    }
 
-        tx_data = oss.str();
-        header.data_size = tx_data.size();
+    //get flags of the message read, WIRE_FLAG_*
+    uint16_t rflags(void)
+    {
+        return header.flags;
     }
 
-    //de-serealized data from transmittion
+    //de-serealized data from transmittion, decoded in place. Throws
+    //wire_exception if it is not a @T
     template<typename T> T rdata(void)
     {
         T t;
-        std::string archive_data(&rx_data[0], rx_data.size());
-        std::istringstream iss(archive_data);
-        boost::archive::binary_iarchive arch(iss);
+        wire_reader in(rx_data.data(), header.length);
 
-        arch>>t;
+        wire_decode(in, t);
         return t;
     }
 
-    //transmit serealized data
-    template<typename Handler> void async_write(Handler handler)
+    //serealize @t and queue it for transmittion, @handler is called once
+    //written. @handler may be null
+    template<typename T> void async_send(data_type_e type, const T& t, write_handler handler,
+        uint64_t request_id = 0, uint16_t flags = 0)
     {
-        //data already serialized by wdata()
-        std::ostringstream oss;
-        boost::archive::binary_oarchive arch(oss);
-        arch<<header;
-        tx_header = oss.str();
+        tx_queue.push_back(tx_message_s());
+        struct tx_message_s& m = tx_queue.back();
+        wire_encode(m.data, t);
+        m.done = handler;
 
-        if(!oss || tx_header.size() != header_raw_size) {
+        if(m.data.size() > WIRE_MAX_LENGTH) {
             //send error to handler
-            std::cerr<<"async_write boundry error. tx_header.size(): "<<tx_header.size()<<" != header_raw_size "<<header_raw_size<<"\n";
-            boost::system::error_code err(boost::asio::error::invalid_argument);
-            socket_.get_io_service().post(boost::bind(handler, err));
+            std::cerr<<"async_send message too long: "<<m.data.size()<<" bytes\n";
+            tx_queue.pop_back();
+            boost::system::error_code err(boost::asio::error::message_size);
+            if(handler)
+                socket_.get_io_service().post(boost::bind(handler, err));
             return;
         }
 
-        //write to socket
-        std::vector<boost::asio::const_buffer> buffers;
-        buffers.push_back(boost::asio::buffer(tx_header));
-        buffers.push_back(boost::asio::buffer(tx_data));
+        struct wire_header_s h = {WIRE_VERSION, (uint8_t)type, flags, (uint32_t)m.data.size(), request_id};
+        wire_put_header(m.header, h);
 
-        boost::asio::async_write(socket_, buffers, handler);
+        if(!tx_sending)
+            write_queued();
+    }
+
+    //calls @handler once every message queued so far is written
+    void async_drain(write_handler handler)
+    {
+        if(tx_queue.empty()) {
+            socket_.get_io_service().post(boost::bind(handler, boost::system::error_code()));
+            return;
+        }
+
+        write_handler prev = tx_queue.back().done;
+        tx_queue.back().done = [prev, handler](const boost::system::error_code& ec)
+            {
+                if(prev)
+                    prev(ec);
+                handler(ec);
+            };
     }
 
     template<typename Handler> void async_read(Handler handler)
@@ -115,7 +139,7 @@ class connection
         void (connection::*f)(const boost::system::error_code&, boost::tuple<Handler>)
             = &connection::read_header<Handler>;
 
-        boost::asio::async_read(socket_, boost::asio::buffer(rx_header),
+        boost::asio::async_read(socket_, boost::asio::buffer(rx_header, WIRE_HEADER_SIZE),
             boost::bind(f, this, boost::asio::placeholders::error,
                 boost::make_tuple(handler)));
     }
@@ -124,35 +148,36 @@ class connection
     void read_header(const boost::system::error_code& ec, boost::tuple<Handler> handler)
     {
         if(!ec) {
-            //get&deserealize header
-            try {
-                std::istringstream iss(std::string(&rx_header[0], header_raw_size));
-                boost::archive::binary_iarchive arch(iss);
-
-                arch>>header;
-            } catch (std::exception& e) {
-                std::cerr<<"read_header cought exception: "<<e.what()<<std::endl;
+            if(!wire_get_header(rx_header, header)) {
+                std::cerr<<"read_header unsupported wire version "<<(unsigned int)header.version<<std::endl;
                 boost::system::error_code err(boost::asio::error::invalid_argument);
                 boost::get<0>(handler)(err);
                 return;
             }
 
-            if(!header.data_size) {
-                std::cout<<"!header.data_size\n";
-                boost::system::error_code err(boost::asio::error::invalid_argument);
+            if(header.length > WIRE_MAX_LENGTH) {
+                std::cerr<<"read_header message too long: "<<header.length<<" bytes\n";
+                boost::system::error_code err(boost::asio::error::message_size);
                 boost::get<0>(handler)(err);
                 return;
             }
 
-            //now async_read data
-            rx_data.resize(header.data_size);
+            //nothing more to read
+            if(!header.length) {
+                boost::get<0>(handler)(ec);
+                return;
+            }
+
+            //now async_read data, the buffer only ever grows
+            if(rx_data.size() < header.length)
+                rx_data.resize(header.length);
 
             //read data from socket, call handler on completion - caller
             //must explicitly deserealise data
             void (connection::*f)(const boost::system::error_code&, boost::tuple<Handler>)
                 = &connection::read_data<Handler>;
 
-            boost::asio::async_read(socket_, boost::asio::buffer(rx_data),
+            boost::asio::async_read(socket_, boost::asio::buffer(rx_data.data(), header.length),
                 boost::bind(f, this, boost::asio::placeholders::error,
                     handler));
         } else {
@@ -168,28 +193,67 @@ class connection
     }
 
     private:
+    struct tx_message_s {
+        char header[WIRE_HEADER_SIZE];
+        std::string data;
+        write_handler done;
+    };
+
     boost::asio::ip::tcp::socket socket_;
 
-    struct header_s {
-        data_type_e data_type;
-        std::size_t data_size;
+    //header of the message last read
+    struct wire_header_s header;
+    std::vector<char> rx_data;
+    char rx_header[WIRE_HEADER_SIZE];
+
+    //messages being written, then those waiting. Elements of a deque stay
+    //put as it grows, so buffers given to the socket remain valid
+    std::deque<struct tx_message_s> tx_queue;
+    size_t tx_sending;                  //messages of the write in flight
 
-        template<class Archive>
-        void serialize(Archive& ar, const unsigned int version)
-        {
-            ar & data_type;
-            ar & data_size;
+    //writes up to CONNECTION_GATHER_MAX queued messages at once
+    void write_queued(void)
+    {
+        std::vector<boost::asio::const_buffer> buffers;
+        for(auto& m: tx_queue) {
+            if(tx_sending == CONNECTION_GATHER_MAX)
+                break;
+            buffers.push_back(boost::asio::buffer(m.header, WIRE_HEADER_SIZE));
+            buffers.push_back(boost::asio::buffer(m.data));
+            ++tx_sending;
         }
-    } header;
 
-    //half duplex communication, though full duplex can easily be implemented
-    //by not sharing the header above with tx&rx functions
-    std::string tx_data;
-    std::string tx_header;
-    std::vector<char> rx_data;
-    std::vector<char> rx_header;
+        boost::asio::async_write(socket_, buffers,
+            boost::bind(&connection::write_complete, this, boost::asio::placeholders::error));
+    }
 
-    std::size_t header_raw_size;
+    void write_complete(const boost::system::error_code& ec)
+    {
+        size_t sent = tx_sending;
+        tx_sending = 0;
+
+        //handlers may queue more, keep those for the next write
+        std::vector<write_handler> done;
+        for(size_t i = 0; i < sent; ++i) {
+            done.push_back(tx_queue.front().done);
+            tx_queue.pop_front();
+        }
+
+        //after a failed write the stream is broken, fail the rest too
+        if(ec) {
+            for(auto& m: tx_queue)
+                done.push_back(m.done);
+            tx_queue.clear();
+        }
+
+        for(auto& d: done) {
+            if(d)
+                d(ec);
+        }
+
+        if(!tx_sending && !tx_queue.empty())
+            write_queued();
+    }
 };
 
 #endif
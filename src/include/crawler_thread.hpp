@@ -5,12 +5,15 @@
 #include <vector>
 #include <stdexcept>
 #include <thread>
+#include <atomic>
 
 #include "page_data.hpp"
 #include "ipc_common.hpp"
 #include "parser.hpp"
 #include "ipc_client.hpp"
 #include "memory_mgr.hpp"
+#include "host_scheduler.hpp"
+#include "host_table.hpp"
 
 class netio;
 class ipc_client;
@@ -21,10 +24,20 @@ class robots_txt;
  */
 #define ROBOTS_REFRESH  15*60   //15 minutes
 
+/**
+ * Page and robots storage, and domain politeness state, are owned by the worker
+ * process and shared by all of its crawler threads so that cache hits and
+ * object locks are common to every thread.
+ *
+ * Each thread keeps many pages, on different domains, in flight at once over
+ * its netio's async engine. A page's objects and domain are held from when
+ * its fetch starts until it has been parsed.
+ */
 class crawler_thread
 {
     public:
-    crawler_thread(ipc_client* ipc_obj);
+    crawler_thread(ipc_client* ipc_obj, memory_mgr<page_data_c>* page_mgr,
+                   memory_mgr<robots_txt>* robots_mgr, host_table* host_state);
     ~crawler_thread(void);
 
     /**
@@ -42,7 +55,7 @@ class crawler_thread
 
     /**
      * signals the internal thread to shut down once its completed its
-     * current crawl.
+     * current crawls. The destructor waits for it to do so.
      *
      * Returns immidiately
      */
@@ -54,20 +67,41 @@ class crawler_thread
     worker_status_e status(void);
 
     private:
-    worker_status_e thread_status;
+    std::atomic<worker_status_e> thread_status;
     struct worker_config_s cfg;
-    std::string data;
     std::thread main_thread;
 
     //objects dynamically allocated based on config
     netio* netio_obj;
     ipc_client* ipc;
+    parse_profile* profile;     //compiled cfg.parse_param
+    parser page_parser;         //reused for every page crawled by this thread
+    host_scheduler work_queue;  //work items waiting on their domain
+
+    //shared between threads
+    memory_mgr<page_data_c>* pages;
+    memory_mgr<robots_txt>* robots_store;
+    host_table* hosts;          //per domain politeness state
+
+    //a page being fetched, with the objects it holds until parsed
+    struct fetch_s {
+        queue_node_s work_item;
+        std::string root_url;
+        page_data_c* page;
+        bool page_changed;
+        robots_txt* robots;
+        bool robots_changed;
+        host_state_s* host;
+    };
 
     size_t root_domain(std::string& url);
-    void crawl(queue_node_s& work_item, page_data_c* page, robots_txt* robots);
-    void thread() throw(std::underflow_error);
+    void start_fetch(struct fetch_s* f);
+    void fetched(struct fetch_s* f, std::string& data, bool ok);
+    bool crawl(queue_node_s& work_item, page_data_c* page, std::string& data);
+    void thread(void);
     unsigned int tax(unsigned int credit, unsigned int percent);
     void launch_thread(void);
+    void set_status(worker_status_e s);
     bool sanitize_url_tag(struct data_node_s& d, std::string root_url);
     bool is_whitespace(Glib::ustring::value_type c);
     unsigned int tokenize_meta_tag(page_data_c* page, Glib::ustring& data);
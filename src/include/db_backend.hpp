@@ -0,0 +1,194 @@
+#if !defined(DB_BACKEND_H)
+#define DB_BACKEND_H
+
+#include <iostream>
+#include <string>
+#include <exception>
+#include <vector>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+#include "io_executor.hpp"
+
+/**
+ * generic exception interface to database client
+ */
+struct db_exception: std::exception {
+    std::string message;
+    const char* what() const noexcept
+    {
+        return message.c_str();
+    }
+    db_exception(std::string s): message(s) {};
+};
+
+/**
+ * storage engines memory_mgr can be configured with
+ */
+enum db_type_e {
+    db_file,    //one file per object, see file_db.hpp
+    db_log      //append only segments, see log_db.hpp
+};
+
+/**
+ * negative lookup counters
+ */
+struct db_filter_stats_s {
+    unsigned long lookups;          //calls to get_object()
+    unsigned long skipped;          //known absent, no storage read
+    unsigned long false_positives;  //storage read, but no object found
+};
+
+/**
+ * compression counters
+ */
+struct compress_stats_s {
+    unsigned long records;          //records compressed
+    unsigned long raw_bytes;        //their size before
+    unsigned long stored_bytes;     //and after
+    unsigned int dictionary;        //version in use, 0 for none
+};
+
+/**
+ * completion of a get_many()/put_many() batch
+ */
+struct db_batch_s {
+    std::promise<void> done;
+    std::atomic<size_t> remaining;
+    std::mutex error_lock;
+    std::exception_ptr error;       //first request to fail
+};
+
+/**
+ * Interface shared by the storage engines, so that memory_mgr can be
+ * switched between them by configuration.
+ *
+ * Engines must allow concurrent calls for different keys, batches are run
+ * as one request per key on the executor unless the engine has a better
+ * way of storing them.
+ */
+template<typename T> class db_backend
+{
+    public:
+    db_backend(void): executor(0) {};
+    virtual ~db_backend(void) {};
+
+    /**
+     * Runs batches on @e from now on, rather than on the calling thread.
+     * @e must outlive this database.
+     */
+    virtual void set_executor(io_executor* e)
+    {
+        executor = e;
+    }
+
+    /**
+     * Asynchronous get_object() of every key in @keys into the object at the
+     * same index of @objects. Both must stay untouched until the returned
+     * future is ready, which rethrows the first error of the batch.
+     */
+    std::future<void> get_many(std::vector<T*>& objects, std::vector<std::string>& keys)
+    {
+        return run_many(objects, keys, false);
+    }
+
+    /**
+     * asynchronous put_object() of each of @objects, as get_many()
+     */
+    virtual std::future<void> put_many(std::vector<T*>& objects, std::vector<std::string>& keys)
+    {
+        return run_many(objects, keys, true);
+    }
+
+    /**
+     * Blocking synchronous call to retrieve object from database.
+     *
+     * On success @t is replaced by the stored object. If no database entry
+     * exists for @key, @t is unmodified.
+     */
+    virtual void get_object(T*& t, std::string& key) throw(std::exception) = 0;
+
+    /**
+     * Blocking call to put object to database, replacing any stored under
+     * @key.
+     */
+    virtual void put_object(T*& t, std::string& key) = 0;
+
+    /**
+     * Removes any object stored under @key. Throws exception if
+     * connection/database error occured.
+     */
+    virtual void delete_object(std::string& key) throw(std::exception) = 0;
+
+    /**
+     * Checks if the data in memory is in sync with that in the database
+     * returns true if it is.
+     */
+    virtual bool is_recent(T*& t, std::string& key) throw(std::exception) = 0;
+
+    /**
+     * returns negative lookup counters since creation
+     */
+    virtual struct db_filter_stats_s filter_stats(void) = 0;
+
+    /**
+     * returns record compression counters since creation
+     */
+    virtual struct compress_stats_s compress_stats(void) = 0;
+
+    protected:
+    io_executor* executor;
+
+    private:
+    std::future<void> run_many(std::vector<T*>& objects, std::vector<std::string>& keys, bool put);
+};
+
+template<typename T> std::future<void> db_backend<T>::run_many(std::vector<T*>& objects, std::vector<std::string>& keys, bool put)
+{
+    std::shared_ptr<db_batch_s> batch = std::make_shared<db_batch_s>();
+    std::future<void> f = batch->done.get_future();
+
+    batch->remaining = keys.size();
+    if(keys.empty()) {
+        batch->done.set_value();
+        return f;
+    }
+
+    std::vector<std::function<void()>> tasks;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tasks.push_back([this, batch, &objects, &keys, i, put]() {
+            try {
+                if(put)
+                    put_object(objects[i], keys[i]);
+                else
+                    get_object(objects[i], keys[i]);
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(batch->error_lock);
+                if(!batch->error)
+                    batch->error = std::current_exception();
+            }
+
+            //last one out completes the batch
+            if(--batch->remaining == 0) {
+                if(batch->error)
+                    batch->done.set_exception(batch->error);
+                else
+                    batch->done.set_value();
+            }
+        });
+    }
+
+    if(executor) {
+        executor->submit_many(tasks);
+    } else {
+        for(auto& t: tasks)
+            t();
+    }
+
+    return f;
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <sstream>
 #include <thread>
 #include <atomic>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/lockfree/spsc_queue.hpp>
@@ -28,6 +29,7 @@ class dummy_server
     {
         cout<<">server: starting test server\n";
         running = true;
+        received = 0;
 
         srv = std::thread(&dummy_server::do_accept, this);
     }
@@ -48,6 +50,12 @@ class dummy_server
         uut_cfg = worker_cfg;
     }
 
+    //nodes sent by the client so far
+    unsigned long received_nodes(void)
+    {
+        return received;
+    }
+
     private:
     //ipc io
     boost::asio::io_service ipc_service;
@@ -58,6 +66,7 @@ class dummy_server
     //server thread
     std::thread srv;
     std::atomic<bool> running;
+    std::atomic<unsigned long> received;
     boost::lockfree::spsc_queue<struct queue_node_s, boost::lockfree::capacity<BUFFER_MAX_SIZE>> node_buffer;
 
     //thread data
@@ -91,7 +100,7 @@ class dummy_server
             switch(connection_.rdata_type()) {
             case dt_instruction:
                 dbg_2<<">server: client sent ctrl_instruction"<<endl;
-                process_instruction(connection_.rdata<ctrl_instruction_e>());
+                process_instruction(connection_.rdata<ctrl_instruction_e>(), connection_.rrequest_id());
                 break;
 
             case dt_wstatus:
@@ -108,6 +117,21 @@ class dummy_server
                 dbg_2<<">server: cient sent queue_node_s"<<endl;
                 ipc_qnode = connection_.rdata<queue_node_s>();
                 node_buffer.push(ipc_qnode);
+                ++received;
+                break;
+
+            case dt_queue_nodes:
+            {
+                std::vector<queue_node_s> nodes = connection_.rdata<std::vector<queue_node_s>>();
+                dbg_2<<">server: client sent "<<nodes.size()<<" queue_node_s"<<endl;
+                for(auto& n: nodes)
+                    node_buffer.push(n);
+                received += nodes.size();
+                break;
+            }
+
+            case dt_node_request:
+                send_nodes(connection_.rdata<unsigned int>(), connection_.rrequest_id());
                 break;
 
             default:
@@ -122,26 +146,21 @@ class dummy_server
         }
     }
 
-    void process_instruction(ctrl_instruction_e instruction)
+    //replies go back under the client's @request_id
+    void process_instruction(ctrl_instruction_e instruction, uint64_t request_id)
     {
         switch(instruction) {
         case ctrl_wconfig:
             dbg_2<<">server: recieved ctrl_wconfig from client\n";
-
-            connection_.wdata_type(dt_wconfig);
-            connection_.wdata(uut_cfg);
-            connection_.async_write(boost::bind(&dummy_server::write_complete,
-                this, boost::asio::placeholders::error));
+            connection_.async_send(dt_wconfig, uut_cfg, boost::bind(&dummy_server::write_complete,
+                this, boost::asio::placeholders::error), request_id, WIRE_FLAG_REPLY);
             break;
 
         case ctrl_wnodes:
             dbg_2<<">server: recieved ctrl_wnodes from client, sending (1)queue_node_s\n";
             node_buffer.pop(ipc_qnode);
-
-            connection_.wdata_type(dt_queue_node);
-            connection_.wdata(ipc_qnode);
-            connection_.async_write(boost::bind(&dummy_server::write_complete,
-                this, boost::asio::placeholders::error));
+            connection_.async_send(dt_queue_node, ipc_qnode, boost::bind(&dummy_server::write_complete,
+                this, boost::asio::placeholders::error), request_id, WIRE_FLAG_REPLY);
             break;
 
         default:
@@ -150,6 +169,19 @@ class dummy_server
         }
     }
 
+    //replies with up to @count nodes, none if the buffer is empty
+    void send_nodes(unsigned int count, uint64_t request_id)
+    {
+        std::vector<queue_node_s> nodes;
+        struct queue_node_s n;
+        while(nodes.size() < count && node_buffer.pop(n))
+            nodes.push_back(n);
+
+        dbg_2<<">server: client requested "<<count<<" nodes, sending "<<nodes.size()<<endl;
+        connection_.async_send(dt_queue_nodes, nodes, boost::bind(&dummy_server::write_complete,
+            this, boost::asio::placeholders::error), request_id, WIRE_FLAG_REPLY);
+    }
+
     void write_complete(const boost::system::error_code& ec)
     {
         if(!ec) {
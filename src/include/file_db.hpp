@@ -6,33 +6,58 @@
 #include <sstream>
 #include <chrono>
 #include <mutex>
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
+#include <unordered_set>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "db_backend.hpp"
+#include "record_codec.hpp"
+#include "mapped_file.hpp"
+#include "key_filter.hpp"
+#include "write_log.hpp"
+#include "debug.hpp"
+
+//keys a table's filter is sized for before false positives rise
+#define DB_FILTER_KEYS  (1024*1024)
+//locks guarding files, keys sharing one are serialised
+#define DB_LOCK_STRIPES 64
 
 /**
- * generic exception interface to database client
+ * Each object is stored in its own file, named after the hash of its key.
+ *
+ * The hashes of stored keys are also kept in a counting Bloom filter, so
+ * that lookups of keys never stored (most urls, in a new crawl) do not touch
+ * the filesystem. The filter is saved next to the table on destruction and
+ * loaded on creation. Whilst a database is open the saved copy is removed,
+ * so if the process dies the filter is rebuilt from the table's files.
+ *
+ * Access to each file is serialised by one of DB_LOCK_STRIPES locks, picked
+ * by key hash, so requests for different keys mostly run in parallel.
+ *
+ * Files are rewritten in place, so a crash mid write loses the object. A
+ * @durable database instead commits puts and deletes to a write_log kept
+ * beside the table, grouping concurrent ones into one fsync, and writes the
+ * files in the background. Logged records not yet written are read from the
+ * log, and stay there until a retry writes them. Each file written is
+ * fsynced before the log holding it is retired. put_many() logs its whole
+ * batch at once, so it fills commits rather than each executor thread
+ * waiting on an fsync of its own.
  */
-struct db_exception: std::exception {
-    std::string message;
-    const char* what() const noexcept
-    {
-        return message.c_str();
-    }
-    db_exception(std::string s): message(s) {};
-};
-
-template<typename T> class database
+template<typename T> class database: public db_backend<T>
 {
     public:
     /**
      * On creation, object connects to the database at @uri. All object access
      * will occure from @table
      */
-    database(std::string uri, std::string table)
-    {
-        db_path = uri;
-        db_table = table;
-    }
+    database(std::string uri, std::string table, size_t expected_keys = DB_FILTER_KEYS, bool compress = false,
+        bool durable = false, unsigned int commit_window = WAL_COMMIT_WINDOW,
+        unsigned int commit_batch = WAL_COMMIT_BATCH);
+    ~database(void);
 
     /**
      * Blocking synchronous call to retrieve object from database. Automatically
@@ -49,9 +74,17 @@ template<typename T> class database
      * retrieved by this session its entry is unlocked afterwards. Concurrent
      * writes to an unlocked object are expected to be handled by the database
      * implementation.
+     *
+     * Throws db_exception if the object's file could not be written.
      */
     void put_object(T*& t, std::string& key);
 
+    /**
+     * as db_backend::put_many(), a durable database encodes the batch and
+     * commits it to the log in one task
+     */
+    std::future<void> put_many(std::vector<T*>& objects, std::vector<std::string>& keys);
+
     /**
      * Sets object state to 'OBJ_DELETE_PENDING' to prevent get_object deadlocks
      * in concurrent processes before deleting object.
@@ -69,82 +102,376 @@ template<typename T> class database
      */
     bool is_recent(T*& t, std::string& key) throw(std::exception);
 
+    /**
+     * returns negative lookup filter counters since creation
+     */
+    struct db_filter_stats_s filter_stats(void);
+
+    struct compress_stats_s compress_stats(void);
+
+    /**
+     * as db_backend::set_executor(), compression dictionaries are trained
+     * on @e too
+     */
+    void set_executor(io_executor* e);
+
+    /**
+     * write-ahead log counters, all 0 unless durable
+     */
+    struct wal_stats_s wal_stats(void);
+
     private:
-    std::mutex file_io_lock;    //concurrent open to the same file
+    std::mutex file_locks[DB_LOCK_STRIPES];    //concurrent open to the same file
     std::string db_path;
     std::string db_table;
+
+    std::mutex filter_lock;     //taken after any file lock
+    key_filter filter;
+    struct db_filter_stats_s stats;
+
+    //always there to read records compressed earlier
+    record_compressor compressor;
+    bool compress;
+
+    write_log* wal;             //0 unless durable
+    std::mutex sync_lock;
+    std::unordered_set<std::string> unsynced;  //applied, not yet fsynced
+
+    std::string filename(std::string& key, size_t& hash);
+    std::mutex& file_lock(size_t hash);
+    std::string filter_path(void);
+    void rebuild_filter(void);
+    void read_record(T*& t, const char* data, size_t size);
+    bool write_file(std::string& key, std::string& record, std::string& path);
+    void remove_file(std::string& key) throw(db_exception);
+    bool apply_record(std::string& key, std::string& record, bool deleted);
+    bool sync_table(void);
 };
 
-template<typename T> void database<T>::get_object(T*& t, std::string& key) throw(std::exception)
+template<typename T> database<T>::database(std::string uri, std::string table, size_t expected_keys, bool compress,
+    bool durable, unsigned int commit_window, unsigned int commit_batch):
+    filter(expected_keys),
+    compressor(uri+"/"+table),
+    compress(compress),
+    wal(0)
+{
+    db_path = uri;
+    db_table = table;
+    stats = db_filter_stats_s();
+
+    if(filter.load(filter_path())) {
+        dbg<<"loaded filter of "<<filter.keys()<<" keys for ["<<db_table<<"]\n";
+    } else {
+        rebuild_filter();
+    }
+
+    //a stale filter would hide stored objects, only trust it after a
+    //clean shutdown
+    remove(filter_path().c_str());
+
+    //replays what a crash left in the log, which needs the filter
+    //std:: placeholders named in full, boost/bind puts its own in scope
+    if(durable) {
+        wal = new write_log(db_path+"/"+db_table+".wal",
+            std::bind(&database<T>::apply_record, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3),
+            std::bind(&database<T>::sync_table, this),
+            commit_window, commit_batch);
+    }
+}
+
+template<typename T> database<T>::~database(void)
+{
+    //writes out everything logged
+    delete wal;
+
+    filter_lock.lock();
+    if(!filter.save(filter_path()))
+        std::cerr<<"failed to save filter for table "<<db_table<<std::endl;
+    filter_lock.unlock();
+}
+
+template<typename T> std::string database<T>::filename(std::string& key, size_t& hash)
 {
     //generate db query
     std::hash<std::string> h;
     std::stringstream ss;
-    ss<<h(key);
 
-    std::string filename = ss.str();
+    hash = h(key);
+    ss<<hash;
 
-    //read from database
-    file_io_lock.lock();
-    std::ifstream file_data(db_path+"/"+db_table+"/"+filename);
-    if(file_data) {
-        //deserealize
-        boost::archive::binary_iarchive arch(file_data);
-        arch>>t;
+    return db_path+"/"+db_table+"/"+ss.str();
+}
 
-        file_data.close();
+template<typename T> std::mutex& database<T>::file_lock(size_t hash)
+{
+    return file_locks[hash%DB_LOCK_STRIPES];
+}
+
+//kept beside, not in, the table so that table scans only see objects
+template<typename T> std::string database<T>::filter_path(void)
+{
+    return db_path+"/"+db_table+".filter";
+}
+
+//filenames are the hashes the filter holds
+template<typename T> void database<T>::rebuild_filter(void)
+{
+    std::string table_path = db_path+"/"+db_table;
+    DIR* dir = opendir(table_path.c_str());
+    if(!dir) {
+        dbg<<"no table at ["<<table_path<<"], starting with an empty filter\n";
+        return;
     }
-    //if file does not exist we simply leave @t as is
 
-    file_io_lock.unlock();
+    struct dirent* ent;
+    while((ent = readdir(dir)) != 0) {
+        char* end;
+        unsigned long long hash = strtoull(ent->d_name, &end, 10);
+        if(end != ent->d_name && *end == '\0')
+            filter.add((size_t)hash);
+    }
+    closedir(dir);
+
+    dbg<<"rebuilt filter of "<<filter.keys()<<" keys for ["<<db_table<<"]\n";
+}
+
+template<typename T> void database<T>::get_object(T*& t, std::string& key) throw(std::exception)
+{
+    size_t hash;
+    std::string path = filename(key, hash);
+
+    //logged but not yet written to its file
+    if(wal) {
+        std::string record;
+        bool deleted;
+        if(wal->lookup(key, record, deleted)) {
+            filter_lock.lock();
+            ++stats.lookups;
+            filter_lock.unlock();
+
+            if(!deleted)
+                read_record(t, record.data(), record.size());
+            return;
+        }
+    }
+
+    filter_lock.lock();
+    ++stats.lookups;
+    bool stored = filter.may_contain(hash);
+    if(!stored)
+        ++stats.skipped;
+    filter_lock.unlock();
+
+    //never stored, leave @t as is
+    if(!stored)
+        return;
+
+    //read from database, in place
+    std::lock_guard<std::mutex> lock(file_lock(hash));
+    mapped_file file_data(path);
+    if(file_data.is_open()) {
+        read_record(t, file_data.data(), file_data.size());
+    } else {
+        //if file does not exist we simply leave @t as is
+        filter_lock.lock();
+        ++stats.false_positives;
+        filter_lock.unlock();
+    }
 }
 
 template<typename T> void database<T>::put_object(T*& t, std::string& key)
 {
     //serealize object
-    std::ostringstream oss;
-    boost::archive::binary_oarchive arch(oss);
-    arch<<t;
+    std::string record;
+    encode_record(t, record, compress ? &compressor : 0);
 
-    //generate filename from key
-    std::hash<std::string> h;
-    std::stringstream ss;
-    ss<<h(key);
+    //durable once logged, the file is written later
+    std::string path;
+    if(wal)
+        wal->append(key, record);
+    else if(!write_file(key, record, path))
+        throw db_exception("failed to write file: "+path);
+}
+
+template<typename T> std::future<void> database<T>::put_many(std::vector<T*>& objects, std::vector<std::string>& keys)
+{
+    //in place writes are independent, one request per key
+    if(!wal)
+        return db_backend<T>::put_many(objects, keys);
 
-    std::string filename = ss.str();
+    auto task = std::make_shared<std::packaged_task<void()>>([this, &objects, &keys]() {
+        std::vector<std::string> records(keys.size());
+        for(size_t i = 0; i < keys.size(); ++i)
+            encode_record(objects[i], records[i], compress ? &compressor : 0);
 
-    //write
-    file_io_lock.lock();
-    std::ofstream file_data(db_path+"/"+db_table+"/"+filename);
+        wal->append_many(keys, records);
+    });
+    std::future<void> f = task->get_future();
 
-    file_data<<oss.str();
+    if(this->executor)
+        this->executor->submit([task]() { (*task)(); });
+    else
+        (*task)();
 
-    file_data.close();
-    file_io_lock.unlock();
+    return f;
 }
 
 template<typename T> void database<T>::delete_object(std::string& key) throw(std::exception)
 {
-    //generate db query
-    std::hash<std::string> h;
-    std::stringstream ss;
-    ss<<h(key);
+    if(wal)
+        wal->remove(key);
+    else
+        remove_file(key);
+}
+
+template<typename T> bool database<T>::is_recent(T*& t, std::string& key) throw(std::exception)
+{
+    return true;
+}
+
+template<typename T> struct db_filter_stats_s database<T>::filter_stats(void)
+{
+    filter_lock.lock();
+    struct db_filter_stats_s st = stats;
+    filter_lock.unlock();
+
+    return st;
+}
+
+template<typename T> struct compress_stats_s database<T>::compress_stats(void)
+{
+    return compressor.stats();
+}
+
+template<typename T> void database<T>::set_executor(io_executor* e)
+{
+    db_backend<T>::set_executor(e);
+    compressor.set_executor(e);
+}
+
+template<typename T> struct wal_stats_s database<T>::wal_stats(void)
+{
+    return wal ? wal->stats() : wal_stats_s();
+}
 
-    std::string filename = db_path+"/"+db_table+"/"+ss.str();
+template<typename T> void database<T>::read_record(T*& t, const char* data, size_t size)
+{
+    T* loaded = decode_record<T>(data, size, &compressor);
+    delete t;
+    t = loaded;
+}
+
+//returns false if the file could not be written, @path is set to it
+template<typename T> bool database<T>::write_file(std::string& key, std::string& record, std::string& path)
+{
+    //generate filename from key
+    size_t hash;
+    path = filename(key, hash);
+
+    //write
+    std::lock_guard<std::mutex> lock(file_lock(hash));
+
+    //each stored key may only be counted once by the filter
+    struct stat st;
+    bool is_new = stat(path.c_str(), &st) != 0;
+
+    std::ofstream file_data(path);
+    file_data<<record;
+    file_data.close();
+
+    if(is_new && file_data) {
+        filter_lock.lock();
+        filter.add(hash);
+        filter_lock.unlock();
+    }
+    return (bool)file_data;
+}
+
+template<typename T> void database<T>::remove_file(std::string& key) throw(db_exception)
+{
+    size_t hash;
+    std::string path = filename(key, hash);
 
     //delete object
-    file_io_lock.lock();
-    int r = remove(filename.c_str());
-    file_io_lock.unlock();
+    file_lock(hash).lock();
+    int r = remove(path.c_str());
+    int err = errno;
+    if(!r) {
+        filter_lock.lock();
+        filter.remove(hash);
+        filter_lock.unlock();
+    }
+    file_lock(hash).unlock();
 
-    if(!r)
-        throw db_exception("failed to delete file: "+filename);
+    //pages never stored have no file to remove
+    if(r && err != ENOENT)
+        throw db_exception("failed to delete file: "+path);
 }
 
-template<typename T> bool database<T>::is_recent(T*& t, std::string& key) throw(std::exception)
+//write_log apply handler, on its thread or during replay. Returns false
+//if the store was not changed, so the log keeps the record
+template<typename T> bool database<T>::apply_record(std::string& key, std::string& record, bool deleted)
 {
-    return true;
+    try {
+        //removals only need the directory synced
+        if(deleted) {
+            remove_file(key);
+            return true;
+        }
+
+        std::string path;
+        if(!write_file(key, record, path)) {
+            std::cerr<<"failed to write file: "<<path<<std::endl;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(sync_lock);
+        unsynced.insert(path);
+        return true;
+    } catch(db_exception& e) {
+        std::cerr<<e.what()<<std::endl;
+        return false;
+    }
 }
 
+//write_log sync handler, fsyncs the files applied since the last sync then
+//the table directory. Those which fail are tried again next time
+template<typename T> bool database<T>::sync_table(void)
+{
+    std::unordered_set<std::string> files;
+    sync_lock.lock();
+    files.swap(unsynced);
+    sync_lock.unlock();
+
+    std::vector<std::string> failed;
+    for(auto& path: files) {
+        int fd = open(path.c_str(), O_RDONLY);
+        //removed since, nothing left to sync
+        if(fd < 0 && errno == ENOENT)
+            continue;
+        if(fd < 0 || fsync(fd)) {
+            std::cerr<<"failed to sync file: "<<path<<std::endl;
+            failed.push_back(path);
+        }
+        if(fd >= 0)
+            close(fd);
+    }
+
+    std::string table_path = db_path+"/"+db_table;
+    int fd = open(table_path.c_str(), O_RDONLY);
+    bool dir_synced = fd >= 0 && !fsync(fd);
+    if(!dir_synced)
+        std::cerr<<"failed to sync table "<<table_path<<std::endl;
+    if(fd >= 0)
+        close(fd);
+
+    if(!failed.empty()) {
+        std::lock_guard<std::mutex> lock(sync_lock);
+        unsynced.insert(failed.begin(), failed.end());
+    }
+
+    return failed.empty() && dir_synced;
+}
 
 #endif
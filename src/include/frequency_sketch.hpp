@@ -0,0 +1,46 @@
+#if !defined(FREQUENCY_SKETCH_H)
+#define FREQUENCY_SKETCH_H
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+//rows of the sketch, each key has one counter per row
+#define SKETCH_DEPTH        4
+//additions, per unit of capacity, before all counters are halved
+#define SKETCH_SAMPLE_RATIO 10
+
+/**
+ * Count-Min sketch of 4 bit counters estimating how often keys have been
+ * seen recently, as used by TinyLFU cache admission. Counters are halved
+ * once SKETCH_SAMPLE_RATIO*@capacity keys have been added, so estimates
+ * favour recent popularity and old hot keys age out.
+ *
+ * Keys are identified only by their hash. Not thread safe.
+ */
+class frequency_sketch
+{
+    public:
+    frequency_sketch(size_t capacity);
+
+    /**
+     * records one access of the key hashed to @hash
+     */
+    void increment(size_t hash);
+
+    /**
+     * estimated number of recent accesses of @hash, at most 15
+     */
+    unsigned int frequency(size_t hash);
+
+    private:
+    std::vector<uint64_t> table;    //16 counters per word
+    size_t mask;
+    size_t sample_size;
+    size_t additions;
+
+    size_t index_of(size_t hash, int row);
+    void reset(void);
+};
+
+#endif
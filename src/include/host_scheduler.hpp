@@ -0,0 +1,88 @@
+#if !defined(HOST_SCHEDULER_H)
+#define HOST_SCHEDULER_H
+
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <chrono>
+
+#include "ipc_common.hpp"
+
+//hosts idle for this many pops are checked for removal
+#define SCHEDULER_PRUNE_INTERVAL    1024
+
+/**
+ * Per worker politeness scheduler. Work items are kept in per-host queues
+ * and hosts are ordered by the time they may next be fetched from, so a
+ * crawler thread always picks work from a host that is ready and never
+ * needs to sleep while such work exists.
+ *
+ * A host handed out by pop() is busy until complete() is called for it,
+ * so at most one item per host is in flight. complete() also sets when
+ * the host may be fetched from again (ie its crawl delay).
+ *
+ * Not thread safe, each crawler_thread owns its own scheduler.
+ */
+class host_scheduler
+{
+    public:
+    typedef std::chrono::steady_clock::time_point time_point_t;
+
+    host_scheduler(void);
+
+    /**
+     * queues @item for @host. Hosts not seen before are ready immediately.
+     */
+    void push(struct queue_node_s& item, std::string& host);
+
+    /**
+     * gets the next item from a ready host, which then becomes busy. If no
+     * host is ready returns false and sets @wait to the time until one
+     * will be (zero if the scheduler is empty or all hosts are busy).
+     */
+    bool pop(struct queue_node_s& item, std::string& host, std::chrono::microseconds& wait);
+
+    /**
+     * returns @item to the front of its (busy) host's queue, to be retried
+     * once the host is completed and ready again.
+     */
+    void push_front(struct queue_node_s& item, std::string& host);
+
+    /**
+     * marks @host as no longer busy, next fetchable at @ready_at.
+     */
+    void complete(std::string& host, time_point_t ready_at);
+
+    /**
+     * removes every queued item, eg to hand back to the master on shutdown
+     */
+    void drain(std::vector<struct queue_node_s>& items);
+
+    //queued items, across all hosts
+    size_t size(void);
+
+    private:
+    struct host_queue_s {
+        std::deque<struct queue_node_s> items;
+        time_point_t ready_at;
+        bool busy;
+        bool scheduled;     //has a live entry in ready_heap
+    };
+
+    //min heap of (ready_at, host). Entries whose ready_at no longer matches
+    //their host's are stale and skipped
+    typedef std::pair<time_point_t, std::string> heap_entry_t;
+    typedef std::priority_queue<heap_entry_t, std::vector<heap_entry_t>, std::greater<heap_entry_t>> ready_heap_t;
+
+    std::unordered_map<std::string, struct host_queue_s> hosts;
+    ready_heap_t ready_heap;
+    size_t items;
+    unsigned int pops;
+
+    void schedule(const std::string& host, struct host_queue_s& q);
+    void prune(void);
+};
+
+#endif
@@ -0,0 +1,103 @@
+#if !defined(HOST_TABLE_H)
+#define HOST_TABLE_H
+
+#include <iostream>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+//number of independently locked partitions of the table
+#define HOST_TABLE_SHARDS   16
+//consecutive fetch errors after which a host's delay stops doubling
+#define HOST_MAX_BACKOFF    4
+//seconds, least delay doubled after a fetch error, so hosts without a
+//crawl delay are still backed off
+#define HOST_BACKOFF_BASE   1
+//hosts unused for this many of their delays are forgotten
+#define HOST_IDLE_DELAYS    8
+//lookups in a shard between checks for idle hosts
+#define HOST_PRUNE_INTERVAL 1024
+
+/**
+ * Politeness state of one host. Fields are atomic so that crawler threads
+ * may read and update them without holding any lock.
+ */
+struct host_state_s {
+    std::atomic<long long> last_fetch;          //steady_clock ticks, 0 if never
+    std::atomic<unsigned int> crawl_delay;      //seconds, from robots_txt
+    std::atomic<unsigned int> in_flight;        //1 whilst a fetch is running
+    std::atomic<unsigned int> errors;           //consecutive failed fetches
+    unsigned int users;                         //get()s not yet released, under the shard lock
+
+    host_state_s(void): last_fetch(0), crawl_delay(0), in_flight(0), errors(0), users(0) {}
+};
+
+/**
+ * In memory table of per host politeness state, used to enforce crawl
+ * delays without loading anything from page storage.
+ *
+ * Entries are created on first use and kept while in use, a reference
+ * returned by get() stays valid until release(). Hosts with no fetch in
+ * flight and none for HOST_IDLE_DELAYS times their delay are then dropped,
+ * their politeness state having nothing left to enforce.
+ */
+class host_table
+{
+    public:
+    typedef std::chrono::steady_clock::time_point time_point_t;
+
+    host_table(void);
+
+    /**
+     * returns the state for @host, creating it if needed. Must be given back
+     * with release()
+     */
+    struct host_state_s& get(std::string& host);
+
+    /**
+     * gives back the state of @host returned by get()
+     */
+    void release(std::string& host);
+
+    /**
+     * earliest time @host may be fetched from again. After an error a
+     * host's delay, at least HOST_BACKOFF_BASE, doubles with each
+     * consecutive error up to HOST_MAX_BACKOFF times.
+     */
+    time_point_t next_fetch(struct host_state_s& host);
+
+    /**
+     * true if @host may be fetched from now. Only a hint, the fetch must
+     * still be claimed with begin_fetch().
+     */
+    bool ready(struct host_state_s& host);
+
+    /**
+     * atomically claims the next fetch from @host, only one may run at
+     * once. Returns false if the host is not ready or another thread
+     * claimed it first.
+     */
+    bool begin_fetch(struct host_state_s& host);
+
+    /**
+     * ends a fetch claimed by begin_fetch(), @ok being its outcome
+     */
+    void end_fetch(struct host_state_s& host, bool ok);
+
+    //hosts in the table
+    size_t size(void);
+
+    private:
+    struct shard_s {
+        std::mutex lock;    //only held to find, insert or remove entries
+        std::unordered_map<std::string, struct host_state_s> hosts;
+        unsigned int lookups;
+    } shards[HOST_TABLE_SHARDS];
+
+    struct shard_s& shard_of(std::string& host);
+    std::chrono::seconds delay(struct host_state_s& host);
+    void prune(struct shard_s& shard);
+};
+
+#endif
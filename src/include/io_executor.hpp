@@ -0,0 +1,52 @@
+#if !defined(IO_EXECUTOR_H)
+#define IO_EXECUTOR_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//default worker threads, blocking file I/O so more than cores
+#define IO_THREADS  8
+
+/**
+ * Pool of threads running blocking I/O tasks, so that callers can submit
+ * requests and carry on rather than wait on the disk. Tasks run in
+ * submission order but complete in any order.
+ *
+ * All tasks submitted are run before destruction completes. Exceptions
+ * escaping a task are logged and dropped, tasks should report errors
+ * themselves.
+ */
+class io_executor
+{
+    public:
+    io_executor(unsigned int threads = IO_THREADS);
+    ~io_executor(void);
+
+    void submit(std::function<void()> task);
+
+    /**
+     * submits every task in @batch at once, leaving it empty
+     */
+    void submit_many(std::vector<std::function<void()>>& batch);
+
+    /**
+     * tasks submitted but not yet started
+     */
+    size_t pending(void);
+
+    private:
+    std::vector<std::thread> workers;
+    std::mutex queue_lock;
+    std::condition_variable queue_cv;
+    std::deque<std::function<void()>> tasks;
+    bool stopping;
+
+    void worker(void);
+};
+
+#endif
@@ -8,21 +8,31 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <future>
+#include <unordered_map>
+#include <condition_variable>
 #include <boost/lockfree/queue.hpp>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include "ipc_common.hpp"
 #include "page_data.hpp"
 #include "connection.hpp"
 
 #define BUFFER_MAX_SIZE     2048
+//nodes allocated up front by the submission queues
+#define SUBMIT_QUEUE_SIZE   256
+//longest a node waits in send_buffer
 #define SERVICE_GRANUALITY  std::chrono::milliseconds(500)
 /**
  * provided by process calling contructor, to configure ipc connection
  * user supplied/config file in production
  */
 struct ipc_config_s {
-    unsigned int gbuff_min;         //min size of get_buffer before fetching data
+    unsigned int gbuff_min;         //min size of get_buffer before fetching more
     unsigned int sbuff_max;         //max size of send_buffer before draining
     unsigned int sc;                //nodes to send to fill/drain buffer
     std::string master_address;
@@ -104,33 +114,74 @@ template<typename T> class mpmc_queue {
 
 using boost::asio::ip::tcp;
 
+/**
+ * called with each worker_config_s recieved from master
+ */
+typedef std::function<void(struct worker_config_s& config)> config_handler;
+
+/**
+ * Connection of a worker to its master, shared by every crawler thread of
+ * the worker over one socket. All methods are thread safe.
+ *
+ * The client owns an io_service, run by a background thread which does all
+ * socket I/O, connecting included. Other threads hand it work through
+ * lock-free queues: nodes to send through the send_buffer and requests
+ * through the submission queue, whose first entry posts one task to drain
+ * it, so that busy crawler threads rarely take a lock to talk to master.
+ *
+ * Requests to master are tagged with a request id and
+ * their completion handlers kept until the reply carrying that id arrives,
+ * so any number may be in flight at once. Callers get replies as futures.
+ *
+ * The get_buffer is kept topped up: whenever it holds, with nodes already
+ * requested, fewer than gbuff_min a batch of sc more is requested from
+ * master, so that get_item() rarely has to wait on the network. Nodes given
+ * to send_item() are collected in the send_buffer and sent as one message
+ * once sbuff_max are waiting, or every SERVICE_GRANUALITY.
+ */
 class ipc_client
 {
     public:
-    ipc_client(struct ipc_config_s& config, boost::asio::io_service& _ipc_service);
+    ipc_client(struct ipc_config_s& config);
+    ~ipc_client(void);
 
     /**
      * Used to send discovered/crawled pages to master.
-     * 
-     * Add item to send_buffer and immediately send. A thread will poll the
-     * send_buffer in the future and decide when to batch send.
      *
-     * Will block whilst sending data.
-     * Will throw system_error exception if IPC failed.
+     * Adds item to send_buffer, which the background thread sends in
+     * batches.
+     *
+     * Does not block.
+     * Will throw ipc_exception if IPC has already failed.
      */
     void send_item(struct queue_node_s& data);
 
     /**
-     * Requests one node from master and delivers to caller.
-     * In the future function will immidiately return data off of the get_buffer
-     * if any is present, and block only if its fully drained. A background
-     * queue will (try to) keep this buffer filled.
+     * Sends everything in the send_buffer now.
      *
-     * Will block whilst waiting for data from master.
-     * Will throw exception if queue is empty or IPC has failed.
+     * Will block until written.
+     * Will throw ipc_exception if IPC has failed.
+     */
+    void flush(void);
+
+    /**
+     * Returns the next node off the get_buffer, which the background thread
+     * keeps filled from master.
+     *
+     * Will block only if the get_buffer is empty, until a batch arrives.
+     * Will throw ipc_exception if master has no nodes left or IPC has failed.
      */
     struct queue_node_s get_item(void) throw(std::exception);
 
+    /**
+     * As get_item() but never waits on master. Returns false, having asked
+     * master for more, if the get_buffer is empty.
+     *
+     * Does not block.
+     * Will throw ipc_exception if IPC has failed.
+     */
+    bool try_get_item(struct queue_node_s& data);
+
     /**
      * Gets configuration structure from master. Should be used for subsequest
      * polls to make sure configuration is up-to-date.
@@ -144,10 +195,36 @@ class ipc_client
      * data transfer.
      *
      * Will block.
-     * Will throw system_error exception if IPC has failed.
+     * Will throw ipc_exception if IPC has failed.
      */
     struct worker_config_s get_config(void);
 
+    /**
+     * Requests configuration from master, as get_config() but without
+     * waiting for it.
+     *
+     * Does not block. The future throws ipc_exception if IPC has failed.
+     */
+    std::future<struct worker_config_s> request_config(void);
+
+    /**
+     * Requests up to @count nodes from master, bypassing the get_buffer. The
+     * reply holds none if master has no nodes left.
+     *
+     * Does not block. The future throws ipc_exception if IPC has failed.
+     */
+    std::future<std::vector<struct queue_node_s>> fetch_nodes(unsigned int count);
+
+    /**
+     * Registers @handler to be called with every configuration recieved
+     * from master, whether requested by get_config() or pushed by master.
+     * Used to apply settings which may change live, such as cache budgets.
+     *
+     * Handler is called from the background ipc thread. May be called
+     * whilst connected, replacing any handler registered before.
+     */
+    void on_config(config_handler handler);
+
     /**
      * Used to set worker status as reported to master.
      *
@@ -163,26 +240,66 @@ class ipc_client
     void set_capabilities(worker_capabilities_s& c);
 
     private:
+    //called on ipc_thread with the reply to a request loaded in connection_,
+    //or with @ok false if IPC failed first. Handlers decode the reply before
+    //changing any state, if it does not decode IPC fails and they are called
+    //again with @ok false
+    typedef std::function<void(bool ok)> reply_handler;
+
     struct ipc_config_s cfg;
     worker_status_e wstatus;
     struct worker_config_s wcfg;
     struct worker_capabilities_s wcaps;
+    config_handler config_changed;          //under state_lock
 
     //ipc
+    boost::asio::io_service ipc_service;
     connection connection_;
-    boost::asio::io_service* ipc_service;
     tcp::resolver resolver_;
+    std::thread ipc_thread;
+    std::unique_ptr<boost::asio::io_service::work> ipc_work;
+    std::promise<void> connected;
+    boost::asio::steady_timer send_timer;
+
+    //requests awaiting replies by id, ipc_thread only
+    std::unordered_map<uint64_t, reply_handler> outstanding;
+    uint64_t next_request_id;
 
     //internal work queues
     mpmc_queue<struct queue_node_s> get_buffer;
-    mpmc_queue<struct queue_node_s> send_buffer;
+    boost::lockfree::queue<struct queue_node_s*> send_buffer;
+    std::atomic<long> send_size;            //counted after the push, may dip below 0
+    std::atomic<bool> drain_posted;         //drain_send_buffer() on its way
+
+    //tasks for ipc_thread from other threads
+    boost::lockfree::queue<std::function<void(void)>*> submissions;
+    std::atomic<bool> submit_posted;        //run_submissions() on its way
+
+    //get_buffer refills, under state_lock
+    std::mutex state_lock;
+    std::condition_variable state_cv;
+    unsigned long requests;         //node requests sent, numbered from 1
+    unsigned long last_empty;       //last request master had no nodes for
+    unsigned int refill_nodes;      //nodes asked for, not yet recieved
+    std::string ipc_error;          //set once the connection failed
+    std::atomic<bool> failed;       //ipc_error is set, checked without state_lock
 
     void connect(void) throw(std::exception);
-    void handle_connected(const boost::system::error_code& ec) throw(std::exception);
-    void write_complete(boost::system::error_code ec) throw(std::exception);
-    void write_no_read(boost::system::error_code ec) throw(std::exception);
-    void read_data(const boost::system::error_code& ec) throw(std::exception);
-    void process_instruction(void);
+    void submit(std::function<void(void)> task);
+    void run_submissions(void);
+    void refill(bool needed);
+    std::string error(void);
+    void fail(std::string error);
+    template<typename T> void send(data_type_e type, T data, uint64_t request_id = 0, uint16_t flags = 0);
+    template<typename T> void request(data_type_e type, T data, reply_handler handler);
+    void write_done(const boost::system::error_code& ec);
+    void handle_connected(const boost::system::error_code& ec);
+    void drain_send_buffer(void);
+    void send_tick(const boost::system::error_code& ec);
+    void read_data(const boost::system::error_code& ec);
+    bool process_data(void);
+    struct worker_config_s process_config(void);
+    void process_instruction(ctrl_instruction_e instruction, uint64_t request_id);
 };
 
 #endif
@@ -19,7 +19,9 @@ enum data_type_e {
     dt_wstatus,     //worker_status_e           worker -> master
     dt_wcap,        //worker_capabilities_s     worker -> master
     dt_wconfig,     //worker_config_s           worker <- master
-    dt_queue_node   //queue_node_s              worker <-> master
+    dt_queue_node,  //queue_node_s              worker <-> master
+    dt_node_request,//unsigned int, nodes wanted worker -> master
+    dt_queue_nodes  //vector of queue_node_s    worker <-> master, empty if none
 };
 
 //
@@ -113,7 +115,7 @@ struct worker_config_s {
     unsigned int day_max_crawls;    //per page
     unsigned int worker_id;
 
-    //cache config
+    //cache memory budgets and reserves, KiB
     unsigned int page_cache_max;
     unsigned int page_cache_res;
     unsigned int robots_cache_max;
@@ -0,0 +1,58 @@
+#if !defined(KEY_FILTER_H)
+#define KEY_FILTER_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//counters per expected key, with FILTER_HASHES gives ~1% false positives
+#define FILTER_CELLS_PER_KEY    10
+#define FILTER_HASHES           7
+
+/**
+ * Counting Bloom filter over key hashes, used to tell that a key is
+ * certainly not stored without asking the storage. Supports removal as long
+ * as each removed hash was added, and only once per add. Counters saturate
+ * rather than wrap, saturated counters are never decremented.
+ *
+ * Not thread safe.
+ */
+class key_filter
+{
+    public:
+    key_filter(size_t expected_keys);
+
+    void add(size_t hash);
+    void remove(size_t hash);
+
+    /**
+     * false if @hash was certainly never added (or since removed)
+     */
+    bool may_contain(size_t hash);
+
+    /**
+     * Replaces filter contents with those saved at @path. Returns false,
+     * leaving the filter unchanged, if there is no valid filter of the same
+     * size there.
+     */
+    bool load(std::string path);
+
+    /**
+     * writes filter contents to @path, returns false on error
+     */
+    bool save(std::string path);
+
+    /**
+     * number of keys held
+     */
+    size_t keys(void);
+
+    private:
+    std::vector<uint8_t> counters;
+    size_t key_count;
+
+    size_t index_of(size_t hash, unsigned int i);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#if !defined(LINK_SCAN_H)
+#define LINK_SCAN_H
+
+#include <iostream>
+#include <vector>
+
+#include "parser.hpp"
+
+/**
+ * Link only extraction for frontier expansion crawls. Scans raw html for
+ * <a href=".."> and <base href=".."> without building a DOM or validating
+ * utf-8. The search for tag openings is vectorised, with AVX2 if the cpu
+ * has it, else SSE2 on x86, with a scalar fallback.
+ *
+ * Each <a> with a href produces a tag_type_url data_node_s with tag_name "a"
+ * and the (entity decoded) href as attr_data, as the xpath "//a[@href]"
+ * would. Unlike it, tag_data is left empty: anchor text may span chunks
+ * and nothing reads it for links. Hrefs are left as written, see parser
+ * for their resolution. The first <base> href seen is stored in @base_href, if it is
+ * empty. Comments, <script> and <style> contents are skipped.
+ *
+ * Returns the number of bytes consumed. When scanning a stream, anything
+ * after that (an incomplete tag) must be prepended to the next chunk. A
+ * chunk ending inside a comment, <script> or <style> leaves the terminator
+ * looked for in @raw_close, to be passed with the next chunk, so that only
+ * the few bytes which may begin it are kept rather than the whole element.
+ * @raw_close must be empty at the start of a page.
+ */
+size_t scan_links(const char* data, size_t size, std::vector<struct data_node_s>& nodes,
+    std::string& base_href, std::string& raw_close);
+
+#endif
@@ -0,0 +1,119 @@
+#if !defined(LOG_DB_H)
+#define LOG_DB_H
+
+#include <iostream>
+
+#include "db_backend.hpp"
+#include "record_codec.hpp"
+#include "log_store.hpp"
+#include "debug.hpp"
+
+/**
+ * Objects are encoded by record_codec as with database<T>, but appended to
+ * the segments of a log_store kept in directory @uri/@table.log, rather than
+ * each written to its own file.
+ */
+template<typename T> class log_database: public db_backend<T>
+{
+    public:
+    log_database(std::string uri, std::string table, size_t segment_max = LOG_SEGMENT_MAX, bool compress = false);
+    ~log_database(void);
+
+    void get_object(T*& t, std::string& key) throw(std::exception);
+    void put_object(T*& t, std::string& key);
+    void delete_object(std::string& key) throw(std::exception);
+    bool is_recent(T*& t, std::string& key) throw(std::exception);
+    struct db_filter_stats_s filter_stats(void);
+    struct compress_stats_s compress_stats(void);
+    void set_executor(io_executor* e);
+
+    /**
+     * segment counters, for reporting
+     */
+    struct log_stats_s log_stats(void);
+
+    /**
+     * compacts now rather than waiting for the background thread, returns
+     * segments compacted
+     */
+    unsigned int compact(void);
+
+    private:
+    log_store* store;
+
+    //always there to read records compressed earlier
+    record_compressor compressor;
+    bool compress;
+};
+
+template<typename T> log_database<T>::log_database(std::string uri, std::string table, size_t segment_max, bool compress):
+    compressor(uri+"/"+table),
+    compress(compress)
+{
+    store = new log_store(uri+"/"+table+".log", segment_max);
+}
+
+template<typename T> log_database<T>::~log_database(void)
+{
+    delete store;
+}
+
+template<typename T> void log_database<T>::get_object(T*& t, std::string& key) throw(std::exception)
+{
+    std::string value;
+
+    //if nothing is stored we simply leave @t as is
+    if(!store->get(key, value))
+        return;
+
+    T* loaded = decode_record<T>(value.data(), value.size(), &compressor);
+    delete t;
+    t = loaded;
+}
+
+template<typename T> void log_database<T>::put_object(T*& t, std::string& key)
+{
+    std::string record;
+    encode_record(t, record, compress ? &compressor : 0);
+
+    store->put(key, record);
+}
+
+template<typename T> void log_database<T>::delete_object(std::string& key) throw(std::exception)
+{
+    //pages never stored have nothing to remove
+    store->remove(key);
+}
+
+template<typename T> bool log_database<T>::is_recent(T*& t, std::string& key) throw(std::exception)
+{
+    return true;
+}
+
+template<typename T> struct db_filter_stats_s log_database<T>::filter_stats(void)
+{
+    return store->filter_stats();
+}
+
+template<typename T> struct log_stats_s log_database<T>::log_stats(void)
+{
+    return store->stats();
+}
+
+template<typename T> unsigned int log_database<T>::compact(void)
+{
+    return store->compact();
+}
+
+template<typename T> struct compress_stats_s log_database<T>::compress_stats(void)
+{
+    return compressor.stats();
+}
+
+template<typename T> void log_database<T>::set_executor(io_executor* e)
+{
+    db_backend<T>::set_executor(e);
+    compressor.set_executor(e);
+}
+
+#endif
@@ -0,0 +1,144 @@
+#if !defined(LOG_STORE_H)
+#define LOG_STORE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "db_backend.hpp"
+
+//bytes after which the active segment is sealed and a new one started
+#define LOG_SEGMENT_MAX         (64*1024*1024)
+//percent of a sealed segment which must be dead before it is compacted
+#define LOG_COMPACT_PERCENT     50
+//time between background compaction passes, ms
+#define LOG_COMPACT_INTERVAL    60000
+
+/**
+ * segment and compaction counters
+ */
+struct log_stats_s {
+    unsigned long keys;             //live keys in index
+    unsigned long segments;
+    unsigned long bytes;            //total size of segment files
+    unsigned long dead_bytes;       //of which overwritten or deleted
+    unsigned long compactions;      //segments compacted since creation
+};
+
+/**
+ * Bitcask style key/value store. Records are only ever appended to the
+ * active segment file, and an in memory index maps the hash of each key to
+ * the location of its latest record. Deletes append a tombstone.
+ *
+ * When the active segment reaches segment_max it is sealed and a hint file
+ * is written beside it, listing the index entries it holds. On creation the
+ * index is rebuilt from the hint files, only segments without one (ie. the
+ * active segment when the process died) are scanned. A torn record at the
+ * end of a scanned segment is truncated away.
+ *
+ * A background thread compacts sealed segments which are mostly dead, by
+ * appending their live records to the active segment and removing them.
+ *
+ * Keys are indexed by their hash, two keys with the same hash replace each
+ * other as they did with one file per hash. The full key is kept in each
+ * record so such a collision reads as a miss rather than the wrong object.
+ *
+ * All methods are thread safe. Appends are serialised, reads only hold the
+ * lock for the index lookup.
+ */
+class log_store
+{
+    public:
+    /**
+     * Opens, or creates, the store kept in directory @path. Throws
+     * db_exception if the directory can not be used.
+     */
+    log_store(std::string path, size_t segment_max = LOG_SEGMENT_MAX) throw(db_exception);
+    ~log_store(void);
+
+    /**
+     * Copies the value stored under @key into @value. Returns false, leaving
+     * @value unmodified, if there is none.
+     */
+    bool get(std::string& key, std::string& value) throw(db_exception);
+
+    void put(std::string& key, const std::string& value) throw(db_exception);
+
+    /**
+     * returns false if nothing was stored under @key
+     */
+    bool remove(std::string& key) throw(db_exception);
+
+    /**
+     * Compacts every sealed segment over LOG_COMPACT_PERCENT dead, returns
+     * the number compacted. Called periodically by the background thread.
+     */
+    unsigned int compact(void);
+
+    struct log_stats_s stats(void);
+    struct db_filter_stats_s filter_stats(void);
+
+    private:
+    struct segment_s {
+        uint32_t id;
+        int fd;
+        uint64_t size;
+        uint64_t dead;
+        ~segment_s(void);
+    };
+
+    //where the latest record of a key is
+    struct location_s {
+        uint32_t segment;
+        uint32_t size;              //whole record
+        uint64_t offset;
+    };
+
+    //hint file entry
+    struct hint_s {
+        uint64_t hash;
+        uint64_t offset;
+        uint32_t size;
+        uint32_t flags;
+    };
+
+    std::string dir;
+    size_t segment_max;
+
+    std::mutex store_lock;
+    std::map<uint32_t, std::shared_ptr<segment_s>> segments;
+    std::shared_ptr<segment_s> active;
+    std::vector<hint_s> active_hints;
+    std::unordered_map<uint64_t, location_s> index;
+
+    std::thread compact_thread;
+    std::mutex compact_mutex;
+    std::condition_variable compact_cv;
+    bool stopping;
+
+    std::atomic<unsigned long> lookups;
+    std::atomic<unsigned long> skipped;
+    std::atomic<unsigned long> false_positives;
+    std::atomic<unsigned long> compactions;
+
+    std::string segment_path(uint32_t id, const char* ext);
+    std::shared_ptr<segment_s> open_segment(uint32_t id, bool create) throw(db_exception);
+    void load_segment(std::shared_ptr<segment_s> seg);
+    void apply(uint32_t id, hint_s& h);
+    void seal_active(void);
+    bool write_hints(uint32_t id, std::vector<hint_s>& hints);
+
+    hint_s append(uint32_t flags, std::string& key, const std::string& value) throw(db_exception);
+    void compact_segment(uint32_t id);
+    void compactor(void);
+};
+
+#endif
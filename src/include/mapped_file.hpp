@@ -0,0 +1,33 @@
+#if !defined(MAPPED_FILE_H)
+#define MAPPED_FILE_H
+
+#include <iostream>
+#include <string>
+
+/**
+ * Read only memory mapping of a whole file, unmapped on destruction. Lets
+ * records be read in place rather than copied through a stream.
+ */
+class mapped_file
+{
+    public:
+    /**
+     * maps @path, check is_open() for success
+     */
+    mapped_file(std::string path);
+    ~mapped_file(void);
+
+    bool is_open(void);
+    const char* data(void);
+    size_t size(void);
+
+    private:
+    const char* base;
+    size_t length;
+    bool opened;
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+};
+
+#endif
@@ -3,14 +3,27 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
 
 #include "page_data.hpp"
 #include "robots_txt.hpp"
 #include "cache.hpp"
 #include "file_db.hpp"
+#include "log_db.hpp"
 
 class robots_txt;
 
+//default time between write backs of dirty objects, ms
+#define MMGR_FLUSH_INTERVAL 5000
+//default bytes of dirty objects which trigger an early write back
+#define MMGR_MAX_DIRTY      (8*1024*1024)
+
 /**
  * generic exception interface to memory_mgr
  *
@@ -33,12 +46,50 @@ struct mmgr_config
     std::string database_path;
     std::string object_table;
     std::string user_agent; //when instantiating robots_txt classes
+    cache_policy_e cache_policy;
+
+    //cache memory budget and reserve in bytes, 0 for CACHE_MAX/CACHE_RES
+    size_t cache_max;
+    size_t cache_res;
+
+    //write behind, 0 for MMGR_FLUSH_INTERVAL/MMGR_MAX_DIRTY
+    unsigned int flush_interval;    //ms
+    size_t max_dirty;               //bytes
+
+    db_type_e db_type;              //storage engine, db_file by default
+    bool compress;                  //zstd compress stored records
+    size_t expected_keys;           //objects the file engine's filter is sized for, 0 for DB_FILTER_KEYS
+    unsigned int io_threads;        //database I/O threads, 0 for IO_THREADS
+
+    //write-ahead log with group commit, file engine only
+    bool durable;
+    unsigned int commit_window;     //us, 0 for WAL_COMMIT_WINDOW
+    unsigned int commit_batch;      //records, 0 for WAL_COMMIT_BATCH
+};
+
+/**
+ * write behind counters, the difference between puts and writes is the
+ * number of database writes saved
+ */
+struct mmgr_stats_s {
+    unsigned long puts;             //calls to put_object_nblk()
+    unsigned long dirty_puts;       //of which modified the object
+    unsigned long writes;           //objects written to database
 };
 
 /**
  * controls allocating/deletion of page_data_c'
  *      for now only uses new/delete
  *
+ * A single instance is shared by every crawler thread of a worker, all
+ * methods are thread safe.
+ *
+ * Writes are deferred: put objects are only marked dirty in the cache, and
+ * a background thread writes them to the database every flush_interval, or
+ * sooner once max_dirty bytes are waiting. Repeated puts of an object in
+ * between thus cost one write. Dirty objects are never evicted, they stay
+ * cached until a flush, or destruction, has written them.
+ *
  * to do/
  *      use a pool of pre allocated page_data_c
  *          -- fifo?
@@ -58,8 +109,9 @@ template<class T> class memory_mgr
      */
     /**
      * Attempts to perform a cache lookup for object @T based on @url hash.
-     * If object is found in cache, database is still checked for @url entries
-     * and a hash of @T is compared to ensure cache consistancy.
+     * A cached object is returned as is, every write goes through the cache
+     * so it is never older than the database's. Otherwise it is loaded from
+     * the database and cached.
      *
      * If no object is found in cache or database, a new @T is allocated
      *
@@ -68,17 +120,17 @@ template<class T> class memory_mgr
     T* get_object_nblk(std::string& url) throw(std::exception);
 
     /**
-     * Tries to store object @T in cache and database at @url key. Object
-     * will always be stored to database but may not be cached. If object
-     * does not make it to cache it will still be put into the database but
-     * is then deleted. As such, @T should not be accessed after calling
-     * this method.
+     * Stores object @T in cache at @url key. It is written to the database
+     * by the next flush, and only if @modified is set (by this or an earlier
+     * put). If object does not make it to cache it is put into the database
+     * straight away and then deleted. As such, @T should not be accessed
+     * after calling this method.
      *
      * Will throw an exception if object is locked (should not happen as
      * get_object() performs lock) or connection to database has failed.
-     * Caller should re-try later.
+     * Caller should re-try later, @T is then still its own.
      */
-    void put_object_nblk(T* t, std::string& url) throw(std::exception);
+    void put_object_nblk(T* t, std::string& url, bool modified = true) throw(std::exception);
 
     /**
      * Attempts to delete object from cache and database.
@@ -92,6 +144,13 @@ template<class T> class memory_mgr
      */
     void delete_object_nblk(T* t, std::string& url) throw(std::exception);
 
+    /**
+     * Loads objects at @urls not already cached into the cache in the
+     * background, unlocked, so that a later get_object_nblk() hits. Returns
+     * without waiting on the database.
+     */
+    void prefetch(std::vector<std::string>& urls);
+
     /**
      * BLOCKING API
      */
@@ -110,22 +169,104 @@ template<class T> class memory_mgr
      */
     void delete_object_blk(T* t, std::string& url);
 
+    /**
+     * cache hit/miss counters, for reporting
+     */
+    struct cache_stats_s cache_stats(void);
+
+    /**
+     * Changes the cache memory budget, see cache::resize(). Safe to call
+     * whilst other threads use the memory_mgr.
+     */
+    void resize_cache(size_t max_bytes, size_t res_bytes);
+
+    /**
+     * write behind counters, for reporting
+     */
+    struct mmgr_stats_s write_stats(void);
+
+    /**
+     * database negative lookup counters, for reporting
+     */
+    struct db_filter_stats_s db_stats(void);
+
+    /**
+     * stored record compression counters, for reporting
+     */
+    struct compress_stats_s compress_stats(void);
+
     private:
     struct mmgr_config cfg;
 
     cache<T>* mem_cache;
-    database<T>* mem_db;
+    db_backend<T>* mem_db;
+    io_executor* executor;          //database requests off the calling thread
+
+    //write behind
+    std::thread flush_thread;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+    bool stopping;
+    std::atomic<unsigned long> puts;
+    std::atomic<unsigned long> dirty_puts;
+    std::atomic<unsigned long> writes;
+
+    void write_object(T* t, std::string& key);
+    void write_objects(std::vector<T*>& objects, std::vector<std::string>& keys);
+    void load_object(std::string& url);
+    void flusher(void);
 };
 
 template<class T> memory_mgr<T>::memory_mgr(struct mmgr_config& config)
 {
     cfg = config;
-    mem_cache = new cache<T>;
-    mem_db = new database<T>(cfg.database_path, cfg.object_table);
+    if(!cfg.cache_max) {
+        cfg.cache_max = CACHE_MAX*1024;
+        cfg.cache_res = CACHE_RES*1024;
+    }
+
+    if(!cfg.flush_interval)
+        cfg.flush_interval = MMGR_FLUSH_INTERVAL;
+    if(!cfg.max_dirty)
+        cfg.max_dirty = MMGR_MAX_DIRTY;
+
+    mem_cache = new cache<T>(cfg.cache_policy, cfg.cache_max, cfg.cache_res);
+    if(cfg.db_type == db_log)
+        mem_db = new log_database<T>(cfg.database_path, cfg.object_table, LOG_SEGMENT_MAX, cfg.compress);
+    else
+        mem_db = new database<T>(cfg.database_path, cfg.object_table,
+            cfg.expected_keys ? cfg.expected_keys : DB_FILTER_KEYS, cfg.compress,
+            cfg.durable, cfg.commit_window ? cfg.commit_window : WAL_COMMIT_WINDOW, cfg.commit_batch);
+
+    executor = new io_executor(cfg.io_threads ? cfg.io_threads : IO_THREADS);
+    mem_db->set_executor(executor);
+
+    puts = 0;
+    dirty_puts = 0;
+    writes = 0;
+    stopping = false;
+    mem_cache->on_writeback(std::bind(&memory_mgr<T>::write_object, this,
+        std::placeholders::_1, std::placeholders::_2));
+    mem_cache->on_writeback_many(std::bind(&memory_mgr<T>::write_objects, this,
+        std::placeholders::_1, std::placeholders::_2));
+    flush_thread = std::thread(&memory_mgr<T>::flusher, this);
 }
 
 template<class T> memory_mgr<T>::~memory_mgr(void)
 {
+    flush_mutex.lock();
+    stopping = true;
+    flush_mutex.unlock();
+    flush_cv.notify_one();
+    flush_thread.join();
+
+    //runs outstanding prefetches, which need the cache and database
+    mem_db->set_executor(0);
+    delete executor;
+
+    //anything put since the last flush
+    mem_cache->flush();
+
     delete mem_cache;
     delete mem_db;
 }
@@ -134,36 +275,52 @@ template<class T> T* memory_mgr<T>::get_object_nblk(std::string& url) throw(std:
 {
     T* t;
 
-    if(!mem_cache->get_object(&t, url)) {
+    //the cache takes the object lock, so that threads sharing this manager
+    //never hold the same object at once
+    cache_result_e r = mem_cache->get_object(&t, url);
+    if(r == cache_miss) {
         //objects not in cache need to be allocated first,before haniding
         //to database to fill out.
         t = new T;
-
         mem_db->get_object(t, url);
-    } else {
-        //cache coherencey
-        if(!mem_db->is_recent(t, url))
-            mem_db->get_object(t, url);
+
+        //another thread may have missed on the same key meanwhile
+        r = mem_cache->add_object(&t, url);
     }
+    //a hit is never reloaded: writes go through the cache, so the cached
+    //object is at least as recent as the database's, and the database may
+    //replace the object it loads into whilst the cache still points at it
 
     // check if object is locked
-    if(t->is_locked())
+    if(r == cache_locked)
         throw memory_exception("LOCKED. Cannot access object "+url);
-    t->lock();
 
     return t;
 }
 
-template<class T> void memory_mgr<T>::put_object_nblk(T* t, std::string& url) throw(std::exception)
+template<class T> void memory_mgr<T>::put_object_nblk(T* t, std::string& url, bool modified) throw(std::exception)
 {
     if(!t->is_locked())
         throw memory_exception("UNLOCKED. memory_mgr::put_object_nblk given an unlocked object. Was it allocated by us?");
 
-    mem_db->put_object(t, url);
-    if(!mem_cache->put_object(t, url))
-        delete t; //object did not make it to cache
-    else
-        t->unlock();
+    ++puts;
+    if(modified)
+        ++dirty_puts;
+
+    //cache unlocks the object, and writes it back later if modified
+    if(!mem_cache->put_object(t, url, modified)) {
+        //object did not make it to cache, if it is not stored either it is
+        //left with the caller
+        try {
+            write_object(t, url);
+        } catch(std::exception& e) {
+            throw memory_exception("failed to store object "+url+": "+e.what());
+        }
+        delete t;
+    }
+
+    if(mem_cache->dirty_bytes() > cfg.max_dirty)
+        flush_cv.notify_one();
 }
 
 template<class T> void memory_mgr<T>::delete_object_nblk(T* t, std::string& url) throw(std::exception)
@@ -171,8 +328,98 @@ template<class T> void memory_mgr<T>::delete_object_nblk(T* t, std::string& url)
     if(!t->is_locked())
         throw memory_exception("UNLOCKED. Cannot delete object "+url+" - Was it allocated by us?");
 
-    mem_db->delete_object(url);
+    //drop from cache first so no other thread can pick up the object
     mem_cache->delete_object(url);
+    t->unlock();
     delete t;
+
+    mem_db->delete_object(url);
+}
+
+template<class T> void memory_mgr<T>::prefetch(std::vector<std::string>& urls)
+{
+    for(auto& url: urls) {
+        if(mem_cache->contains(url))
+            continue;
+
+        executor->submit(std::bind(&memory_mgr<T>::load_object, this, url));
+    }
+}
+
+template<class T> struct cache_stats_s memory_mgr<T>::cache_stats(void)
+{
+    return mem_cache->stats();
+}
+
+template<class T> void memory_mgr<T>::resize_cache(size_t max_bytes, size_t res_bytes)
+{
+    mem_cache->resize(max_bytes, res_bytes);
+}
+
+template<class T> struct mmgr_stats_s memory_mgr<T>::write_stats(void)
+{
+    struct mmgr_stats_s st;
+    st.puts = puts;
+    st.dirty_puts = dirty_puts;
+    st.writes = writes;
+
+    return st;
+}
+
+template<class T> struct db_filter_stats_s memory_mgr<T>::db_stats(void)
+{
+    return mem_db->filter_stats();
+}
+
+template<class T> struct compress_stats_s memory_mgr<T>::compress_stats(void)
+{
+    return mem_db->compress_stats();
+}
+
+template<class T> void memory_mgr<T>::write_object(T* t, std::string& key)
+{
+    mem_db->put_object(t, key);
+    ++writes;
+}
+
+//flush() batches, written in parallel on the executor
+template<class T> void memory_mgr<T>::write_objects(std::vector<T*>& objects, std::vector<std::string>& keys)
+{
+    //the cache keeps them locked until we return
+    mem_db->put_many(objects, keys).get();
+    writes += objects.size();
+}
+
+//prefetch() of one url, on the executor
+template<class T> void memory_mgr<T>::load_object(std::string& url)
+{
+    T* t = new T;
+    try {
+        mem_db->get_object(t, url);
+    } catch(std::exception& e) {
+        dbg<<"prefetch of ["<<url<<"] failed: "<<e.what()<<"\n";
+        delete t;
+        return;
+    }
+
+    //a caller holding it already has it cached
+    if(mem_cache->add_object(&t, url) == cache_hit && !mem_cache->put_object(t, url))
+        delete t;
+}
+
+//background thread writing back dirty objects
+template<class T> void memory_mgr<T>::flusher(void)
+{
+    std::unique_lock<std::mutex> lock(flush_mutex);
+
+    while(!stopping) {
+        flush_cv.wait_for(lock, std::chrono::milliseconds(cfg.flush_interval));
+        if(stopping)
+            break;
+
+        lock.unlock();
+        mem_cache->flush();
+        lock.lock();
+    }
 }
 #endif
@@ -3,8 +3,35 @@
 
 #include <iostream>
 #include <mutex>
+#include <map>
+#include <vector>
+#include <functional>
 #include <curl/curl.h>
 
+//default limits for the multiplexed (async) fetch engine
+#define NETIO_MAX_TRANSFERS     256     //total transfers in flight
+#define NETIO_MAX_HOST_CONN     4       //connections per host
+
+/**
+ * called once per completed async transfer. @data holds the page body, or
+ * if @ok is false the reason the transfer failed
+ */
+typedef std::function<void(std::string& url, std::string& data, bool ok)> fetch_handler;
+
+/**
+ * called with each chunk of body data as it arrives from the network (see
+ * streaming fetch). Returning false aborts the transfer.
+ */
+typedef std::function<bool(const char* data, size_t size)> chunk_handler;
+
+/**
+ * configuration of the multiplexed fetch engine
+ */
+struct netio_multi_config_s {
+    unsigned int max_transfers;     //total concurrent transfers
+    unsigned int max_host_conn;     //concurrent connections to any one host
+};
+
 class netio
 {
     public:
@@ -12,21 +39,89 @@ class netio
     netio(std::string user_agent_string, bool enable_debug);
     ~netio();
 
+    /**
+     * BLOCKING API
+     *
+     * Fetches @url into @mem, returns false on failure.
+     */
     bool fetch(std::string* mem, std::string url);
+
+    /**
+     * Streaming variant of fetch, body data is passed to @handler as it
+     * arrives instead of being buffered. Returns false on failure or if
+     * @handler aborted the transfer.
+     */
+    bool fetch(chunk_handler handler, std::string url);
+
+    /**
+     * why the last blocking fetch to fail did so
+     */
     std::string last_error(void);
     void reset_config(void);
     size_t store_data(char *ptr, size_t size, size_t nmemb);
 
+    /**
+     * ASYNC API
+     *
+     * Transfers are multiplexed over one curl_multi handle; many may be in
+     * flight at once but the engine is only driven by calls to perform()
+     * or run(), from which @handler is invoked on completion. A transfer
+     * that can not be set up fails straight away, from fetch_async().
+     *
+     * fetch_async() and pending() may be called from any thread, also
+     * whilst another waits in perform(), which is woken to pick up new
+     * transfers.
+     *
+     * Async transfers do not share the blocking API's easy handle so both
+     * may be used on the same object.
+     */
+    void configure_multi(struct netio_multi_config_s& config);
+    void fetch_async(std::string url, fetch_handler handler);
+
+    /**
+     * Drives transfers for up to @timeout_ms waiting on socket activity.
+     * Returns the number of transfers still in flight.
+     */
+    unsigned int perform(int timeout_ms);
+
+    /**
+     * Blocks until every queued transfer has completed.
+     */
+    void run(void);
+
+    /**
+     * transfers queued or in flight
+     */
+    unsigned int pending(void);
+
     private:
     std::mutex lib_mutex;
     CURL* lib_handle;
-    CURLcode curl_ret;
 
     std::string user_agent;
+    std::mutex error_lock;
     std::string error_buffer;
     std::string* target_memory;
+    chunk_handler target_handler;
+    bool debug_output;
+
+    //async state. multi_handle is only used under perform_mutex, which is
+    //dropped whilst polling; transfers and added under multi_mutex
+    struct transfer_s {
+        std::string url;
+        std::string data;
+        fetch_handler handler;
+    };
+    std::mutex perform_mutex;
+    std::mutex multi_mutex;
+    CURLM* multi_handle;
+    std::map<CURL*, struct transfer_s*> transfers;
+    std::vector<CURL*> added;       //queued, not yet given to multi_handle
 
-    bool default_config(bool debug);
+    CURLcode default_config(CURL* handle, bool debug);
+    void set_error(CURLcode ret);
+    void add_transfers(void);
+    void complete_transfers(void);
 };
 
 #endif
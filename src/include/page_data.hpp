@@ -58,6 +58,24 @@ class page_data_c
         return use_count > 0;
     }
 
+    /**
+     * estimated bytes of memory held by this page, for cache budgets
+     */
+    size_t footprint(void)
+    {
+        size_t bytes = sizeof(*this) + url.capacity() + title.capacity() + description.capacity();
+
+        bytes += out_links.capacity()*sizeof(std::string);
+        for(auto& l: out_links)
+            bytes += l.capacity();
+
+        bytes += meta.capacity()*sizeof(Glib::ustring);
+        for(auto& m: meta)
+            bytes += m.capacity();
+
+        return bytes;
+    }
+
     template<class Archive>
     void save(Archive& ar, const unsigned int version) const
     {
@@ -0,0 +1,130 @@
+#if !defined(PAGE_RECORD_H)
+#define PAGE_RECORD_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#include "page_data.hpp"
+
+#define PAGE_RECORD_MAGIC   0x63726770  //"pgrc" on disk
+#define PAGE_RECORD_VERSION 1
+
+/**
+ * Stored page_data_c layout, replacing the boost archive for pages:
+ *
+ *      u32     magic
+ *      u8      version
+ *      varint  rank
+ *      varint  crawl_count
+ *      i64     last_crawl, system_clock ticks since epoch
+ *      string  url
+ *      string  title
+ *      string  description
+ *      varint  out link count, then each as a string
+ *      varint  meta count, then each as a string
+ *
+ * Fixed width integers are little endian, varints are LEB128, strings are a
+ * varint byte length followed by the UTF-8 bytes, without terminator.
+ */
+
+/**
+ * a string held within a record
+ */
+struct page_field_s {
+    const char* data;
+    size_t size;
+
+    std::string str(void) const
+    {
+        return std::string(data, size);
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, const page_field_s& f);
+
+/**
+ * the strings of a list field, in stored order
+ */
+class page_field_list
+{
+    public:
+    class iterator
+    {
+        public:
+        iterator(const char* pos, size_t remaining);
+
+        page_field_s operator*(void) const;
+        iterator& operator++(void);
+        bool operator!=(const iterator& i) const;
+
+        private:
+        const char* pos;
+        size_t remaining;
+    };
+
+    page_field_list(void);
+    page_field_list(const char* start, size_t count);
+
+    size_t size(void) const;
+    iterator begin(void) const;
+    iterator end(void) const;
+
+    private:
+    const char* start;
+    size_t count;
+};
+
+/**
+ * Reads a page record in place, for callers only needing a few fields or
+ * reading records straight out of a mapped file. Returned fields point into
+ * the record, which must outlive them.
+ *
+ * The record is bounds checked once on construction, accessors of a view
+ * which is not valid() return empty fields.
+ */
+class page_view
+{
+    public:
+    page_view(const char* data, size_t size);
+
+    bool valid(void) const;
+
+    unsigned int rank(void) const;
+    unsigned int crawl_count(void) const;
+    std::chrono::system_clock::time_point last_crawl(void) const;
+    page_field_s url(void) const;
+    page_field_s title(void) const;
+    page_field_s description(void) const;
+    page_field_list out_links(void) const;
+    page_field_list meta(void) const;
+
+    /**
+     * copies every field into @page
+     */
+    void materialize(page_data_c& page) const;
+
+    private:
+    bool is_valid;
+    uint64_t rank_v;
+    uint64_t crawl_count_v;
+    int64_t last_crawl_v;
+    page_field_s url_f;
+    page_field_s title_f;
+    page_field_s description_f;
+    page_field_list out_links_l;
+    page_field_list meta_l;
+};
+
+/**
+ * appends the record of @page to @out
+ */
+void encode_page_record(const page_data_c& page, std::string& out);
+
+/**
+ * true if @data starts with a page record header, of any version
+ */
+bool is_page_record(const char* data, size_t size);
+
+#endif
@@ -17,23 +17,114 @@ struct data_node_s {
     tag_type_e tag_type;       //type of tag that this /should/ be
 };
 
-/* to do
- * give parser netio object on creation
- *  - libcurl is needed for https access (and others?)
- *  - see libxml2 nanohttp limitations
- * pass tagdb_s config to parse()
- *  - no need to copy config each time
+/**
+ * tagdb_s parameter simple enough to be matched during a single SAX pass.
+ * Built from xpaths of the form //tag, //tag[@attr] or //tag[@attr='value']
  */
+struct sax_rule_s {
+    unsigned int param;         //index into parse_profile::param
+    std::string tag;            //lower case, as reported by the html parser
+    std::string cond_attr;      //attribute that must be present, if any
+    std::string cond_value;     //value cond_attr must hold if match_value
+    bool match_value;
+};
+
+/**
+ * A set of tagdb_s parameters with their xpath expressions compiled. Built
+ * once per worker_config_s::parse_param and then reused for every page.
+ * Compiled expressions are only read during evaluation so one profile may
+ * be shared by any number of parsers across threads.
+ *
+ * Parameters which the SAX engine understands are also turned into rules
+ * so that a streaming parser can extract all of them in one pass. The
+ * remainder fall back to xpath over a DOM, which is only built if needed.
+ */
+class parse_profile
+{
+    public:
+    parse_profile(std::vector<struct tagdb_s>& parse_param);
+    ~parse_profile(void);
 
+    //index matched, expr[i] is 0 if param[i].xpath failed to compile
+    std::vector<struct tagdb_s> param;
+    std::vector<xmlXPathCompExprPtr> expr;
+    std::vector<bool> by_sax;   //param[i] is handled by a sax rule
 
+    std::vector<struct sax_rule_s> rules;
+    bool needs_dom;             //some param can only be matched by xpath
 
+    //every param is //a[@href] with attr href, so streaming parsers skip
+    //libxml2 altogether and use the raw link scanner (see link_scan.hpp).
+    //Its links carry no tag_data, anchor text is not extracted
+    bool links_only;
+
+    private:
+    parse_profile(const parse_profile&);
+    parse_profile& operator=(const parse_profile&);
+};
+
+/**
+ * Links, the attr_data of tag_type_url nodes, are resolved against the
+ * page's first <base href>, or its url if it has none, whichever engine
+ * extracted them.
+ *
+ * A parser is reusable: a crawler thread keeps one for its lifetime and
+ * calls reset() per page, so the dictionary of tag and attribute names
+ * every page's libxml2 parser context shares, and the xpath context, are
+ * only allocated once per thread. Parsers are not shared between threads, but
+ * any number may run concurrently.
+ */
 class parser
 {
     public:
+    /**
+     * reusable streaming parser, reset() must be called before each page
+     */
+    parser(void);
+
+    /**
+     * parses the page @data already fetched (via netio) from @url. @url is
+     * only used as the document base, the parser performs no network io.
+     */
+    parser(std::string& data, Glib::ustring url);
+
+    /**
+     * creates a streaming (push) parser for @url. Page data is then given
+     * chunk by chunk via parse_chunk(), typically straight from the netio
+     * write callback, so parsing overlaps the transfer and the raw page is
+     * never held in memory.
+     */
     parser(Glib::ustring url);
+
+    /**
+     * streaming parser which extracts @profile's SAX capable parameters
+     * in a single pass as chunks arrive. A DOM is only built if @profile
+     * has parameters needing xpath. @profile must outlive the parser and
+     * should then be given to parse().
+     *
+     * Link only profiles bypass libxml2 and scan the raw chunks for links.
+     * Their data then holds no anchor text, tag_data is left empty.
+     */
+    parser(Glib::ustring url, parse_profile& profile);
     ~parser(void);
 
+    /**
+     * discards the previous page's document and data and starts streaming
+     * @url as the parser(url, profile) constructor would, reusing this
+     * parser's libxml2 contexts.
+     */
+    void reset(Glib::ustring url, parse_profile& profile);
+
+    /**
+     * feeds the next @size bytes of the page to a streaming parser. Returns
+     * false if the parser cannot accept more data.
+     */
+    bool parse_chunk(const char* chunk, size_t size);
+
     //walks the document tree, parsing based on configuration
+    void parse(parse_profile& profile);
+
+    //as above, compiling @param for this page only
     void parse(std::vector<struct tagdb_s>& param);
 
     //data from parsing
@@ -42,11 +133,43 @@ class parser
     private:
     std::string doc_url;
 
-    //libxml2
+    //libxml2, dictionary and xpath context are kept across pages
+    xmlDictPtr dict;
+    htmlParserCtxtPtr push_ctxt;
+    bool push_pending;          //push_ctxt holds an unfinished document
+    xmlXPathContextPtr xpath_ctxt;
     htmlDocPtr doc;
     xmlXPathObjectPtr tags;
 
+    //single pass extraction state
+    struct sax_match_s {
+        unsigned int node;      //index into data
+        int depth;              //element depth the match was opened at
+        std::string text;       //direct child text
+    };
+    parse_profile* sax_profile;
+    std::vector<struct sax_match_s> sax_open;
+    int sax_depth;
+
+    //link only state, unconsumed tail of the stream and the terminator of
+    //the comment or raw text element it ended in
+    std::string scan_buffer;
+    std::string scan_raw_close;
+
+    std::string base_href;      //first <base href> of the page, any engine
+
+    void init(void);
+    void clear(void);
+    void start_push(htmlSAXHandlerPtr sax);
     void save_nodes(struct tagdb_s& param);
+    void finish_push(void);
+    void find_base(void);
+    void resolve_links(void);
+
+    //libxml2 SAX callbacks, ctx is the parser context
+    static void sax_start_element(void* ctx, const xmlChar* name, const xmlChar** atts);
+    static void sax_end_element(void* ctx, const xmlChar* name);
+    static void sax_characters(void* ctx, const xmlChar* ch, int len);
 };
 
 #endif
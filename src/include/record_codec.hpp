@@ -0,0 +1,117 @@
+#if !defined(RECORD_CODEC_H)
+#define RECORD_CODEC_H
+
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+#include "db_backend.hpp"
+#include "page_data.hpp"
+#include "page_record.hpp"
+#include "record_compressor.hpp"
+
+/**
+ * read only stream over a record already in memory
+ */
+struct record_buf: std::streambuf {
+    record_buf(const char* data, size_t size)
+    {
+        char* p = const_cast<char*>(data);
+        setg(p, p, p+size);
+    }
+};
+
+/**
+ * Objects archived through pointers with boost, the stored format for
+ * anything without its own record_codec.
+ */
+template<typename T> struct boost_codec {
+    static void encode(T*& t, std::string& out)
+    {
+        std::ostringstream oss;
+        {
+            boost::archive::binary_oarchive arch(oss);
+            arch<<t;
+        }
+        out.append(oss.str());
+    }
+
+    /**
+     * returns a new object, boost allocates it when loading the pointer
+     */
+    static T* decode(const char* data, size_t size)
+    {
+        record_buf buf(data, size);
+        std::istream is(&buf);
+        boost::archive::binary_iarchive arch(is);
+        T* t = 0;
+        arch>>t;
+        return t;
+    }
+};
+
+/**
+ * How the databases store a @T, see the specialisations below.
+ */
+template<typename T> struct record_codec: boost_codec<T> {};
+
+/**
+ * Pages use the page_record layout. Pages stored as boost archives, before
+ * it, are still read.
+ */
+template<> struct record_codec<page_data_c> {
+    static void encode(page_data_c*& t, std::string& out)
+    {
+        encode_page_record(*t, out);
+    }
+
+    static page_data_c* decode(const char* data, size_t size)
+    {
+        if(!is_page_record(data, size))
+            return boost_codec<page_data_c>::decode(data, size);
+
+        page_view view(data, size);
+        if(!view.valid())
+            throw db_exception("corrupt page record");
+
+        page_data_c* t = new page_data_c;
+        view.materialize(*t);
+        return t;
+    }
+};
+
+/**
+ * Stored form of @t, appended to @out. Compressed if @compressor is set.
+ */
+template<typename T> void encode_record(T*& t, std::string& out, record_compressor* compressor)
+{
+    if(!compressor) {
+        record_codec<T>::encode(t, out);
+        return;
+    }
+
+    std::string record;
+    record_codec<T>::encode(t, record);
+    compressor->compress(record, out);
+}
+
+/**
+ * Returns a new object from its stored form. Compressed records need the
+ * table's @compressor.
+ */
+template<typename T> T* decode_record(const char* data, size_t size, record_compressor* compressor)
+{
+    if(!record_compressor::is_compressed(data, size))
+        return record_codec<T>::decode(data, size);
+
+    if(!compressor)
+        throw db_exception("compressed record in a table opened without compression");
+
+    std::string record;
+    compressor->decompress(data, size, record);
+    return record_codec<T>::decode(record.data(), record.size());
+}
+
+#endif
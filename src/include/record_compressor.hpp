@@ -0,0 +1,115 @@
+#if !defined(RECORD_COMPRESSOR_H)
+#define RECORD_COMPRESSOR_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "db_backend.hpp"
+#include "io_executor.hpp"
+
+//zstd compression level
+#define COMPRESS_LEVEL          3
+//records sampled before the first dictionary is trained
+#define COMPRESS_TRAIN_SAMPLES  4096
+//largest dictionary trained, bytes
+#define COMPRESS_DICT_SIZE      (64*1024)
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+/**
+ * zstd compression of one table's records, with a dictionary trained from a
+ * sample of them. Records of a table share much of their content (hosts of
+ * links, title prefixes, keywords), which a dictionary captures but single
+ * records are too short for zstd to find.
+ *
+ * Until COMPRESS_TRAIN_SAMPLES records have been compressed they are
+ * sampled and compressed without a dictionary, then a dictionary is trained
+ * from the samples. Training takes long enough to stall a writer, so it
+ * runs on the executor if one is set, records being compressed without a
+ * dictionary until it is ready. Dictionaries are saved as @prefix.<version>.dict and
+ * loaded on creation. Each compressed record carries the version of its
+ * dictionary, so train() may replace the dictionary whilst older records
+ * remain readable.
+ *
+ * Compressed records start with a header of their own, records which would
+ * not shrink are stored as given.
+ *
+ * All methods are thread safe.
+ */
+class record_compressor
+{
+    public:
+    record_compressor(std::string prefix, int level = COMPRESS_LEVEL);
+
+    /**
+     * waits for a dictionary being trained on the executor
+     */
+    ~record_compressor(void);
+
+    /**
+     * Trains dictionaries on @e from now on, rather than in the compress()
+     * call completing the sample. @e may be 0.
+     */
+    void set_executor(io_executor* e);
+
+    /**
+     * appends @in, compressed if that makes it smaller, to @out
+     */
+    void compress(const std::string& in, std::string& out);
+
+    /**
+     * Replaces @out with the decompressed record. Returns false if @data was
+     * not compressed, throws db_exception if it can not be decompressed.
+     */
+    bool decompress(const char* data, size_t size, std::string& out) throw(db_exception);
+
+    static bool is_compressed(const char* data, size_t size);
+
+    /**
+     * Trains a new dictionary from @samples and uses it for all records
+     * compressed from now on. Returns false if none could be trained.
+     */
+    bool train(std::vector<std::string>& samples);
+
+    struct compress_stats_s stats(void);
+
+    private:
+    struct dictionary_s {
+        uint32_t version;
+        ZSTD_CDict_s* cdict;
+        ZSTD_DDict_s* ddict;
+        ~dictionary_s(void);
+    };
+
+    std::string prefix;
+    int level;
+
+    std::mutex dict_lock;
+    std::map<uint32_t, std::shared_ptr<dictionary_s>> dicts;
+    std::shared_ptr<dictionary_s> current;
+    std::vector<std::string> samples;
+    bool sampling;
+    bool training;              //dictionary being trained on the executor
+    std::condition_variable trained;
+
+    std::atomic<io_executor*> executor;
+
+    std::mutex train_lock;      //one dictionary trained at a time
+
+    std::atomic<unsigned long> records;
+    std::atomic<unsigned long> raw_bytes;
+    std::atomic<unsigned long> stored_bytes;
+
+    std::string dict_path(uint32_t version);
+    std::shared_ptr<dictionary_s> make_dictionary(uint32_t version, const std::string& dict);
+};
+
+#endif
@@ -78,6 +78,11 @@ class robots_txt
     void lock(void);
     void unlock(void);
 
+    /**
+     * estimated bytes of memory held by this object, for cache budgets
+     */
+    size_t footprint(void);
+
     private:
     bool can_crawl; //if crawler's completely banned or a whitelist policy is used
     bool process_param;
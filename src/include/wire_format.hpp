@@ -0,0 +1,100 @@
+#if !defined(WIRE_FORMAT_H)
+#define WIRE_FORMAT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <exception>
+#include <cstdint>
+
+#include "ipc_common.hpp"
+
+#define WIRE_VERSION        1
+#define WIRE_HEADER_SIZE    16
+//largest payload accepted, anything bigger is a corrupt header
+#define WIRE_MAX_LENGTH     (64*1024*1024)
+
+//header flags
+#define WIRE_FLAG_REPLY     0x0001  //request id is that of the request
+                                    //replied to, not a new one
+
+/**
+ * Message layout between worker and master, replacing boost archives:
+ *
+ *      u8      version, WIRE_VERSION
+ *      u8      type, data_type_e
+ *      u16     flags, WIRE_FLAG_*
+ *      u32     payload length
+ *      u64     request id, 0 if no reply is expected
+ *      payload
+ *
+ * Fixed width integers are little endian. Payloads are made of varints
+ * (LEB128), for integers and enums, and strings, a varint byte length
+ * followed by the bytes. Vectors are a varint count followed by each
+ * element. Structs are their fields in declaration order, see the
+ * wire_encode() overloads.
+ */
+struct wire_header_s {
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint32_t length;
+    uint64_t request_id;
+};
+
+/**
+ * payload does not decode as the type asked for
+ */
+struct wire_exception: std::exception {
+    std::string message;
+    const char* what() const noexcept
+    {
+        return message.c_str();
+    }
+    wire_exception(std::string s): message(s) {};
+};
+
+/**
+ * writes @h into the WIRE_HEADER_SIZE bytes at @out
+ */
+void wire_put_header(char* out, const struct wire_header_s& h);
+
+/**
+ * reads the header at @in, returns false if it is not of WIRE_VERSION
+ */
+bool wire_get_header(const char* in, struct wire_header_s& h);
+
+/**
+ * Decodes a payload in place, bounds checked. Throws wire_exception on
+ * reading past the end.
+ */
+class wire_reader
+{
+    public:
+    wire_reader(const char* data, size_t size);
+
+    uint64_t varint(void) throw(wire_exception);
+    void string(std::string& s) throw(wire_exception);
+
+    private:
+    const char* pos;
+    const char* end;
+};
+
+void wire_encode(std::string& out, unsigned int v);
+void wire_encode(std::string& out, ctrl_instruction_e v);
+void wire_encode(std::string& out, worker_status_e v);
+void wire_encode(std::string& out, const struct worker_capabilities_s& c);
+void wire_encode(std::string& out, const struct worker_config_s& c);
+void wire_encode(std::string& out, const struct queue_node_s& n);
+void wire_encode(std::string& out, const std::vector<struct queue_node_s>& nodes);
+
+void wire_decode(wire_reader& in, unsigned int& v);
+void wire_decode(wire_reader& in, ctrl_instruction_e& v);
+void wire_decode(wire_reader& in, worker_status_e& v);
+void wire_decode(wire_reader& in, struct worker_capabilities_s& c);
+void wire_decode(wire_reader& in, struct worker_config_s& c);
+void wire_decode(wire_reader& in, struct queue_node_s& n);
+void wire_decode(wire_reader& in, std::vector<struct queue_node_s>& nodes);
+
+#endif
@@ -0,0 +1,192 @@
+#if !defined(WRITE_LOG_H)
+#define WRITE_LOG_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "db_backend.hpp"
+
+//default time a commit waits for more records after the first, us
+#define WAL_COMMIT_WINDOW   1000
+//default records which commit at once without waiting out the window
+#define WAL_COMMIT_BATCH    256
+//bytes after which a new log file is started, and the old one retired
+#define WAL_FILE_MAX        (16*1024*1024)
+//time between retries of records which failed to apply, ms
+#define WAL_RETRY_INTERVAL  1000
+
+/**
+ * group commit and recovery counters
+ */
+struct wal_stats_s {
+    unsigned long commits;          //fsyncs of the log
+    unsigned long records;          //records committed
+    unsigned long bytes;            //bytes written to the log
+    unsigned long applied;          //records applied to the store
+    unsigned long apply_failures;   //failed applies, each retried
+    unsigned long checkpoints;      //log files retired
+    unsigned long replayed;         //records replayed on creation
+    unsigned long replay_ms;        //time replay took
+};
+
+/**
+ * Write-ahead log for a store which updates records in place.
+ *
+ * append() and remove() return once the record is on disk in the log.
+ * Records arriving within commit_window of each other, up to commit_batch,
+ * are written and fsynced together, so many concurrent writers share one
+ * fsync. Committed records are then applied to the store by a background
+ * thread through the apply handler, in commit order. Until then lookup()
+ * returns them. Records which fail to apply stay readable and are retried
+ * every WAL_RETRY_INTERVAL.
+ *
+ * The log is a directory of numbered files. Once every record of a full
+ * file has been applied the sync handler is called to make the store
+ * durable, and the file is removed. On creation records left in the log
+ * by a crash are replayed: the latest record of each key is applied, keys
+ * in parallel, before the constructor returns. A torn record at the end of
+ * the log, which was never acknowledged, is dropped. Files are only ever
+ * removed once the store has synced everything they hold, so whatever is
+ * not in the store is replayed next time.
+ *
+ * All methods are thread safe.
+ */
+class write_log
+{
+    public:
+    /**
+     * applies a committed record, @deleted records are removed from the
+     * store. Returns false if it could not be, it is then retried. Must not
+     * throw.
+     */
+    typedef std::function<bool(std::string& key, std::string& record, bool deleted)> apply_handler;
+
+    /**
+     * makes everything applied so far durable, returns false if it could
+     * not
+     */
+    typedef std::function<bool(void)> sync_handler;
+
+    /**
+     * Opens, or creates, the log kept in directory @path and replays it into
+     * the store through @apply, using @replay_threads. Throws db_exception
+     * if the directory can not be used.
+     */
+    write_log(std::string path, apply_handler apply, sync_handler sync,
+        unsigned int commit_window = WAL_COMMIT_WINDOW, unsigned int commit_batch = WAL_COMMIT_BATCH,
+        unsigned int replay_threads = IO_THREADS) throw(db_exception);
+
+    /**
+     * Applies and syncs everything committed, then removes the log. If
+     * anything failed to apply or sync the log is kept, to be replayed.
+     */
+    ~write_log(void);
+
+    /**
+     * Blocks until @record is committed under @key. Throws db_exception if
+     * the log could not be written, the record is then lost.
+     */
+    void append(std::string& key, const std::string& record) throw(db_exception);
+
+    /**
+     * Commits @records under the @keys at the same index, as append(), but
+     * waits once for all of them. Batches larger than commit_batch span
+     * several commits. @records are moved from. Throws db_exception if any
+     * could not be committed.
+     */
+    void append_many(std::vector<std::string>& keys, std::vector<std::string>& records) throw(db_exception);
+
+    /**
+     * commits the removal of @key, as append()
+     */
+    void remove(std::string& key) throw(db_exception);
+
+    /**
+     * Returns true if a committed record of @key is not yet applied, and
+     * copies it into @record. @deleted is set if it is a removal.
+     */
+    bool lookup(std::string& key, std::string& record, bool& deleted);
+
+    struct wal_stats_s stats(void);
+
+    private:
+    //a record waiting for its commit
+    struct commit_s {
+        uint64_t seq;
+        uint32_t flags;
+        std::string key;
+        std::string record;
+        size_t* waiting;            //caller's records not yet committed, under log_lock
+        bool* failed;               //set if any of them failed to commit
+    };
+
+    //committed records of one commit, waiting to be applied
+    struct batch_s {
+        uint32_t file;              //log file they were written to
+        std::vector<commit_s> records;
+    };
+
+    //a committed record not yet applied
+    struct pending_s {
+        uint64_t seq;
+        bool deleted;
+        std::string record;
+    };
+
+    //a record whose apply failed, still pending
+    struct unapplied_s {
+        uint32_t file;              //log file holding it, kept until applied
+        uint64_t seq;
+        std::string key;
+    };
+
+    std::string dir;
+    unsigned int commit_window;
+    unsigned int commit_batch;
+    apply_handler apply;
+    sync_handler sync;
+
+    //log file being appended to, only touched by the committer
+    int fd;
+    uint32_t file;
+    uint64_t file_size;
+    uint32_t oldest;                //first file not yet retired, applier only
+    std::vector<unapplied_s> unapplied;     //applier only
+
+    std::mutex log_lock;
+    std::condition_variable commit_cv;      //records queued
+    std::condition_variable done_cv;        //records committed
+    std::condition_variable apply_cv;       //batches to apply
+    std::deque<commit_s> queue;
+    std::deque<batch_s> applying;
+    std::unordered_map<std::string, pending_s> pending;
+    uint64_t next_seq;
+    bool commit_stopping;
+    bool apply_stopping;
+    struct wal_stats_s st;
+
+    std::thread commit_thread;
+    std::thread apply_thread;
+
+    std::string file_path(uint32_t id);
+    void open_file(uint32_t id) throw(db_exception);
+    void sync_dir(void);
+    void enqueue(std::vector<commit_s>& records) throw(db_exception);
+    size_t write_batch(std::vector<commit_s>& batch);
+    void replay(std::vector<uint32_t>& ids, unsigned int threads);
+    bool apply_pending(std::string& key, uint64_t seq);
+    void retry_unapplied(void);
+    void checkpoint(uint32_t upto);
+    void committer(void);
+    void applier(void);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "io_executor.hpp"
+#include "debug.hpp"
+
+io_executor::io_executor(unsigned int threads)
+{
+    stopping = false;
+
+    if(!threads)
+        threads = 1;
+    for(unsigned int i = 0; i < threads; ++i)
+        workers.push_back(std::thread(&io_executor::worker, this));
+}
+
+io_executor::~io_executor(void)
+{
+    queue_lock.lock();
+    stopping = true;
+    queue_lock.unlock();
+    queue_cv.notify_all();
+
+    for(auto& w: workers)
+        w.join();
+}
+
+void io_executor::submit(std::function<void()> task)
+{
+    queue_lock.lock();
+    tasks.push_back(std::move(task));
+    queue_lock.unlock();
+    queue_cv.notify_one();
+}
+
+void io_executor::submit_many(std::vector<std::function<void()>>& batch)
+{
+    if(batch.empty())
+        return;
+
+    queue_lock.lock();
+    for(auto& t: batch)
+        tasks.push_back(std::move(t));
+    queue_lock.unlock();
+    batch.clear();
+
+    queue_cv.notify_all();
+}
+
+size_t io_executor::pending(void)
+{
+    std::lock_guard<std::mutex> lock(queue_lock);
+    return tasks.size();
+}
+
+void io_executor::worker(void)
+{
+    std::unique_lock<std::mutex> lock(queue_lock);
+
+    while(true) {
+        queue_cv.wait(lock, [this]{ return stopping || !tasks.empty(); });
+
+        //drain before stopping, callers may be waiting on these
+        if(tasks.empty())
+            break;
+
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+
+        try {
+            task();
+        } catch(std::exception& e) {
+            std::cerr<<"io_executor task failed: "<<e.what()<<std::endl;
+        }
+
+        lock.lock();
+    }
+}
@@ -5,9 +5,17 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
 #include <boost/lockfree/queue.hpp>         //task queue
 #include <boost/bind.hpp>                   //boost::bind
 #include <boost/asio.hpp>                   //all ipc
+#include <boost/asio/steady_timer.hpp>      //send_buffer drain
 #include <string>                           //to_string
 
 #include "ipc_client.hpp"
@@ -19,85 +27,221 @@ using boost::asio::ip::tcp;
 
 //
 // public
-ipc_client::ipc_client(struct ipc_config_s& config, boost::asio::io_service& _ipc_service):
-    connection_(_ipc_service), resolver_(_ipc_service)
+ipc_client::ipc_client(struct ipc_config_s& config):
+    connection_(ipc_service), resolver_(ipc_service), send_timer(ipc_service),
+    send_buffer(BUFFER_MAX_SIZE), submissions(SUBMIT_QUEUE_SIZE)
 {
     //initialise internal data
     cfg = config;
-    ipc_service = &_ipc_service;
+    send_size = 0;
+    drain_posted = false;
+    submit_posted = false;
     wstatus = IDLE;
     wcfg = {};
+    wcaps = {};
+    next_request_id = 0;
+    requests = 0;
+    last_empty = 0;
+    refill_nodes = 0;
+    failed = false;
+
+    //all socket I/O, connecting included, happens on ipc_thread
+    ipc_work.reset(new boost::asio::io_service::work(ipc_service));
+    ipc_thread = std::thread([this]() { ipc_service.run(); });
 
     //will block
-    connect();
+    try {
+        connect();
+    } catch(std::exception& e) {
+        ipc_work.reset();
+        ipc_service.stop();
+        ipc_thread.join();
+        throw;
+    }
+
+    ipc_service.post([this]()
+        {
+            connection_.async_read(boost::bind(&ipc_client::read_data, this,
+                boost::asio::placeholders::error));
+            send_timer.expires_from_now(SERVICE_GRANUALITY);
+            send_timer.async_wait(boost::bind(&ipc_client::send_tick, this,
+                boost::asio::placeholders::error));
+        });
+
+    //fill get_buffer before the first get_item()
+    state_lock.lock();
+    refill(false);
+    state_lock.unlock();
+}
+
+ipc_client::~ipc_client(void)
+{
+    //nodes still buffered would be lost
+    try {
+        flush();
+    } catch(std::exception& e) {
+        std::cerr<<"ipc_client: dropping "<<send_size<<" unsent nodes: "<<e.what()<<std::endl;
+    }
+
+    ipc_work.reset();
+    ipc_service.stop();
+    ipc_thread.join();
+
+    //whatever ipc_thread did not get to
+    struct queue_node_s* n;
+    while(send_buffer.pop(n))
+        delete n;
+    std::function<void(void)>* task;
+    while(submissions.pop(task))
+        delete task;
 }
 
-//can throw system_error excpetion (from boost) if IPC fails
 void ipc_client::send_item(struct queue_node_s& data)
 {
-    dbg_1<<"sending node to master\n";
-    connection_.wdata_type(dt_queue_node);
-    connection_.wdata(data);
-    connection_.async_write(boost::bind(&ipc_client::write_no_read, this,
-        boost::asio::placeholders::error));
+    std::string err = error();
+    if(!err.empty())
+        throw ipc_exception(err);
 
-    //kick off ipc_service
-    ipc_service->run();  //will block
-    ipc_service->reset();
-    dbg_1<<"completed ***\n";
+    send_buffer.push(new queue_node_s(data));
+
+    //a full batch goes now, anything less on the next send_tick()
+    if(++send_size >= (long)std::max(cfg.sbuff_max, 1u) && !drain_posted.exchange(true))
+        ipc_service.post(boost::bind(&ipc_client::drain_send_buffer, this));
+}
+
+void ipc_client::flush(void)
+{
+    std::shared_ptr<std::promise<void>> sent = std::make_shared<std::promise<void>>();
+    std::future<void> f = sent->get_future();
+
+    submit([this, sent]()
+        {
+            drain_send_buffer();
+
+            //completes once every write before it has
+            connection_.async_drain([sent](const boost::system::error_code& ec) { sent->set_value(); });
+        });
+
+    //will block
+    f.get();
+
+    std::string err = error();
+    if(!err.empty())
+        throw ipc_exception(err);
 }
 
 struct queue_node_s ipc_client::get_item(void) throw(std::exception)
 {
-    dbg_1<<"requesting node from master\n";
-    connection_.wdata_type(dt_instruction);
-    connection_.wdata(ctrl_wnodes);
-    connection_.async_write(boost::bind(&ipc_client::write_complete, this,
-        boost::asio::placeholders::error));
+    std::unique_lock<std::mutex> lock(state_lock);
 
-    //kick off ipc_service
-    ipc_service->run();  //will block
-    ipc_service->reset();
-    dbg_1<<"completed ***\n";
+    //an empty reply only means master has nothing if we asked after
+    //finding get_buffer empty
+    unsigned long conclusive = requests+1;
+    while(get_buffer.empty()) {
+        if(!ipc_error.empty())
+            throw ipc_exception(ipc_error);
+        if(last_empty >= conclusive)
+            throw ipc_exception("get_buffer.data empty\n");
 
-    struct queue_node_s data = {};
-    if(!get_buffer.empty()) {
-        dbg_1<<"data already present on queue\n";
-        data = get_buffer.pop();
-    } else {
-        throw ipc_exception("get_buffer.data empty\n");
+        dbg_1<<"get_buffer empty, waiting on master\n";
+        if(requests < conclusive || !refill_nodes)
+            refill(true);
+        state_cv.wait(lock);
     }
 
+    struct queue_node_s data = get_buffer.pop();
+
+    //top up in the background
+    refill(false);
+    lock.unlock();
+
     dbg<<"returning data from queue [credit: "<<data.credit<<" url: "<<data.url<<"]\n";
     return data;
 }
 
+bool ipc_client::try_get_item(struct queue_node_s& data)
+{
+    std::lock_guard<std::mutex> lock(state_lock);
+
+    if(get_buffer.empty()) {
+        if(!ipc_error.empty())
+            throw ipc_exception(ipc_error);
+
+        //have a batch on its way for the next call
+        if(!refill_nodes)
+            refill(true);
+        return false;
+    }
+
+    data = get_buffer.pop();
+    refill(false);
+
+    dbg<<"returning data from queue [credit: "<<data.credit<<" url: "<<data.url<<"]\n";
+    return true;
+}
+
 struct worker_config_s ipc_client::get_config(void)
 {
     dbg<<"requesting registration config\n";
-    connection_.wdata_type(dt_instruction);
-    connection_.wdata(ctrl_wconfig);
-    connection_.async_write(boost::bind(&ipc_client::write_complete, this,
-        boost::asio::placeholders::error));
 
-    //kick off ipc_service
-    ipc_service->run();  //will block
-    ipc_service->reset();
+    //will block
+    struct worker_config_s config = request_config().get();
     dbg_1<<"completed ***\n";
 
-    return wcfg;
+    return config;
+}
+
+std::future<struct worker_config_s> ipc_client::request_config(void)
+{
+    std::shared_ptr<std::promise<worker_config_s>> reply = std::make_shared<std::promise<worker_config_s>>();
+    std::future<worker_config_s> f = reply->get_future();
+
+    request(dt_instruction, ctrl_wconfig, [this, reply](bool ok)
+        {
+            if(ok)
+                reply->set_value(process_config());
+            else
+                reply->set_exception(std::make_exception_ptr(ipc_exception(error())));
+        });
+
+    return f;
+}
+
+std::future<std::vector<struct queue_node_s>> ipc_client::fetch_nodes(unsigned int count)
+{
+    typedef std::vector<queue_node_s> nodes_t;
+    std::shared_ptr<std::promise<nodes_t>> reply = std::make_shared<std::promise<nodes_t>>();
+    std::future<nodes_t> f = reply->get_future();
+
+    request(dt_node_request, count, [this, reply](bool ok)
+        {
+            if(ok)
+                reply->set_value(connection_.rdata<nodes_t>());
+            else
+                reply->set_exception(std::make_exception_ptr(ipc_exception(error())));
+        });
+
+    return f;
+}
+
+void ipc_client::on_config(config_handler handler)
+{
+    std::lock_guard<std::mutex> lock(state_lock);
+    config_changed = handler;
 }
 
 //master requests status asynchronously (not referring to ipc). keep it
 //updated here.
 void ipc_client::set_status(worker_status_e& s)
 {
+    std::lock_guard<std::mutex> lock(state_lock);
     wstatus = s;
 }
 
 //same principle as set_status()
 void ipc_client::set_capabilities(worker_capabilities_s& c)
 {
+    std::lock_guard<std::mutex> lock(state_lock);
     wcaps = c;
 }
 
@@ -105,101 +249,329 @@ void ipc_client::set_capabilities(worker_capabilities_s& c)
 //private
 void ipc_client::connect(void) throw(std::exception)
 {
-    tcp::resolver::query query(cfg.master_address, MASTER_SERVICE_NAME);
-    resolver_.async_resolve(query,
-        [this](boost::system::error_code ec, tcp::resolver::iterator it)
+    std::future<void> f = connected.get_future();
+
+    ipc_service.post([this]()
         {
-            if(!ec) {
-                dbg_1<<"resolved master\n";
-                dbg<<"connecting to: "<<it->endpoint()<<std::endl;
-                boost::asio::async_connect(connection_.socket(), it,
-                    boost::bind(&ipc_client::handle_connected, this,
-                        boost::asio::placeholders::error));
-            } else {
-                throw ipc_exception("async_resolve error: "+ec.message());
-            }
+            tcp::resolver::query query(cfg.master_address, MASTER_SERVICE_NAME);
+            resolver_.async_resolve(query,
+                [this](boost::system::error_code ec, tcp::resolver::iterator it)
+                {
+                    if(!ec) {
+                        dbg_1<<"resolved master\n";
+                        dbg<<"connecting to: "<<it->endpoint()<<std::endl;
+                        boost::asio::async_connect(connection_.socket(), it,
+                            boost::bind(&ipc_client::handle_connected, this,
+                                boost::asio::placeholders::error));
+                    } else {
+                        connected.set_exception(std::make_exception_ptr(
+                            ipc_exception("async_resolve error: "+ec.message())));
+                    }
+                });
         });
 
-    dbg_1<<"launching boost service\n";
-    ipc_service->run();
-    ipc_service->reset();
+    //will block
+    dbg_1<<"waiting on ipc thread to connect\n";
+    f.get();
 }
 
-//placeholder function atm; used only for debug. In the future may launch
-//the background thread which keeps the get_buffer filled and send_buffer drained
-void ipc_client::handle_connected(const boost::system::error_code& ec) throw(std::exception)
+void ipc_client::handle_connected(const boost::system::error_code& ec)
 {
-    if(!ec)
+    if(!ec) {
         dbg<<"connected.\n";
-    else
-        throw ipc_exception("handle_connected() async_connect error: "+ec.message());
+        connected.set_value();
+    } else {
+        connected.set_exception(std::make_exception_ptr(
+            ipc_exception("handle_connected() async_connect error: "+ec.message())));
+    }
 }
 
-//generic async write return point (callback) - placeholder for debug only.
-//registers generic read handler which processes replies/async master comms
-void ipc_client::write_complete(boost::system::error_code ec) throw(std::exception)
+//queues @task for ipc_thread. Only the first task queued since the last
+//run_submissions() posts to the io_service, later ones ride along
+void ipc_client::submit(std::function<void(void)> task)
 {
-    if(!ec) {
-        dbg_1<<"sent data to master\n";
-        connection_.async_read(boost::bind(&ipc_client::read_data, this,
-            boost::asio::placeholders::error));
-    } else {
-        throw ipc_exception("failed to write to master: "+ec.message());
-    }
+    submissions.push(new std::function<void(void)>(task));
+
+    if(!submit_posted.exchange(true))
+        ipc_service.post(boost::bind(&ipc_client::run_submissions, this));
 }
 
-//development debug version. threaded variant can afford for background
-//thread to sleep on read callback (after send data), however atm we need
-//the send_data call to not block indefinetley
-void ipc_client::write_no_read(boost::system::error_code ec) throw(std::exception)
+//ipc_thread only
+void ipc_client::run_submissions(void)
 {
-    if(!ec) {
-        dbg_1<<"sent data to master. will not register read\n";
-    } else {
-        throw ipc_exception("failed to write to master: "+ec.message());
+    //cleared first, so a task queued while draining posts again rather
+    //than being missed
+    submit_posted = false;
+
+    std::function<void(void)>* task;
+    while(submissions.pop(task)) {
+        (*task)();
+        delete task;
     }
 }
 
-//generic processing of data from master. data may be a reply to an earlier
-//request or event/async communication such as getting worker status
-void ipc_client::read_data(const boost::system::error_code& ec) throw(std::exception)
+//asks master for a batch of sc nodes, unless, with those already asked
+//for, get_buffer will hold gbuff_min. @needed asks regardless. state_lock
+//held
+void ipc_client::refill(bool needed)
 {
-    if(!ec) {
-        switch(connection_.rdata_type()) {
-        case dt_instruction:
-        {
-            dbg<<"got ctrl instruction from master: "<<connection_.rdata<ctrl_instruction_e>()<<std::endl;
-            process_instruction();
-            break;
-        }
+    if(!ipc_error.empty())
+        return;
+    if(!needed && get_buffer.size()+refill_nodes >= cfg.gbuff_min)
+        return;
+
+    unsigned int count = cfg.sc ? cfg.sc : 1;
+    unsigned long seq = ++requests;
+    refill_nodes += count;
+    dbg_1<<"requesting "<<count<<" nodes from master\n";
 
-        case dt_wconfig:
+    request(dt_node_request, count, [this, seq, count](bool ok)
         {
-            dbg<<"got config from master\n";
-            wcfg = connection_.rdata<worker_config_s>();
-            break;
-        }
+            std::vector<queue_node_s> nodes;
+            if(ok)
+                nodes = connection_.rdata<std::vector<queue_node_s>>();
+            dbg_1<<"got "<<nodes.size()<<" queue_node_s from master\n";
+
+            state_lock.lock();
+            refill_nodes -= count;
+            for(auto& n: nodes)
+                get_buffer.push(n);
+            if(ok && nodes.empty())
+                last_empty = std::max(last_empty, seq);
+
+            //still short, master may have sent fewer than asked for
+            if(!nodes.empty())
+                refill(false);
+            state_lock.unlock();
+            state_cv.notify_all();
+        });
+}
+
+//empty unless IPC failed, only then is state_lock taken
+std::string ipc_client::error(void)
+{
+    if(!failed.load())
+        return std::string();
 
-        case dt_queue_node:
+    std::lock_guard<std::mutex> lock(state_lock);
+    return ipc_error;
+}
+
+//wakes every caller waiting on master, they throw @error. ipc_thread only
+void ipc_client::fail(std::string error)
+{
+    state_lock.lock();
+    bool first = ipc_error.empty();
+    if(first) {
+        ipc_error = error;
+        failed = true;
+    }
+    state_lock.unlock();
+    state_cv.notify_all();
+
+    if(first)
+        std::cerr<<"ipc_client: "<<error<<std::endl;
+
+    //no more replies will come
+    std::unordered_map<uint64_t, reply_handler> failed;
+    failed.swap(outstanding);
+    for(auto& r: failed)
+        r.second(false);
+}
+
+//ipc_thread only
+template<typename T> void ipc_client::send(data_type_e type, T data, uint64_t request_id, uint16_t flags)
+{
+    connection_.async_send(type, data, boost::bind(&ipc_client::write_done, this,
+        boost::asio::placeholders::error), request_id, flags);
+}
+
+//sends a request under a new id, @handler is called with its reply. Can
+//be called from any thread
+template<typename T> void ipc_client::request(data_type_e type, T data, reply_handler handler)
+{
+    submit([this, type, data, handler]()
         {
-            dbg<<"got queue_node_s from master\n";
-            queue_node_s n = connection_.rdata<struct queue_node_s>();
-            get_buffer.push(n);
+            if(!error().empty()) {
+                handler(false);
+                return;
+            }
+
+            uint64_t id = ++next_request_id;
+            outstanding[id] = handler;
+            send(type, data, id);
+        });
+}
+
+void ipc_client::write_done(const boost::system::error_code& ec)
+{
+    if(ec)
+        fail("failed to write to master: "+ec.message());
+}
+
+//sends the send_buffer as messages of up to BUFFER_MAX_SIZE nodes,
+//ipc_thread only
+void ipc_client::drain_send_buffer(void)
+{
+    //nodes pushed from here on will post again once sbuff_max are waiting
+    drain_posted = false;
+
+    struct queue_node_s* n;
+    std::vector<queue_node_s> nodes;
+    while(true) {
+        nodes.clear();
+        while(nodes.size() < BUFFER_MAX_SIZE && send_buffer.pop(n)) {
+            nodes.push_back(std::move(*n));
+            delete n;
+        }
+        if(nodes.empty())
             break;
+        send_size -= nodes.size();
+
+        dbg_1<<"sending "<<nodes.size()<<" nodes to master\n";
+        send(dt_queue_nodes, nodes);
+    }
+}
+
+//sends whatever has waited in the send_buffer since the last tick
+void ipc_client::send_tick(const boost::system::error_code& ec)
+{
+    if(ec)
+        return;
+
+    drain_send_buffer();
+
+    send_timer.expires_from_now(SERVICE_GRANUALITY);
+    send_timer.async_wait(boost::bind(&ipc_client::send_tick, this,
+        boost::asio::placeholders::error));
+}
+
+//runs on ipc_thread for as long as the connection lasts
+void ipc_client::read_data(const boost::system::error_code& ec)
+{
+    if(ec) {
+        fail("get_data() boost error: "+ec.message());
+        return;
+    }
+
+    try {
+        if(!process_data())
+            return;
+    } catch(std::exception& e) {
+        //undecodable, the stream can not be trusted after it
+        fail(std::string("failed to decode data from master: ")+e.what());
+        return;
+    }
+
+    connection_.async_read(boost::bind(&ipc_client::read_data, this,
+        boost::asio::placeholders::error));
+}
+
+//generic processing of data from master. data may be a reply to an earlier
+//request or event/async communication such as getting worker status.
+//Returns false if the connection is unusable
+bool ipc_client::process_data(void)
+{
+    uint64_t id = connection_.rrequest_id();
+
+    if(connection_.rflags() & WIRE_FLAG_REPLY) {
+        auto it = outstanding.find(id);
+        if(it == outstanding.end()) {
+            dbg<<"dropping reply to unknown request "<<id<<std::endl;
+            return true;
         }
 
-        default:
-            throw ipc_exception("unknown data type recieved from master ("+std::to_string(connection_.rdata_type())+")\n");
+        reply_handler handler = it->second;
+        outstanding.erase(it);
+        try {
+            handler(true);
+        } catch(std::exception& e) {
+            fail(std::string("failed to decode reply from master: ")+e.what());
+            handler(false);
+            return false;
         }
+        return true;
+    }
 
+    switch(connection_.rdata_type()) {
+    case dt_instruction:
+    {
+        ctrl_instruction_e instruction = connection_.rdata<ctrl_instruction_e>();
+        dbg<<"got ctrl instruction from master: "<<instruction<<std::endl;
+        process_instruction(instruction, id);
+        break;
+    }
 
-    } else {
-        throw ipc_exception("get_data() boost error: "+ec.message());
+    case dt_wconfig:
+        dbg<<"got config from master\n";
+        process_config();
+        break;
+
+    case dt_queue_node:
+    {
+        dbg<<"got queue_node_s from master\n";
+        queue_node_s n = connection_.rdata<struct queue_node_s>();
+        state_lock.lock();
+        get_buffer.push(n);
+        state_lock.unlock();
+        state_cv.notify_all();
+        break;
     }
+
+    case dt_queue_nodes:
+    {
+        std::vector<queue_node_s> nodes = connection_.rdata<std::vector<queue_node_s>>();
+        dbg_1<<"got "<<nodes.size()<<" unrequested queue_node_s from master\n";
+        state_lock.lock();
+        for(auto& n: nodes)
+            get_buffer.push(n);
+        state_lock.unlock();
+        state_cv.notify_all();
+        break;
+    }
+
+    default:
+        fail("unknown data type recieved from master ("+std::to_string(connection_.rdata_type())+")");
+        return false;
+    }
+
+    return true;
 }
 
-//stub
-void ipc_client::process_instruction(void)
+//worker_config_s recieved, whether requested or pushed by master
+struct worker_config_s ipc_client::process_config(void)
 {
-    //to do
+    struct worker_config_s config = connection_.rdata<worker_config_s>();
+
+    state_lock.lock();
+    wcfg = config;
+    config_handler handler = config_changed;
+    state_lock.unlock();
+
+    if(handler)
+        handler(config);
+    return config;
+}
+
+//replies to master's requests under the id it sent
+void ipc_client::process_instruction(ctrl_instruction_e instruction, uint64_t request_id)
+{
+    std::unique_lock<std::mutex> lock(state_lock);
+    worker_status_e status = wstatus;
+    struct worker_capabilities_s caps = wcaps;
+    lock.unlock();
+
+    switch(instruction) {
+    case ctrl_mstatus:
+        send(dt_wstatus, status, request_id, WIRE_FLAG_REPLY);
+        break;
+
+    case ctrl_mcap:
+        send(dt_wcap, caps, request_id, WIRE_FLAG_REPLY);
+        break;
+
+    default:
+        dbg<<"ignoring ctrl instruction "<<instruction<<" from master\n";
+        break;
+    }
 }
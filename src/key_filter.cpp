@@ -0,0 +1,110 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "key_filter.hpp"
+#include "debug.hpp"
+
+//Local defines
+#define FILTER_MAGIC    0x6b666c74  //"kflt"
+#define FILTER_VERSION  1
+
+key_filter::key_filter(size_t expected_keys)
+{
+    counters.assign((expected_keys ? expected_keys : 1)*FILTER_CELLS_PER_KEY, 0);
+    key_count = 0;
+}
+
+//double hashing, keys are already hashed so only need spreading
+size_t key_filter::index_of(size_t hash, unsigned int i)
+{
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash*0x9e3779b97f4a7c15ULL)>>17 | 1;
+
+    return (size_t)((h1 + i*h2) % counters.size());
+}
+
+void key_filter::add(size_t hash)
+{
+    for(unsigned int i = 0; i < FILTER_HASHES; ++i) {
+        uint8_t& c = counters[index_of(hash, i)];
+        if(c < UINT8_MAX)
+            ++c;
+    }
+    ++key_count;
+}
+
+void key_filter::remove(size_t hash)
+{
+    for(unsigned int i = 0; i < FILTER_HASHES; ++i) {
+        uint8_t& c = counters[index_of(hash, i)];
+        if(c > 0 && c < UINT8_MAX)
+            --c;
+    }
+    if(key_count)
+        --key_count;
+}
+
+bool key_filter::may_contain(size_t hash)
+{
+    for(unsigned int i = 0; i < FILTER_HASHES; ++i) {
+        if(!counters[index_of(hash, i)])
+            return false;
+    }
+
+    return true;
+}
+
+size_t key_filter::keys(void)
+{
+    return key_count;
+}
+
+bool key_filter::load(std::string path)
+{
+    std::ifstream file_data(path, std::ios::binary);
+    if(!file_data)
+        return false;
+
+    uint32_t magic = 0, version = 0;
+    uint64_t size = 0, count = 0;
+    file_data.read((char*)&magic, sizeof(magic));
+    file_data.read((char*)&version, sizeof(version));
+    file_data.read((char*)&size, sizeof(size));
+    file_data.read((char*)&count, sizeof(count));
+
+    if(!file_data || magic != FILTER_MAGIC || version != FILTER_VERSION || size != counters.size()) {
+        dbg<<"no usable filter at ["<<path<<"]\n";
+        return false;
+    }
+
+    std::vector<uint8_t> saved(size);
+    file_data.read((char*)saved.data(), size);
+    if(!file_data) {
+        dbg<<"truncated filter at ["<<path<<"]\n";
+        return false;
+    }
+
+    counters.swap(saved);
+    key_count = count;
+    return true;
+}
+
+bool key_filter::save(std::string path)
+{
+    std::ofstream file_data(path, std::ios::binary|std::ios::trunc);
+    if(!file_data)
+        return false;
+
+    uint32_t magic = FILTER_MAGIC, version = FILTER_VERSION;
+    uint64_t size = counters.size(), count = key_count;
+    file_data.write((char*)&magic, sizeof(magic));
+    file_data.write((char*)&version, sizeof(version));
+    file_data.write((char*)&size, sizeof(size));
+    file_data.write((char*)&count, sizeof(count));
+    file_data.write((char*)counters.data(), size);
+
+    return (bool)file_data;
+}
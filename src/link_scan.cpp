@@ -0,0 +1,262 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "link_scan.hpp"
+#include "parser.hpp"
+#include "debug.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+//built for AVX2 whatever the build flags, only called if the cpu has it
+__attribute__((target("avx2")))
+static const char* find_tag_open_avx2(const char* p, const char* end)
+{
+    const __m256i lt = _mm256_set1_epi8('<');
+    while(end-p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lt));
+        if(mask)
+            return p+__builtin_ctz(mask);
+        p += 32;
+    }
+
+    const char* r = static_cast<const char*>(memchr(p, '<', end-p));
+    return r?r:end;
+}
+#endif
+
+//returns the first '<' in [p, end) or end
+static inline const char* find_tag_open(const char* p, const char* end)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if(has_avx2)
+        return find_tag_open_avx2(p, end);
+#endif
+#if defined(__SSE2__)
+    const __m128i lt = _mm_set1_epi8('<');
+    while(end-p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lt));
+        if(mask)
+            return p+__builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    const char* r = static_cast<const char*>(memchr(p, '<', end-p));
+    return r?r:end;
+}
+
+//case insensitive match of lower case @s at p, bounded by end
+static inline bool match_lc(const char* p, const char* end, const char* s)
+{
+    for(; *s; ++p, ++s) {
+        if(p == end || tolower(static_cast<unsigned char>(*p)) != *s)
+            return false;
+    }
+    return true;
+}
+
+//finds the '>' closing a tag, honouring quoted attribute values
+static const char* find_tag_close(const char* p, const char* end)
+{
+    char quote = 0;
+    for(; p < end; ++p) {
+        if(quote) {
+            if(*p == quote)
+                quote = 0;
+        } else if(*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if(*p == '>') {
+            return p;
+        }
+    }
+    return end;
+}
+
+//finds @s (lower case) case insensitively in [p, end)
+static const char* find_lc(const char* p, const char* end, const char* s)
+{
+    size_t len = strlen(s);
+    while(end-p >= static_cast<long>(len)) {
+        p = find_tag_open(p, end);
+        if(p == end)
+            break;
+        if(match_lc(p, end, s))
+            return p;
+        ++p;
+    }
+    return end;
+}
+
+//finds the end of a comment or raw text element whose contents start at
+//@p, @close being "-->", "</script" or "</style". Returns the character
+//after its closing '>', or 0 if [p, end) does not hold all of it, with
+//@resume set to where the search must start once more data has arrived
+static const char* skip_raw(const char* p, const char* end, const std::string& close, const char*& resume)
+{
+    if(close == "-->") {
+        const char* c = std::search(p, end, close.begin(), close.end());
+        if(c != end)
+            return c+close.size();
+    } else {
+        const char* c = find_lc(p, end, close.c_str());
+        if(c != end) {
+            const char* gt = static_cast<const char*>(memchr(c, '>', end-c));
+            if(gt)
+                return gt+1;
+            resume = c;
+            return 0;
+        }
+    }
+
+    //only what could be the start of a terminator split between chunks
+    resume = (end-p > static_cast<long>(close.size()))?end-(close.size()-1):p;
+    return 0;
+}
+
+//decodes the few entities found in urls
+static void decode_entities(std::string& s)
+{
+    static const struct {
+        const char* entity;
+        char c;
+    } entities[] = {
+        {"&amp;", '&'}, {"&quot;", '"'}, {"&#39;", '\''}, {"&lt;", '<'}, {"&gt;", '>'}
+    };
+
+    size_t pos = 0;
+    while((pos = s.find('&', pos)) != std::string::npos) {
+        for(auto& e: entities) {
+            if(s.compare(pos, strlen(e.entity), e.entity) == 0) {
+                s.replace(pos, strlen(e.entity), 1, e.c);
+                break;
+            }
+        }
+        ++pos;
+    }
+}
+
+//extracts the href attribute value from the tag attributes in [p, end)
+static bool get_href(const char* p, const char* end, std::string& href)
+{
+    while(p < end) {
+        //attribute name
+        while(p < end && isspace(static_cast<unsigned char>(*p)))
+            ++p;
+        const char* name = p;
+        while(p < end && *p != '=' && *p != '/' && !isspace(static_cast<unsigned char>(*p)))
+            ++p;
+        size_t name_len = p-name;
+        while(p < end && isspace(static_cast<unsigned char>(*p)))
+            ++p;
+
+        if(p == end || *p != '=') {
+            //valueless attribute
+            if(p == name)
+                ++p;
+            continue;
+        }
+        ++p;
+        while(p < end && isspace(static_cast<unsigned char>(*p)))
+            ++p;
+
+        //value
+        const char* value;
+        size_t value_len;
+        if(p < end && (*p == '"' || *p == '\'')) {
+            char quote = *p++;
+            value = p;
+            while(p < end && *p != quote)
+                ++p;
+            value_len = p-value;
+            if(p < end)
+                ++p;
+        } else {
+            value = p;
+            while(p < end && !isspace(static_cast<unsigned char>(*p)))
+                ++p;
+            value_len = p-value;
+        }
+
+        if(name_len == 4 && match_lc(name, end, "href")) {
+            href.assign(value, value_len);
+            decode_entities(href);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t scan_links(const char* data, size_t size, std::vector<struct data_node_s>& nodes,
+    std::string& base_href, std::string& raw_close)
+{
+    const char* end = data+size;
+    const char* p = data;
+    const char* resume;
+
+    //the previous chunk ended inside a comment, <script> or <style>
+    if(!raw_close.empty()) {
+        const char* after = skip_raw(p, end, raw_close, resume);
+        if(!after)
+            return resume-data;
+        raw_close.clear();
+        p = after;
+    }
+
+    while((p = find_tag_open(p, end)) != end) {
+        const char* tag = p;
+
+        //comments
+        if(match_lc(p, end, "<!--")) {
+            raw_close = "-->";
+            const char* after = skip_raw(p+4, end, raw_close, resume);
+            if(!after)
+                return resume-data;
+            raw_close.clear();
+            p = after;
+            continue;
+        }
+
+        const char* close = find_tag_close(p+1, end);
+        if(close == end)
+            return tag-data;
+
+        if(match_lc(p, end, "<a") && (isspace(static_cast<unsigned char>(p[2])))) {
+            struct data_node_s node;
+            std::string href;
+
+            if(get_href(p+2, close, href)) {
+                node.tag_name = "a";
+                node.attr_data = href;
+                node.tag_type = tag_type_url;
+                nodes.push_back(node);
+                dbg_2<<"scanned link ["<<href<<"]\n";
+            }
+        } else if(match_lc(p, end, "<base") && isspace(static_cast<unsigned char>(p[5]))) {
+            //only the first counts
+            if(base_href.empty())
+                get_href(p+5, close, base_href);
+        } else if(match_lc(p, end, "<script") || match_lc(p, end, "<style")) {
+            //raw text elements, links inside are not part of the document
+            raw_close = (tolower(p[2]) == 'c')?"</script":"</style";
+            const char* after = skip_raw(close+1, end, raw_close, resume);
+            if(!after)
+                return resume-data;
+            raw_close.clear();
+            p = after;
+            continue;
+        }
+
+        p = close+1;
+    }
+
+    return size;
+}
@@ -0,0 +1,513 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "log_store.hpp"
+#include "debug.hpp"
+
+//Local defines
+#define REC_TOMBSTONE   1
+
+//on disk record header, followed by key then value
+struct record_s {
+    uint32_t checksum;      //of everything after this field
+    uint32_t flags;
+    uint32_t key_size;
+    uint32_t value_size;
+};
+
+#define CHECKED_OFFSET  sizeof(uint32_t)
+
+//FNV-1a, stable across builds unlike std::hash
+static uint32_t checksum(const char* data, size_t len)
+{
+    uint32_t h = 0x811c9dc5;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)data[i];
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+static uint64_t key_hash(const std::string& key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(unsigned char c: key) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static bool write_all(int fd, const char* buf, size_t len, uint64_t offset)
+{
+    while(len) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* buf, size_t len, uint64_t offset)
+{
+    while(len) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+log_store::segment_s::~segment_s(void)
+{
+    close(fd);
+}
+
+log_store::log_store(std::string path, size_t max) throw(db_exception)
+{
+    dir = path;
+    segment_max = max ? max : LOG_SEGMENT_MAX;
+    lookups = 0;
+    skipped = 0;
+    false_positives = 0;
+    compactions = 0;
+    stopping = false;
+
+    if(mkdir(dir.c_str(), 0755) && errno != EEXIST)
+        throw db_exception("failed to create log directory: "+dir);
+
+    DIR* d = opendir(dir.c_str());
+    if(!d)
+        throw db_exception("failed to open log directory: "+dir);
+
+    //segments are named by sequence number, oldest first
+    std::vector<uint32_t> ids;
+    struct dirent* ent;
+    while((ent = readdir(d)) != 0) {
+        char* end;
+        unsigned long id = strtoul(ent->d_name, &end, 10);
+        if(end != ent->d_name && !strcmp(end, ".data"))
+            ids.push_back((uint32_t)id);
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+
+    auto start = std::chrono::steady_clock::now();
+    for(auto id: ids) {
+        std::shared_ptr<segment_s> seg = open_segment(id, false);
+        segments[id] = seg;
+        load_segment(seg);
+    }
+
+    //never append to a segment from a previous run
+    uint32_t next = ids.empty() ? 1 : ids.back()+1;
+    active = open_segment(next, true);
+    segments[next] = active;
+
+    dbg<<"loaded "<<index.size()<<" keys from "<<ids.size()<<" segments in "
+       <<std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-start).count()
+       <<"ms\n";
+
+    compact_thread = std::thread(&log_store::compactor, this);
+}
+
+log_store::~log_store(void)
+{
+    compact_mutex.lock();
+    stopping = true;
+    compact_mutex.unlock();
+    compact_cv.notify_one();
+    compact_thread.join();
+
+    store_lock.lock();
+    if(active->size) {
+        seal_active();
+    } else {
+        ::remove(segment_path(active->id, "data").c_str());
+        segments.erase(active->id);
+    }
+    store_lock.unlock();
+}
+
+bool log_store::get(std::string& key, std::string& value) throw(db_exception)
+{
+    uint64_t hash = key_hash(key);
+    std::shared_ptr<segment_s> seg;
+    location_s loc;
+
+    ++lookups;
+    store_lock.lock();
+    auto it = index.find(hash);
+    if(it == index.end()) {
+        store_lock.unlock();
+        ++skipped;
+        return false;
+    }
+    loc = it->second;
+    seg = segments[loc.segment];
+    store_lock.unlock();
+
+    //segments are never modified in place, and stay readable whilst we hold
+    //a reference even if compacted meanwhile
+    std::string buf(loc.size, 0);
+    if(!read_all(seg->fd, &buf[0], loc.size, loc.offset))
+        throw db_exception("failed to read segment: "+segment_path(loc.segment, "data"));
+
+    record_s r;
+    memcpy(&r, buf.data(), sizeof(r));
+    if(sizeof(r)+r.key_size+r.value_size != loc.size ||
+       r.checksum != checksum(buf.data()+CHECKED_OFFSET, loc.size-CHECKED_OFFSET))
+        throw db_exception("corrupt record in segment: "+segment_path(loc.segment, "data"));
+
+    //another key with the same hash
+    if(buf.compare(sizeof(r), r.key_size, key)) {
+        ++false_positives;
+        return false;
+    }
+
+    value.assign(buf, sizeof(r)+r.key_size, r.value_size);
+    return true;
+}
+
+void log_store::put(std::string& key, const std::string& value) throw(db_exception)
+{
+    std::lock_guard<std::mutex> lock(store_lock);
+
+    hint_s h = append(0, key, value);
+    apply(active->id, h);
+}
+
+bool log_store::remove(std::string& key) throw(db_exception)
+{
+    std::lock_guard<std::mutex> lock(store_lock);
+
+    if(index.find(key_hash(key)) == index.end())
+        return false;
+
+    hint_s h = append(REC_TOMBSTONE, key, "");
+    apply(active->id, h);
+    return true;
+}
+
+unsigned int log_store::compact(void)
+{
+    std::vector<uint32_t> ids;
+
+    store_lock.lock();
+    for(auto& s: segments) {
+        if(s.second != active && s.second->dead*100 >= s.second->size*LOG_COMPACT_PERCENT)
+            ids.push_back(s.first);
+    }
+    store_lock.unlock();
+
+    for(auto id: ids)
+        compact_segment(id);
+
+    return ids.size();
+}
+
+struct log_stats_s log_store::stats(void)
+{
+    struct log_stats_s st = log_stats_s();
+
+    store_lock.lock();
+    st.keys = index.size();
+    st.segments = segments.size();
+    for(auto& s: segments) {
+        st.bytes += s.second->size;
+        st.dead_bytes += s.second->dead;
+    }
+    store_lock.unlock();
+    st.compactions = compactions;
+
+    return st;
+}
+
+struct db_filter_stats_s log_store::filter_stats(void)
+{
+    struct db_filter_stats_s st;
+    st.lookups = lookups;
+    st.skipped = skipped;
+    st.false_positives = false_positives;
+
+    return st;
+}
+
+std::string log_store::segment_path(uint32_t id, const char* ext)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%08u.%s", id, ext);
+    return dir+"/"+name;
+}
+
+std::shared_ptr<log_store::segment_s> log_store::open_segment(uint32_t id, bool create) throw(db_exception)
+{
+    std::string path = segment_path(id, "data");
+    int fd = open(path.c_str(), create ? O_RDWR|O_CREAT|O_EXCL : O_RDWR, 0644);
+    if(fd < 0)
+        throw db_exception("failed to open segment: "+path);
+
+    struct stat st;
+    if(fstat(fd, &st)) {
+        close(fd);
+        throw db_exception("failed to stat segment: "+path);
+    }
+
+    std::shared_ptr<segment_s> seg = std::make_shared<segment_s>();
+    seg->id = id;
+    seg->fd = fd;
+    seg->size = st.st_size;
+    seg->dead = 0;
+    return seg;
+}
+
+//adds a segment's records to the index, from its hint file if it has one
+void log_store::load_segment(std::shared_ptr<segment_s> seg)
+{
+    std::vector<hint_s> hints;
+
+    std::ifstream hint_file(segment_path(seg->id, "hint"), std::ios::binary|std::ios::ate);
+    if(hint_file) {
+        std::streamoff size = hint_file.tellg();
+        if(size > 0 && size%sizeof(hint_s) == 0) {
+            hints.resize(size/sizeof(hint_s));
+            hint_file.seekg(0);
+            hint_file.read((char*)hints.data(), size);
+
+            //hints must cover the whole segment
+            if(!hint_file || hints.back().offset+hints.back().size != seg->size)
+                hints.clear();
+        }
+    }
+
+    if(hints.empty() && seg->size) {
+        dbg<<"scanning segment "<<seg->id<<"\n";
+
+        std::string buf(seg->size, 0);
+        if(!read_all(seg->fd, &buf[0], seg->size, 0))
+            throw db_exception("failed to read segment: "+segment_path(seg->id, "data"));
+
+        uint64_t offset = 0;
+        while(offset+sizeof(record_s) <= seg->size) {
+            record_s r;
+            memcpy(&r, buf.data()+offset, sizeof(r));
+
+            uint64_t len = sizeof(r)+(uint64_t)r.key_size+r.value_size;
+            if(offset+len > seg->size ||
+               r.checksum != checksum(buf.data()+offset+CHECKED_OFFSET, len-CHECKED_OFFSET))
+                break;
+
+            hint_s h = {key_hash(buf.substr(offset+sizeof(r), r.key_size)), offset, (uint32_t)len, r.flags};
+            hints.push_back(h);
+            offset += len;
+        }
+
+        //whatever follows the last good record was being written when we died
+        if(offset != seg->size) {
+            std::cerr<<"truncating "<<seg->size-offset<<" bytes of torn records from "
+                     <<segment_path(seg->id, "data")<<std::endl;
+            if(ftruncate(seg->fd, offset))
+                throw db_exception("failed to truncate segment: "+segment_path(seg->id, "data"));
+            seg->size = offset;
+        }
+
+        if(!hints.empty())
+            write_hints(seg->id, hints);
+    }
+
+    for(auto& h: hints)
+        apply(seg->id, h);
+}
+
+//updates index for a record appended to segment @id, store_lock held
+void log_store::apply(uint32_t id, hint_s& h)
+{
+    auto it = index.find(h.hash);
+    if(it != index.end()) {
+        auto old = segments.find(it->second.segment);
+        if(old != segments.end())
+            old->second->dead += it->second.size;
+    }
+
+    if(h.flags & REC_TOMBSTONE) {
+        if(it != index.end())
+            index.erase(it);
+
+        //only needed to hide older records
+        segments[id]->dead += h.size;
+    } else {
+        location_s loc = {id, h.size, h.offset};
+        index[h.hash] = loc;
+    }
+}
+
+//store_lock held
+void log_store::seal_active(void)
+{
+    if(fdatasync(active->fd))
+        std::cerr<<"failed to sync "<<segment_path(active->id, "data")<<std::endl;
+
+    write_hints(active->id, active_hints);
+    active_hints.clear();
+}
+
+bool log_store::write_hints(uint32_t id, std::vector<hint_s>& hints)
+{
+    std::string path = segment_path(id, "hint");
+    std::string tmp = path+".tmp";
+
+    //renamed into place so a hint file is either whole or absent
+    std::ofstream hint_file(tmp, std::ios::binary|std::ios::trunc);
+    hint_file.write((char*)hints.data(), hints.size()*sizeof(hint_s));
+    hint_file.close();
+
+    if(!hint_file || rename(tmp.c_str(), path.c_str())) {
+        std::cerr<<"failed to write hint file "<<path<<std::endl;
+        ::remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//store_lock held
+log_store::hint_s log_store::append(uint32_t flags, std::string& key, const std::string& value) throw(db_exception)
+{
+    uint64_t len = sizeof(record_s)+key.size()+value.size();
+
+    if(active->size && active->size+len > segment_max) {
+        seal_active();
+
+        uint32_t next = active->id+1;
+        active = open_segment(next, true);
+        segments[next] = active;
+        compact_cv.notify_one();
+    }
+
+    std::string buf(len, 0);
+    record_s r = {0, flags, (uint32_t)key.size(), (uint32_t)value.size()};
+    memcpy(&buf[sizeof(r)], key.data(), key.size());
+    memcpy(&buf[sizeof(r)+key.size()], value.data(), value.size());
+    memcpy(&buf[0], &r, sizeof(r));
+    r.checksum = checksum(buf.data()+CHECKED_OFFSET, len-CHECKED_OFFSET);
+    memcpy(&buf[0], &r.checksum, sizeof(r.checksum));
+
+    //a failed write is overwritten by the next append
+    if(!write_all(active->fd, buf.data(), len, active->size))
+        throw db_exception("failed to append to segment: "+segment_path(active->id, "data"));
+
+    hint_s h = {key_hash(key), active->size, (uint32_t)len, flags};
+    active->size += len;
+    active_hints.push_back(h);
+
+    return h;
+}
+
+//moves live records of segment @id to the active segment, then removes it
+void log_store::compact_segment(uint32_t id)
+{
+    store_lock.lock();
+    auto it = segments.find(id);
+    if(it == segments.end()) {
+        store_lock.unlock();
+        return;
+    }
+    std::shared_ptr<segment_s> seg = it->second;
+    store_lock.unlock();
+
+    //sealed segments do not change, no lock needed to read them
+    std::string buf(seg->size, 0);
+    if(!read_all(seg->fd, &buf[0], seg->size, 0)) {
+        std::cerr<<"failed to read "<<segment_path(id, "data")<<" for compaction"<<std::endl;
+        return;
+    }
+
+    unsigned long moved = 0;
+    uint64_t offset = 0;
+    try {
+        while(offset+sizeof(record_s) <= buf.size()) {
+            record_s r;
+            memcpy(&r, buf.data()+offset, sizeof(r));
+            uint64_t len = sizeof(r)+(uint64_t)r.key_size+r.value_size;
+            if(offset+len > buf.size())
+                break;
+
+            std::string key = buf.substr(offset+sizeof(r), r.key_size);
+            uint64_t hash = key_hash(key);
+
+            //per record, so puts and gets carry on during compaction
+            std::lock_guard<std::mutex> lock(store_lock);
+            auto idx = index.find(hash);
+            if(r.flags & REC_TOMBSTONE) {
+                //still hides a record in an older segment
+                if(idx == index.end() && segments.begin()->first < id) {
+                    hint_s h = append(r.flags, key, "");
+                    apply(active->id, h);
+                }
+            } else if(idx != index.end() && idx->second.segment == id && idx->second.offset == offset) {
+                hint_s h = append(r.flags, key, buf.substr(offset+sizeof(r)+r.key_size, r.value_size));
+                apply(active->id, h);
+                ++moved;
+            }
+
+            offset += len;
+        }
+    } catch(db_exception& e) {
+        std::cerr<<"compaction of segment "<<id<<" failed: "<<e.what()<<std::endl;
+        return;
+    }
+
+    //copies must be on disk before the originals go
+    store_lock.lock();
+    if(fdatasync(active->fd)) {
+        store_lock.unlock();
+        std::cerr<<"failed to sync "<<segment_path(active->id, "data")<<", keeping segment "<<id<<std::endl;
+        return;
+    }
+    segments.erase(id);
+    store_lock.unlock();
+
+    ::remove(segment_path(id, "data").c_str());
+    ::remove(segment_path(id, "hint").c_str());
+    ++compactions;
+
+    dbg<<"compacted segment "<<id<<", moved "<<moved<<" records\n";
+}
+
+//background thread compacting sealed segments
+void log_store::compactor(void)
+{
+    std::unique_lock<std::mutex> lock(compact_mutex);
+
+    while(!stopping) {
+        compact_cv.wait_for(lock, std::chrono::milliseconds(LOG_COMPACT_INTERVAL));
+        if(stopping)
+            break;
+
+        lock.unlock();
+        compact();
+        lock.lock();
+    }
+}
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapped_file.hpp"
+#include "debug.hpp"
+
+mapped_file::mapped_file(std::string path)
+{
+    base = 0;
+    length = 0;
+    opened = false;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return;
+
+    struct stat st;
+    if(fstat(fd, &st)) {
+        close(fd);
+        return;
+    }
+
+    //empty files can not be mapped, but are still open
+    length = st.st_size;
+    if(length) {
+        void* m = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m == MAP_FAILED) {
+            dbg<<"failed to map ["<<path<<"]\n";
+            close(fd);
+            return;
+        }
+        base = (const char*)m;
+    }
+
+    //mapping stays valid without the descriptor
+    close(fd);
+    opened = true;
+}
+
+mapped_file::~mapped_file(void)
+{
+    if(base)
+        munmap((void*)base, length);
+}
+
+bool mapped_file::is_open(void)
+{
+    return opened;
+}
+
+const char* mapped_file::data(void)
+{
+    return base;
+}
+
+size_t mapped_file::size(void)
+{
+    return length;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <mutex>
 #include <vector>
+#include <map>
 #include <curl/curl.h>
 
 #include "netio.hpp"
@@ -9,23 +10,48 @@
 netio::netio(std::string user_agent_string)
 {
     user_agent = user_agent_string;
+    debug_output = false;
 
     //initialise libCURL
     lib_handle = curl_easy_init();
-    default_config(false);
+    default_config(lib_handle, false);
+
+    struct netio_multi_config_s multi_cfg = {
+        .max_transfers = NETIO_MAX_TRANSFERS,
+        .max_host_conn = NETIO_MAX_HOST_CONN
+    };
+    multi_handle = curl_multi_init();
+    configure_multi(multi_cfg);
 }
 
 netio::netio(std::string user_agent_string, bool enable_debug)
 {
     user_agent = user_agent_string;
+    debug_output = enable_debug;
 
     //initialise libCURL
     lib_handle = curl_easy_init();
-    default_config(enable_debug);
+    default_config(lib_handle, enable_debug);
+
+    struct netio_multi_config_s multi_cfg = {
+        .max_transfers = NETIO_MAX_TRANSFERS,
+        .max_host_conn = NETIO_MAX_HOST_CONN
+    };
+    multi_handle = curl_multi_init();
+    configure_multi(multi_cfg);
 }
 
 netio::~netio(void)
 {
+    //abandon anything still in flight, handles never added included
+    add_transfers();
+    for(auto& t: transfers) {
+        curl_multi_remove_handle(multi_handle, t.first);
+        curl_easy_cleanup(t.first);
+        delete t.second;
+    }
+    curl_multi_cleanup(multi_handle);
+
     curl_easy_cleanup(lib_handle);
 }
 
@@ -41,19 +67,49 @@ bool netio::fetch(std::string* mem, std::string url)
     target_memory = mem;
 
     curl_easy_setopt(lib_handle, CURLOPT_URL, url.c_str());
-    curl_ret = curl_easy_perform(lib_handle);
+    CURLcode ret = curl_easy_perform(lib_handle);
+    lib_mutex.unlock();
+
+    dbg<<"netio: size of data retrieved: "<<mem->size()<<std::endl;
+
+    if(ret != CURLE_OK)
+        set_error(ret);
+
+    return (ret == CURLE_OK)?true:false;
+}
+
+bool netio::fetch(chunk_handler handler, std::string url)
+{
+    dbg<<"stream fetching ["<<url<<"]\n";
+
+    lib_mutex.lock();
+    target_memory = 0;
+    target_handler = handler;
+
+    curl_easy_setopt(lib_handle, CURLOPT_URL, url.c_str());
+    CURLcode ret = curl_easy_perform(lib_handle);
+    target_handler = nullptr;
     lib_mutex.unlock();
 
-    dbg<<"netio: size of data retrieved: "<<target_memory->size()<<std::endl;
+    if(ret != CURLE_OK)
+        set_error(ret);
 
-    return (curl_ret == CURLE_OK)?true:false;
+    return (ret == CURLE_OK)?true:false;
 }
 
 std::string netio::last_error(void)
 {
+    std::lock_guard<std::mutex> lock(error_lock);
     return error_buffer;
 }
 
+//blocking fetches may run on any thread, async ones report their own errors
+void netio::set_error(CURLcode ret)
+{
+    std::lock_guard<std::mutex> lock(error_lock);
+    error_buffer = curl_easy_strerror(ret);
+}
+
 //internal callback method wrapper (libCURL expects a C function)
 static size_t store_data_callback(char *ptr, size_t size, size_t nmemb, void *userp)
 {
@@ -63,29 +119,38 @@ static size_t store_data_callback(char *ptr, size_t size, size_t nmemb, void *us
         return 0;
 }
 
-bool netio::default_config(bool debug)
+//async transfers write straight into their own buffer
+static size_t append_data_callback(char *ptr, size_t size, size_t nmemb, void *userp)
+{
+    if(userp) {
+        ((std::string*)userp)->append(ptr, size*nmemb);
+        return size*nmemb;
+    } else {
+        return 0;
+    }
+}
+
+//returns the first option which could not be set, CURLE_OK if none
+CURLcode netio::default_config(CURL* handle, bool debug)
 {
-    curl_ret = curl_easy_setopt(lib_handle, CURLOPT_VERBOSE, ((debug == true)?1:0));
-    if(curl_ret != CURLE_OK)
-        return false;
+    CURLcode ret = curl_easy_setopt(handle, CURLOPT_VERBOSE, ((debug == true)?1:0));
+    if(ret != CURLE_OK)
+        return ret;
 
     //options
-    if((curl_ret = curl_easy_setopt(lib_handle, CURLOPT_HEADER, 0)) != CURLE_OK)
-        return false;
-    if((curl_ret = curl_easy_setopt(lib_handle, CURLOPT_NOPROGRESS, 1)) != CURLE_OK)
-        return false;
-    if((curl_ret = curl_easy_setopt(lib_handle, CURLOPT_NOSIGNAL, 1)) != CURLE_OK)
-        return false;
-    if((curl_ret = curl_easy_setopt(lib_handle, CURLOPT_USERAGENT, user_agent.c_str())) != CURLE_OK)
-        return false;
+    if((ret = curl_easy_setopt(handle, CURLOPT_HEADER, 0)) != CURLE_OK)
+        return ret;
+    if((ret = curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1)) != CURLE_OK)
+        return ret;
+    if((ret = curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1)) != CURLE_OK)
+        return ret;
+    if((ret = curl_easy_setopt(handle, CURLOPT_USERAGENT, user_agent.c_str())) != CURLE_OK)
+        return ret;
 
     //callbacks
-    if((curl_ret = curl_easy_setopt(lib_handle, CURLOPT_WRITEFUNCTION, &store_data_callback)) != CURLE_OK)
-        return false;
-    if((curl_ret = curl_easy_setopt(lib_handle, CURLOPT_WRITEDATA, this)) != CURLE_OK)
-        return false;
-
-    return true;
+    if((ret = curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &store_data_callback)) != CURLE_OK)
+        return ret;
+    return curl_easy_setopt(handle, CURLOPT_WRITEDATA, this);
 }
 
 void netio::reset_config(void)
@@ -97,6 +162,137 @@ size_t netio::store_data(char *ptr, size_t size, size_t nmemb)
 {
     size_t real_size = size*nmemb;
 
+    //streaming fetches never hold the body, returning less than real_size
+    //makes libCURL abort the transfer
+    if(target_handler)
+        return target_handler(ptr, real_size)?real_size:0;
+
     target_memory->append(ptr, real_size);
     return real_size;
 }
+
+void netio::configure_multi(struct netio_multi_config_s& config)
+{
+    //a poll in progress would hold perform_mutex until it times out
+    curl_multi_wakeup(multi_handle);
+
+    std::lock_guard<std::mutex> lock(perform_mutex);
+    //curl queues transfers internally once either limit is reached
+    curl_multi_setopt(multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)config.max_transfers);
+    curl_multi_setopt(multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, (long)config.max_host_conn);
+    curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+}
+
+void netio::fetch_async(std::string url, fetch_handler handler)
+{
+    dbg<<"queueing async fetch ["<<url<<"]\n";
+    struct transfer_s* t = new struct transfer_s;
+    t->url = url;
+    t->handler = handler;
+
+    CURL* handle = curl_easy_init();
+    CURLcode ret = CURLE_FAILED_INIT;
+    if(handle && (ret = default_config(handle, debug_output)) == CURLE_OK &&
+       (ret = curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &append_data_callback)) == CURLE_OK &&
+       (ret = curl_easy_setopt(handle, CURLOPT_WRITEDATA, &t->data)) == CURLE_OK)
+        ret = curl_easy_setopt(handle, CURLOPT_URL, t->url.c_str());
+
+    if(ret != CURLE_OK) {
+        t->data = curl_easy_strerror(ret);
+        std::cerr<<"netio: failed to set up async fetch of ["<<url<<"]: "<<t->data<<std::endl;
+        if(handle)
+            curl_easy_cleanup(handle);
+        if(t->handler)
+            t->handler(t->url, t->data, false);
+        delete t;
+        return;
+    }
+
+    //multi_handle may be polled right now, perform() adds it once woken
+    multi_mutex.lock();
+    transfers[handle] = t;
+    added.push_back(handle);
+    multi_mutex.unlock();
+
+    curl_multi_wakeup(multi_handle);
+}
+
+unsigned int netio::perform(int timeout_ms)
+{
+    int running = 0;
+
+    perform_mutex.lock();
+    add_transfers();
+    curl_multi_perform(multi_handle, &running);
+    if(running > 0) {
+        //fetch_async() wakes us, so new transfers do not wait out the poll
+        curl_multi_poll(multi_handle, NULL, 0, timeout_ms, NULL);
+        add_transfers();
+        curl_multi_perform(multi_handle, &running);
+    }
+    complete_transfers();
+
+    return pending();
+}
+
+void netio::run(void)
+{
+    while(perform(1000) > 0);
+}
+
+//gives transfers queued by fetch_async() to multi_handle, perform_mutex held
+void netio::add_transfers(void)
+{
+    std::vector<CURL*> handles;
+    multi_mutex.lock();
+    handles.swap(added);
+    multi_mutex.unlock();
+
+    for(auto h: handles)
+        curl_multi_add_handle(multi_handle, h);
+}
+
+unsigned int netio::pending(void)
+{
+    std::lock_guard<std::mutex> lock(multi_mutex);
+    return transfers.size();
+}
+
+//collects finished transfers and hands them to their handlers. Called with
+//perform_mutex held, it is released before handlers are called so that they
+//may queue further fetches or drive the engine themselves.
+void netio::complete_transfers(void)
+{
+    std::vector<std::pair<struct transfer_s*, CURLcode>> done;
+    CURLMsg* msg;
+    int msgs_left;
+
+    multi_mutex.lock();
+    while((msg = curl_multi_info_read(multi_handle, &msgs_left))) {
+        if(msg->msg != CURLMSG_DONE)
+            continue;
+
+        CURL* handle = msg->easy_handle;
+        std::map<CURL*, struct transfer_s*>::iterator it = transfers.find(handle);
+        if(it != transfers.end()) {
+            done.push_back(std::make_pair(it->second, msg->data.result));
+            transfers.erase(it);
+        }
+        curl_multi_remove_handle(multi_handle, handle);
+        curl_easy_cleanup(handle);
+    }
+    multi_mutex.unlock();
+    perform_mutex.unlock();
+
+    for(auto& d: done) {
+        dbg<<"netio: async fetch of ["<<d.first->url<<"] complete, "<<d.first->data.size()<<" bytes\n";
+        //a failed transfer's partial body is of no use, it carries the error instead
+        bool ok = (d.second == CURLE_OK);
+        if(!ok)
+            d.first->data = curl_easy_strerror(d.second);
+
+        if(d.first->handler)
+            d.first->handler(d.first->url, d.first->data, ok);
+        delete d.first;
+    }
+}
@@ -0,0 +1,291 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#include "page_record.hpp"
+#include "debug.hpp"
+
+//Local defines
+#define HEADER_SIZE     5   //magic and version
+#define MAX_VARINT      10
+
+static void put_fixed(std::string& out, uint64_t v, int bytes)
+{
+    for(int i = 0; i < bytes; ++i)
+        out.push_back((char)(v>>(i*8)));
+}
+
+static void put_varint(std::string& out, uint64_t v)
+{
+    while(v >= 0x80) {
+        out.push_back((char)(v|0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static void put_string(std::string& out, const std::string& s)
+{
+    put_varint(out, s.size());
+    out.append(s);
+}
+
+static uint64_t get_fixed(const char* p, int bytes)
+{
+    uint64_t v = 0;
+    for(int i = 0; i < bytes; ++i)
+        v |= (uint64_t)(unsigned char)p[i]<<(i*8);
+    return v;
+}
+
+//bounds checked, for parsing
+static bool read_varint(const char*& p, const char* end, uint64_t& v)
+{
+    v = 0;
+    for(int i = 0; i < MAX_VARINT && p < end; ++i) {
+        unsigned char b = *p++;
+        v |= (uint64_t)(b & 0x7f)<<(i*7);
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+//unchecked, for records already parsed
+static uint64_t decode_varint(const char*& p)
+{
+    uint64_t v = 0;
+    for(int i = 0; ; ++i) {
+        unsigned char b = *p++;
+        v |= (uint64_t)(b & 0x7f)<<(i*7);
+        if(!(b & 0x80))
+            return v;
+    }
+}
+
+static bool read_field(const char*& p, const char* end, page_field_s& f)
+{
+    uint64_t len;
+    if(!read_varint(p, end, len) || len > (uint64_t)(end-p))
+        return false;
+
+    f.data = p;
+    f.size = len;
+    p += len;
+    return true;
+}
+
+static bool read_list(const char*& p, const char* end, page_field_list& l)
+{
+    uint64_t count;
+    //every entry takes at least its length byte
+    if(!read_varint(p, end, count) || count > (uint64_t)(end-p))
+        return false;
+
+    const char* start = p;
+    page_field_s f;
+    for(uint64_t i = 0; i < count; ++i) {
+        if(!read_field(p, end, f))
+            return false;
+    }
+
+    l = page_field_list(start, count);
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& os, const page_field_s& f)
+{
+    return os.write(f.data, f.size);
+}
+
+page_field_list::iterator::iterator(const char* p, size_t r)
+{
+    pos = p;
+    remaining = r;
+}
+
+page_field_s page_field_list::iterator::operator*(void) const
+{
+    const char* p = pos;
+    page_field_s f;
+    f.size = decode_varint(p);
+    f.data = p;
+    return f;
+}
+
+page_field_list::iterator& page_field_list::iterator::operator++(void)
+{
+    size_t len = decode_varint(pos);
+    pos += len;
+    --remaining;
+    return *this;
+}
+
+bool page_field_list::iterator::operator!=(const iterator& i) const
+{
+    return remaining != i.remaining;
+}
+
+page_field_list::page_field_list(void)
+{
+    start = 0;
+    count = 0;
+}
+
+page_field_list::page_field_list(const char* s, size_t c)
+{
+    start = s;
+    count = c;
+}
+
+size_t page_field_list::size(void) const
+{
+    return count;
+}
+
+page_field_list::iterator page_field_list::begin(void) const
+{
+    return iterator(start, count);
+}
+
+page_field_list::iterator page_field_list::end(void) const
+{
+    return iterator(0, 0);
+}
+
+page_view::page_view(const char* data, size_t size)
+{
+    static const page_field_s empty = {"", 0};
+
+    is_valid = false;
+    rank_v = 0;
+    crawl_count_v = 0;
+    last_crawl_v = 0;
+    url_f = title_f = description_f = empty;
+
+    if(!is_page_record(data, size) || (unsigned char)data[4] != PAGE_RECORD_VERSION) {
+        dbg<<"not a version "<<PAGE_RECORD_VERSION<<" page record\n";
+        return;
+    }
+
+    const char* p = data+HEADER_SIZE;
+    const char* end = data+size;
+    page_field_s url_r, title_r, description_r;
+    page_field_list out_links_r, meta_r;
+
+    if(!read_varint(p, end, rank_v) || !read_varint(p, end, crawl_count_v))
+        return;
+    if(end-p < 8)
+        return;
+    last_crawl_v = (int64_t)get_fixed(p, 8);
+    p += 8;
+
+    if(!read_field(p, end, url_r) || !read_field(p, end, title_r) ||
+       !read_field(p, end, description_r) || !read_list(p, end, out_links_r) ||
+       !read_list(p, end, meta_r)) {
+        dbg<<"truncated page record\n";
+        return;
+    }
+
+    url_f = url_r;
+    title_f = title_r;
+    description_f = description_r;
+    out_links_l = out_links_r;
+    meta_l = meta_r;
+    is_valid = true;
+}
+
+bool page_view::valid(void) const
+{
+    return is_valid;
+}
+
+unsigned int page_view::rank(void) const
+{
+    return rank_v;
+}
+
+unsigned int page_view::crawl_count(void) const
+{
+    return crawl_count_v;
+}
+
+std::chrono::system_clock::time_point page_view::last_crawl(void) const
+{
+    return std::chrono::system_clock::time_point(std::chrono::system_clock::duration(last_crawl_v));
+}
+
+page_field_s page_view::url(void) const
+{
+    return url_f;
+}
+
+page_field_s page_view::title(void) const
+{
+    return title_f;
+}
+
+page_field_s page_view::description(void) const
+{
+    return description_f;
+}
+
+page_field_list page_view::out_links(void) const
+{
+    return out_links_l;
+}
+
+page_field_list page_view::meta(void) const
+{
+    return meta_l;
+}
+
+void page_view::materialize(page_data_c& page) const
+{
+    page.rank = rank();
+    page.crawl_count = crawl_count();
+    page.last_crawl = last_crawl();
+
+    //straight from the record, no intermediate strings
+    page.url.assign(url_f.data, url_f.data+url_f.size);
+    page.title.assign(title_f.data, title_f.data+title_f.size);
+    page.description.assign(description_f.data, description_f.data+description_f.size);
+
+    page.out_links.clear();
+    page.out_links.reserve(out_links_l.size());
+    for(auto f: out_links_l)
+        page.out_links.emplace_back(f.data, f.size);
+
+    page.meta.clear();
+    page.meta.reserve(meta_l.size());
+    for(auto f: meta_l)
+        page.meta.emplace_back(f.data, f.data+f.size);
+}
+
+void encode_page_record(const page_data_c& page, std::string& out)
+{
+    put_fixed(out, PAGE_RECORD_MAGIC, 4);
+    out.push_back((char)PAGE_RECORD_VERSION);
+
+    put_varint(out, page.rank);
+    put_varint(out, page.crawl_count);
+    put_fixed(out, (uint64_t)page.last_crawl.time_since_epoch().count(), 8);
+
+    put_string(out, page.url.raw());
+    put_string(out, page.title.raw());
+    put_string(out, page.description.raw());
+
+    put_varint(out, page.out_links.size());
+    for(auto& l: page.out_links)
+        put_string(out, l);
+
+    put_varint(out, page.meta.size());
+    for(auto& m: page.meta)
+        put_string(out, m.raw());
+}
+
+bool is_page_record(const char* data, size_t size)
+{
+    return size >= HEADER_SIZE && get_fixed(data, 4) == PAGE_RECORD_MAGIC;
+}
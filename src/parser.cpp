@@ -1,13 +1,20 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
 #include <libxml/HTMLparser.h>
 #include <libxml/xpath.h>
+#include <libxml/SAX2.h>
+#include <libxml/uri.h>
+#include <libxml/dict.h>
 #include <glibmm/ustring.h>
 #include <glib.h>
 #include <glibmm/convert.h>
 
 #include "parser.hpp"
+#include "link_scan.hpp"
 #include "ipc_common.hpp"
 #include "debug.hpp"
 
@@ -16,19 +23,402 @@
 #include <fstream>
 #endif
 
+//hardwired config. NONET as pages are always fetched by netio
+#define HTML_PARSE_OPTIONS (HTML_PARSE_RECOVER|HTML_PARSE_NOERROR|HTML_PARSE_NOWARNING|HTML_PARSE_NOBLANKS|HTML_PARSE_NONET)
+
+//longest incomplete tag kept between chunks by the link scanner, beyond it
+//the '<' is taken as text
+#define SCAN_TAIL_MAX (64*1024)
+
+parser::parser(void)
+{
+    init();
+}
+
+parser::parser(std::string& data, Glib::ustring url)
+{
+    init();
+    doc_url = url;
+
+    doc = htmlReadMemory(data.c_str(), data.size(), doc_url.c_str(), 0, HTML_PARSE_OPTIONS);
+}
+
 parser::parser(Glib::ustring url)
 {
+    init();
     doc_url = url;
 
-    //hardwired config
-    int h_opt = HTML_PARSE_RECOVER|HTML_PARSE_NOERROR|HTML_PARSE_NOWARNING|HTML_PARSE_NOBLANKS;
-    doc = htmlReadFile(url.c_str(), 0, h_opt);
+    start_push(0);
+}
+
+parser::parser(Glib::ustring url, parse_profile& profile)
+{
+    init();
+    reset(url, profile);
 }
 
 parser::~parser(void)
 {
+    //libxml2 global state is left alone, other threads may still be parsing
+    clear();
+    if(push_ctxt)
+        htmlFreeParserCtxt(push_ctxt);
+    if(xpath_ctxt)
+        xmlXPathFreeContext(xpath_ctxt);
+    //documents still alive hold their own reference
+    if(dict)
+        xmlDictFree(dict);
+}
+
+void parser::init(void)
+{
+    push_ctxt = 0;
+    push_pending = false;
+    xpath_ctxt = 0;
+    dict = xmlDictCreate();
+    doc = 0;
+    sax_profile = 0;
+    sax_depth = 0;
+}
+
+//frees everything belonging to the previous page
+void parser::clear(void)
+{
+    data.clear();
+
+    //an unfinished document is still owned by the context
+    if(push_ctxt && push_ctxt->myDoc) {
+        xmlFreeDoc(push_ctxt->myDoc);
+        push_ctxt->myDoc = 0;
+    }
+    push_pending = false;
     xmlFreeDoc(doc);
-    xmlCleanupParser();
+    doc = 0;
+
+    sax_open.clear();
+    sax_depth = 0;
+    scan_buffer.clear();
+    scan_raw_close.clear();
+    base_href.clear();
+}
+
+void parser::reset(Glib::ustring url, parse_profile& profile)
+{
+    clear();
+    doc_url = url;
+    sax_profile = &profile;
+
+    if(profile.links_only)
+        return;
+
+    xmlSAXHandler sax;
+    if(profile.needs_dom) {
+        //chain to the default tree builder so xpath can run afterwards
+        memset(&sax, 0, sizeof(sax));
+        xmlSAX2InitHtmlDefaultSAXHandler(&sax);
+    } else {
+        //no tree is built at all
+        memset(&sax, 0, sizeof(sax));
+    }
+    sax.startElement = &parser::sax_start_element;
+    sax.endElement = &parser::sax_end_element;
+    sax.characters = &parser::sax_characters;
+
+    start_push(&sax);
+}
+
+//starts a push parse of doc_url with @sax callbacks, or the default tree
+//builder if @sax is 0. A context is created per page, xmlCtxtResetPush would
+//clear its html flag and later pages would be built as XML documents, but
+//each shares this parser's dictionary
+void parser::start_push(htmlSAXHandlerPtr sax)
+{
+    if(push_ctxt)
+        htmlFreeParserCtxt(push_ctxt);
+
+    //encoding is detected from the first chunk. With no user data libxml2
+    //passes the context itself to SAX callbacks, as the tree builder expects
+    push_ctxt = htmlCreatePushParserCtxt(sax, 0, 0, 0, doc_url.c_str(), XML_CHAR_ENCODING_NONE);
+    if(!push_ctxt) {
+        std::cerr<<"Failed to create push parser for "<<doc_url<<std::endl;
+        return;
+    }
+
+    //nothing is parsed yet, only the names interned on creation need moving
+    if(dict) {
+        xmlDictFree(push_ctxt->dict);
+        push_ctxt->dict = dict;
+        xmlDictReference(dict);
+        push_ctxt->str_xml = xmlDictLookup(dict, BAD_CAST "xml", 3);
+        push_ctxt->str_xmlns = xmlDictLookup(dict, BAD_CAST "xmlns", 5);
+        push_ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+    }
+
+    push_ctxt->_private = this;
+    htmlCtxtUseOptions(push_ctxt, HTML_PARSE_OPTIONS);
+    push_pending = true;
+}
+
+//accepts //tag, //tag[@attr] and //tag[@attr='value'] (or "value"), anything
+//else has to be evaluated as xpath
+static bool sax_rule_from_xpath(const std::string& xpath, struct sax_rule_s& rule)
+{
+    size_t pos = 2;
+    size_t len = xpath.length();
+
+    if(xpath.compare(0, 2, "//") != 0)
+        return false;
+
+    //tag name
+    while(pos < len && (isalnum(xpath[pos]) || xpath[pos] == '-' || xpath[pos] == '_'))
+        ++pos;
+    if(pos == 2)
+        return false;
+    rule.tag = xpath.substr(2, pos-2);
+    std::transform(rule.tag.begin(), rule.tag.end(), rule.tag.begin(), ::tolower);
+    rule.cond_attr.clear();
+    rule.cond_value.clear();
+    rule.match_value = false;
+
+    if(pos == len)
+        return true;
+
+    //single attribute predicate
+    if(xpath.compare(pos, 2, "[@") != 0)
+        return false;
+    pos += 2;
+
+    size_t start = pos;
+    while(pos < len && (isalnum(xpath[pos]) || xpath[pos] == '-' || xpath[pos] == '_'))
+        ++pos;
+    if(pos == start || pos == len)
+        return false;
+    rule.cond_attr = xpath.substr(start, pos-start);
+    std::transform(rule.cond_attr.begin(), rule.cond_attr.end(), rule.cond_attr.begin(), ::tolower);
+
+    if(xpath[pos] == '=') {
+        ++pos;
+        if(pos == len || (xpath[pos] != '\'' && xpath[pos] != '"'))
+            return false;
+
+        char quote = xpath[pos++];
+        size_t end = xpath.find(quote, pos);
+        if(end == std::string::npos)
+            return false;
+        rule.cond_value = xpath.substr(pos, end-pos);
+        rule.match_value = true;
+        pos = end+1;
+    }
+
+    return (pos == len-1 && xpath[pos] == ']');
+}
+
+parse_profile::parse_profile(std::vector<struct tagdb_s>& parse_param)
+{
+    //profiles are built before crawler threads start, libxml2 must be
+    //initialised once from the main thread before concurrent use
+    xmlInitParser();
+
+    param = parse_param;
+    needs_dom = false;
+    links_only = !param.empty();
+
+    for(unsigned int i = 0; i < param.size(); ++i) {
+        dbg_2<<"compiling xpath ["<<param[i].xpath<<"]"<<std::endl;
+        xmlXPathCompExprPtr e = xmlXPathCompile(reinterpret_cast<const xmlChar*>(param[i].xpath.c_str()));
+        if(!e)
+            std::cerr<<"Failed to compile xpath ["<<param[i].xpath<<"]\n";
+        expr.push_back(e);
+
+        struct sax_rule_s rule;
+        if(sax_rule_from_xpath(param[i].xpath, rule)) {
+            dbg_2<<"xpath ["<<param[i].xpath<<"] handled by sax rule\n";
+            rule.param = i;
+            rules.push_back(rule);
+            by_sax.push_back(true);
+
+            if(param[i].tag_type != tag_type_url || rule.tag != "a" || rule.cond_attr != "href"
+               || rule.match_value || param[i].attr != "href")
+                links_only = false;
+        } else {
+            by_sax.push_back(false);
+            links_only = false;
+            if(e)
+                needs_dom = true;
+        }
+    }
+    dbg<<"parse profile: "<<rules.size()<<"/"<<param.size()<<" sax rules, links only "<<links_only<<std::endl;
+}
+
+parse_profile::~parse_profile(void)
+{
+    for(auto& e: expr)
+        xmlXPathFreeCompExpr(e);
+}
+
+bool parser::parse_chunk(const char* chunk, size_t size)
+{
+    if(sax_profile && sax_profile->links_only) {
+        //only the incomplete tail of the previous chunk is kept
+        scan_buffer.append(chunk, size);
+        size_t used = scan_links(scan_buffer.data(), scan_buffer.size(), data, base_href, scan_raw_close);
+        scan_buffer.erase(0, used);
+
+        //an unterminated tag would otherwise be rescanned with every chunk
+        if(scan_buffer.size() > SCAN_TAIL_MAX)
+            scan_buffer.erase(0, 1);
+        return true;
+    }
+
+    if(!push_pending)
+        return false;
+
+    dbg_2<<"parsing chunk of "<<size<<" bytes\n";
+    htmlParseChunk(push_ctxt, chunk, size, 0);
+    return true;
+}
+
+void parser::sax_start_element(void* ctx, const xmlChar* name, const xmlChar** atts)
+{
+    htmlParserCtxtPtr ctxt = static_cast<htmlParserCtxtPtr>(ctx);
+    parser* p = static_cast<parser*>(ctxt->_private);
+    parse_profile* profile = p->sax_profile;
+
+    if(profile->needs_dom)
+        xmlSAX2StartElement(ctx, name, atts);
+
+    ++p->sax_depth;
+    const char* tag = reinterpret_cast<const char*>(name);
+
+    //links are resolved against the first <base href>
+    if(p->base_href.empty() && !strcmp(tag, "base")) {
+        for(unsigned int i = 0; atts && atts[i]; i += 2) {
+            if(atts[i+1] && !strcmp(reinterpret_cast<const char*>(atts[i]), "href")) {
+                p->base_href = reinterpret_cast<const char*>(atts[i+1]);
+                break;
+            }
+        }
+    }
+
+    for(auto& r: profile->rules) {
+        if(r.tag.compare(tag) != 0)
+            continue;
+
+        //attribute predicate
+        if(!r.cond_attr.empty()) {
+            bool found = false;
+            for(unsigned int i = 0; atts && atts[i]; i += 2) {
+                if(r.cond_attr.compare(reinterpret_cast<const char*>(atts[i])) == 0) {
+                    found = !r.match_value || (atts[i+1] &&
+                        r.cond_value.compare(reinterpret_cast<const char*>(atts[i+1])) == 0);
+                    break;
+                }
+            }
+            if(!found)
+                continue;
+        }
+
+        struct tagdb_s& param = profile->param[r.param];
+        struct data_node_s data_entry;
+        data_entry.tag_name = tag;
+        data_entry.tag_type = param.tag_type;
+
+        if(!param.attr.empty()) {
+            for(unsigned int i = 0; atts && atts[i]; i += 2) {
+                if(atts[i+1] && param.attr.compare(reinterpret_cast<const char*>(atts[i])) == 0) {
+                    data_entry.attr_data = reinterpret_cast<const char*>(atts[i+1]);
+                    break;
+                }
+            }
+        }
+
+        //node is saved now to keep document order, text is filled in on close
+        struct sax_match_s match;
+        match.node = p->data.size();
+        match.depth = p->sax_depth;
+        p->sax_open.push_back(match);
+        p->data.push_back(data_entry);
+    }
+}
+
+void parser::sax_end_element(void* ctx, const xmlChar* name)
+{
+    htmlParserCtxtPtr ctxt = static_cast<htmlParserCtxtPtr>(ctx);
+    parser* p = static_cast<parser*>(ctxt->_private);
+
+    if(p->sax_profile->needs_dom)
+        xmlSAX2EndElement(ctx, name);
+
+    while(!p->sax_open.empty() && p->sax_open.back().depth == p->sax_depth) {
+        struct sax_match_s& match = p->sax_open.back();
+        p->data[match.node].tag_data = match.text;
+        dbg_2<<"sax matched ["<<p->data[match.node].tag_name<<"] tag data ["<<p->data[match.node].tag_data<<"]\n";
+        p->sax_open.pop_back();
+    }
+    --p->sax_depth;
+}
+
+void parser::sax_characters(void* ctx, const xmlChar* ch, int len)
+{
+    htmlParserCtxtPtr ctxt = static_cast<htmlParserCtxtPtr>(ctx);
+    parser* p = static_cast<parser*>(ctxt->_private);
+
+    if(p->sax_profile->needs_dom)
+        xmlSAX2Characters(ctx, ch, len);
+
+    //as xmlNodeListGetString, only text directly inside a matched node counts
+    for(auto it = p->sax_open.rbegin(); it != p->sax_open.rend() && it->depth == p->sax_depth; ++it)
+        it->text.append(reinterpret_cast<const char*>(ch), len);
+}
+
+//takes the first <base href> from the document, for pages no SAX pass saw
+void parser::find_base(void)
+{
+    if(!base_href.empty() || !xpath_ctxt)
+        return;
+
+    xmlXPathObjectPtr base = xmlXPathEvalExpression(reinterpret_cast<const xmlChar*>("(//base[@href])[1]"), xpath_ctxt);
+    if(base && !xmlXPathNodeSetIsEmpty(base->nodesetval)) {
+        xmlChar* href = xmlGetProp(base->nodesetval->nodeTab[0], reinterpret_cast<const xmlChar*>("href"));
+        if(href)
+            base_href = reinterpret_cast<const char*>(href);
+        xmlFree(href);
+    }
+    xmlXPathFreeObject(base);
+}
+
+//makes links absolute, against <base href> (itself relative to the page) or
+//the page url. Links which do not parse as uris are left as they are
+void parser::resolve_links(void)
+{
+    xmlChar* base = 0;
+    if(!base_href.empty())
+        base = xmlBuildURI(reinterpret_cast<const xmlChar*>(base_href.c_str()),
+                           reinterpret_cast<const xmlChar*>(doc_url.c_str()));
+    if(!base)
+        base = xmlStrdup(reinterpret_cast<const xmlChar*>(doc_url.c_str()));
+
+    for(auto& d: data) {
+        if(d.tag_type != tag_type_url || d.attr_data.empty())
+            continue;
+
+        //links with a scheme of their own come back unchanged
+        xmlChar* url = xmlBuildURI(reinterpret_cast<const xmlChar*>(d.attr_data.c_str()), base);
+        if(url) {
+            d.attr_data = reinterpret_cast<const char*>(url);
+            xmlFree(url);
+        }
+    }
+    xmlFree(base);
+}
+
+//terminates a streaming parse, taking ownership of the resulting document
+void parser::finish_push(void)
+{
+    htmlParseChunk(push_ctxt, 0, 0, 1);
+    doc = push_ctxt->myDoc;
+    push_ctxt->myDoc = 0;
+    push_pending = false;
 }
 
 void parser::save_nodes(struct tagdb_s& param)
@@ -70,24 +460,55 @@ void parser::save_nodes(struct tagdb_s& param)
 
 void parser::parse(std::vector<struct tagdb_s>& param)
 {
+    parse_profile profile(param);
+    parse(profile);
+}
+
+void parser::parse(parse_profile& profile)
+{
+    if(push_pending)
+        finish_push();
+
+    //single pass already extracted everything
+    bool sax_done = (sax_profile == &profile);
+    if(sax_done && profile.links_only) {
+        scan_buffer.clear();
+        resolve_links();
+        return;
+    }
+    if(sax_done && !profile.needs_dom) {
+        resolve_links();
+        return;
+    }
+
     if(doc) {
         //succesfuly parsed
         dbg<<"doc valid\n";
-        xmlXPathContextPtr xpath_ctxt = xmlXPathNewContext(doc);
+        if(!xpath_ctxt) {
+            xpath_ctxt = xmlXPathNewContext(doc);
+        } else {
+            xpath_ctxt->doc = doc;
+            xpath_ctxt->node = 0;
+        }
+
         if(xpath_ctxt) {
             dbg_2<<"created xpath context, processing tags\n";
 
-            //parse xpath tags
-            for(auto& p: param) {
-                dbg_2<<"matching xpath ["<<p.xpath<<"]"<<std::endl;
+            //match precompiled xpath tags
+            for(unsigned int i = 0; i < profile.param.size(); ++i) {
+                if(!profile.expr[i] || (sax_done && profile.by_sax[i]))
+                    continue;
+                dbg_2<<"matching xpath ["<<profile.param[i].xpath<<"]"<<std::endl;
 
-                tags = xmlXPathEvalExpression(reinterpret_cast<const xmlChar*>(p.xpath.c_str()), xpath_ctxt);
-                if(!xmlXPathNodeSetIsEmpty(tags->nodesetval)) {
-                    save_nodes(p);
+                tags = xmlXPathCompiledEval(profile.expr[i], xpath_ctxt);
+                if(tags && !xmlXPathNodeSetIsEmpty(tags->nodesetval)) {
+                    save_nodes(profile.param[i]);
                 }
                 xmlXPathFreeObject(tags);
             }
-            xmlXPathFreeContext(xpath_ctxt);
+
+            find_base();
+            resolve_links();
         } else {
             //FIXME: raise exception
             std::cerr<<"Failed to create xpath_ctxt\n";
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <zdict.h>
+
+#include "record_compressor.hpp"
+#include "debug.hpp"
+
+//Local defines
+#define COMPRESSED_MAGIC    0x6365727a  //"zrec" on disk
+#define HEADER_SIZE         8           //magic and dictionary version
+
+//contexts are costly to create, each thread keeps its own
+struct zstd_contexts_s {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+
+    zstd_contexts_s(void)
+    {
+        cctx = ZSTD_createCCtx();
+        dctx = ZSTD_createDCtx();
+    }
+
+    ~zstd_contexts_s(void)
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+static thread_local zstd_contexts_s contexts;
+
+static void put32(char* p, uint32_t v)
+{
+    for(int i = 0; i < 4; ++i)
+        p[i] = (char)(v>>(i*8));
+}
+
+static uint32_t get32(const char* p)
+{
+    uint32_t v = 0;
+    for(int i = 0; i < 4; ++i)
+        v |= (uint32_t)(unsigned char)p[i]<<(i*8);
+    return v;
+}
+
+//writes @data to a new file at @path and fsyncs it
+static bool write_synced(const std::string& path, const std::string& data)
+{
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t n = write(fd, data.data()+done, data.size()-done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+
+    bool ok = done == data.size() && !fsync(fd);
+    close(fd);
+    return ok;
+}
+
+record_compressor::dictionary_s::~dictionary_s(void)
+{
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+}
+
+record_compressor::record_compressor(std::string p, int l)
+{
+    prefix = p;
+    level = l;
+    training = false;
+    executor = 0;
+    records = 0;
+    raw_bytes = 0;
+    stored_bytes = 0;
+
+    //versions are numbered from 1 without gaps
+    for(uint32_t version = 1; ; ++version) {
+        std::ifstream dict_file(dict_path(version), std::ios::binary);
+        if(!dict_file)
+            break;
+
+        std::stringstream ss;
+        ss<<dict_file.rdbuf();
+        std::shared_ptr<dictionary_s> d = make_dictionary(version, ss.str());
+        if(!d)
+            break;
+
+        dicts[version] = d;
+        current = d;
+    }
+
+    sampling = !current;
+    dbg<<"compressing ["<<prefix<<"] with dictionary "<<(current ? current->version : 0)<<"\n";
+}
+
+record_compressor::~record_compressor(void)
+{
+    std::unique_lock<std::mutex> lock(dict_lock);
+    trained.wait(lock, [this]() { return !training; });
+}
+
+void record_compressor::set_executor(io_executor* e)
+{
+    executor = e;
+}
+
+void record_compressor::compress(const std::string& in, std::string& out)
+{
+    std::shared_ptr<dictionary_s> dict;
+    std::shared_ptr<std::vector<std::string>> batch;
+    io_executor* e = executor;
+
+    dict_lock.lock();
+    dict = current;
+    if(sampling) {
+        samples.push_back(in);
+        if(samples.size() >= COMPRESS_TRAIN_SAMPLES) {
+            sampling = false;
+            batch = std::make_shared<std::vector<std::string>>();
+            batch->swap(samples);
+            training = (e != 0);
+        }
+    }
+    dict_lock.unlock();
+
+    if(batch && e) {
+        //this and later records go without until the dictionary is ready
+        e->submit([this, batch]()
+            {
+                train(*batch);
+
+                //under the lock, the destructor may be waiting to free it
+                std::lock_guard<std::mutex> lock(dict_lock);
+                training = false;
+                trained.notify_all();
+            });
+    } else if(batch && train(*batch)) {
+        //no executor, the record completing the sample pays for training
+        dict_lock.lock();
+        dict = current;
+        dict_lock.unlock();
+    }
+
+    size_t bound = ZSTD_compressBound(in.size());
+    size_t start = out.size();
+    out.resize(start+HEADER_SIZE+bound);
+
+    char* header = &out[start];
+    put32(header, COMPRESSED_MAGIC);
+    put32(header+4, dict ? dict->version : 0);
+
+    size_t n;
+    if(dict)
+        n = ZSTD_compress_usingCDict(contexts.cctx, header+HEADER_SIZE, bound, in.data(), in.size(), dict->cdict);
+    else
+        n = ZSTD_compressCCtx(contexts.cctx, header+HEADER_SIZE, bound, in.data(), in.size(), level);
+
+    if(ZSTD_isError(n) || HEADER_SIZE+n >= in.size()) {
+        out.resize(start);
+        out.append(in);
+    } else {
+        out.resize(start+HEADER_SIZE+n);
+    }
+
+    ++records;
+    raw_bytes += in.size();
+    stored_bytes += out.size()-start;
+}
+
+bool record_compressor::decompress(const char* data, size_t size, std::string& out) throw(db_exception)
+{
+    if(!is_compressed(data, size))
+        return false;
+
+    std::shared_ptr<dictionary_s> dict;
+    uint32_t version = get32(data+4);
+    if(version) {
+        dict_lock.lock();
+        auto d = dicts.find(version);
+        if(d != dicts.end())
+            dict = d->second;
+        dict_lock.unlock();
+
+        if(!dict) {
+            std::stringstream ss;
+            ss<<"missing compression dictionary "<<dict_path(version);
+            throw db_exception(ss.str());
+        }
+    }
+
+    const char* frame = data+HEADER_SIZE;
+    size_t frame_size = size-HEADER_SIZE;
+    unsigned long long len = ZSTD_getFrameContentSize(frame, frame_size);
+    if(len == ZSTD_CONTENTSIZE_ERROR || len == ZSTD_CONTENTSIZE_UNKNOWN)
+        throw db_exception("corrupt compressed record");
+
+    out.resize(len);
+    size_t n;
+    if(dict)
+        n = ZSTD_decompress_usingDDict(contexts.dctx, &out[0], len, frame, frame_size, dict->ddict);
+    else
+        n = ZSTD_decompressDCtx(contexts.dctx, &out[0], len, frame, frame_size);
+
+    if(ZSTD_isError(n) || n != len)
+        throw db_exception("failed to decompress record");
+
+    return true;
+}
+
+bool record_compressor::is_compressed(const char* data, size_t size)
+{
+    return size >= HEADER_SIZE && get32(data) == COMPRESSED_MAGIC;
+}
+
+bool record_compressor::train(std::vector<std::string>& batch)
+{
+    std::lock_guard<std::mutex> lock(train_lock);
+
+    std::string joined;
+    std::vector<size_t> sizes;
+    for(auto& s: batch) {
+        joined.append(s);
+        sizes.push_back(s.size());
+    }
+
+    std::string dict(COMPRESS_DICT_SIZE, 0);
+    size_t n = ZDICT_trainFromBuffer(&dict[0], dict.size(), joined.data(), sizes.data(), sizes.size());
+    if(ZDICT_isError(n)) {
+        std::cerr<<"failed to train dictionary for "<<prefix<<": "<<ZDICT_getErrorName(n)<<std::endl;
+        return false;
+    }
+    dict.resize(n);
+
+    dict_lock.lock();
+    uint32_t version = dicts.empty() ? 1 : dicts.rbegin()->first+1;
+    dict_lock.unlock();
+
+    //written before use, records must never name a dictionary we lost
+    std::string path = dict_path(version);
+    std::string tmp = path+".tmp";
+    if(!write_synced(tmp, dict) || rename(tmp.c_str(), path.c_str())) {
+        std::cerr<<"failed to save dictionary "<<path<<std::endl;
+        remove(tmp.c_str());
+        return false;
+    }
+
+    //the rename is only durable once the directory listing it is
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash+1);
+    int fd = open(dir.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && !fsync(fd);
+    if(fd >= 0)
+        close(fd);
+    if(!synced) {
+        std::cerr<<"failed to sync dictionary directory "<<dir<<std::endl;
+        return false;
+    }
+
+    std::shared_ptr<dictionary_s> d = make_dictionary(version, dict);
+    if(!d)
+        return false;
+
+    dict_lock.lock();
+    dicts[version] = d;
+    current = d;
+    dict_lock.unlock();
+
+    dbg<<"trained dictionary "<<version<<" of "<<n<<" bytes from "<<batch.size()<<" records\n";
+    return true;
+}
+
+struct compress_stats_s record_compressor::stats(void)
+{
+    struct compress_stats_s st;
+    st.records = records;
+    st.raw_bytes = raw_bytes;
+    st.stored_bytes = stored_bytes;
+
+    dict_lock.lock();
+    st.dictionary = current ? current->version : 0;
+    dict_lock.unlock();
+
+    return st;
+}
+
+std::string record_compressor::dict_path(uint32_t version)
+{
+    std::stringstream ss;
+    ss<<prefix<<"."<<version<<".dict";
+    return ss.str();
+}
+
+std::shared_ptr<record_compressor::dictionary_s> record_compressor::make_dictionary(uint32_t version, const std::string& dict)
+{
+    std::shared_ptr<dictionary_s> d = std::make_shared<dictionary_s>();
+    d->version = version;
+    d->cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+    d->ddict = ZSTD_createDDict(dict.data(), dict.size());
+
+    if(!d->cdict || !d->ddict) {
+        std::cerr<<"failed to load dictionary "<<dict_path(version)<<std::endl;
+        return std::shared_ptr<dictionary_s>();
+    }
+
+    return d;
+}
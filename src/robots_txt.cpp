@@ -302,3 +302,16 @@ bool robots_txt::is_locked(void)
 {
     return use_count > 0;
 }
+
+size_t robots_txt::footprint(void)
+{
+    size_t bytes = sizeof(*this) + agent_name.capacity() + domain.capacity() + sitemap_url.capacity();
+
+    bytes += (disallow_list.capacity() + allow_list.capacity())*sizeof(std::string);
+    for(auto& d: disallow_list)
+        bytes += d.capacity();
+    for(auto& a: allow_list)
+        bytes += a.capacity();
+
+    return bytes;
+}
@@ -1,18 +1,153 @@
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <fstream>
 
 #include "page_data.hpp"
 #include "cache.hpp"
 
-#define MAX_PAGES (2*CACHE_MAX)
+//budget the first test overflows, ~5k empty pages
+#define TEST_CACHE_BYTES    (1024*1024)
+#define MAX_PAGES           (20*1024)
+
+//thread scaling benchmark
+#define BENCH_KEYS      (5*1024)
+#define BENCH_OPS       200000  //get/put pairs per thread
+#define BENCH_THREADS   8       //doubled from 1 up to this
+
+//synthetic trace, used when no trace file is given: a skewed popular set
+//of pages interrupted by sweeps over one-off urls
+#define TRACE_CACHE_BYTES   (2*TEST_CACHE_BYTES)
+#define TRACE_HOT_KEYS  (40*1024)
+#define TRACE_ACCESSES  1000000
+#define TRACE_SCAN_LEN  (20*1024)
+#define TRACE_SCAN_GAP  100000  //accesses between sweeps
 
 using std::cout;
 using std::endl;
 
-int main(void)
+static std::string bench_url(int i)
+{
+    std::ostringstream oss;
+    oss<<"http://bench_url_"<<i<<".com/bench_page"<<i<<".html";
+    return oss.str();
+}
+
+//each thread repeatedly gets and puts back random pages, as crawler threads
+//sharing a memory_mgr do
+static void bench_thread(cache<page_data_c>* c, std::vector<std::string>* keys, unsigned int seed,
+                         std::atomic<unsigned long>* locked)
+{
+    std::minstd_rand rng(seed);
+    unsigned long busy = 0;
+
+    for(int i = 0; i < BENCH_OPS; ++i) {
+        std::string& key = (*keys)[rng()%keys->size()];
+        page_data_c* page;
+
+        switch(c->get_object(&page, key)) {
+        case cache_hit:
+            ++page->rank;
+            c->put_object(page, key);
+            break;
+
+        case cache_locked:
+            ++busy;
+            break;
+
+        case cache_miss:
+            page = new page_data_c;
+            if(c->add_object(&page, key) == cache_hit)
+                c->put_object(page, key);
+            else
+                ++busy;
+            break;
+        }
+    }
+
+    *locked += busy;
+}
+
+static void bench_scaling(void)
+{
+    cache<page_data_c> bench_cache;
+    std::vector<std::string> keys;
+
+    for(int i = 0; i < BENCH_KEYS; ++i) {
+        keys.push_back(bench_url(i));
+        bench_cache.put_object(new page_data_c, keys.back());
+    }
+
+    cout<<"\n~~~\nthread scaling, "<<BENCH_OPS<<" get/put per thread over "<<BENCH_KEYS<<" keys"<<endl;
+    for(int n = 1; n <= BENCH_THREADS; n *= 2) {
+        std::vector<std::thread> threads;
+        std::atomic<unsigned long> locked(0);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(int i = 0; i < n; ++i)
+            threads.push_back(std::thread(bench_thread, &bench_cache, &keys, i+1, &locked));
+        for(auto& t: threads)
+            t.join();
+        std::chrono::microseconds elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        double ops = (double)n*BENCH_OPS;
+        cout<<n<<" threads: "<<elapsed.count()/1000<<"ms, "
+            <<(unsigned long)(ops/elapsed.count()*1000000)<<" ops/s, "
+            <<locked<<" found locked"<<endl;
+    }
+}
+
+//replays @trace, reading each key and adding it on a miss as memory_mgr does
+static void replay(std::vector<std::string>& trace, cache_policy_e policy, const char* name)
+{
+    cache<page_data_c> c(policy, TRACE_CACHE_BYTES, 0);
+
+    for(auto& key: trace) {
+        page_data_c* page;
+        cache_result_e r = c.get_object(&page, key);
+
+        if(r == cache_miss) {
+            page = new page_data_c;
+            r = c.add_object(&page, key);
+        }
+        if(r == cache_hit)
+            c.put_object(page, key);
+    }
+
+    struct cache_stats_s st = c.stats();
+    cout<<name<<": hits "<<st.hits<<" misses "<<st.misses<<" hit ratio "
+        <<(100.0*st.hits/(st.hits+st.misses))<<"% evictions "<<st.evictions
+        <<" rejected "<<st.rejected<<endl;
+}
+
+static void synthetic_trace(std::vector<std::string>& trace)
 {
-    cache<page_data_c> test_cache;
+    std::minstd_rand rng(1);
+    std::vector<double> weights;
+    int scanned = 0;
+
+    //zipf(1) popularity over the hot set
+    for(int i = 0; i < TRACE_HOT_KEYS; ++i)
+        weights.push_back(1.0/(i+1));
+    std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+
+    for(int i = 0; i < TRACE_ACCESSES; ++i) {
+        if(i%TRACE_SCAN_GAP == TRACE_SCAN_GAP-1) {
+            for(int j = 0; j < TRACE_SCAN_LEN; ++j)
+                trace.push_back(bench_url(TRACE_HOT_KEYS + scanned++));
+        }
+        trace.push_back(bench_url(zipf(rng)));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    cache<page_data_c> test_cache(cache_lru, TEST_CACHE_BYTES, 0);
     std::ostringstream oss;
     int i;
 
@@ -40,8 +175,8 @@ int main(void)
     }
 
     //now any pages that have not make it to cache or have been kicked out
-    //have been deleted by the cache class, so we only need to delete
-    //the remaining.
+    //have been deleted by the cache class, the remaining are deleted with
+    //the cache.
     cout<<"\n~~~\ngetting "<<i<<" pages"<<endl;
     for(i = 0; i < MAX_PAGES; ++i) {
         //generate test url
@@ -51,14 +186,39 @@ int main(void)
 
         //retrieve test page
         page_data_c* get_test_page;
-        if(test_cache.get_object(&get_test_page, test_url)) {
+        if(test_cache.get_object(&get_test_page, test_url) == cache_hit) {
             cout<<"page "<<i<<" rank "<<get_test_page->rank<<endl;
             cout<<"page "<<i<<" description ["<<get_test_page->description<<"]\n"<<endl;
-            delete get_test_page;
+            test_cache.put_object(get_test_page, test_url);
         } else {
             cout<<"page "<<i<<" not in cache\n"<<endl;
         }
     }
 
+    //shrinking the budget live evicts down to it
+    struct cache_stats_s st = test_cache.stats();
+    cout<<"\n~~~\ncache holds "<<st.bytes<<" bytes of "<<TEST_CACHE_BYTES<<", resizing to "<<TEST_CACHE_BYTES/4<<endl;
+    test_cache.resize(TEST_CACHE_BYTES/4, 0);
+    st = test_cache.stats();
+    cout<<"cache now holds "<<st.bytes<<" bytes, "<<st.evictions<<" evictions"<<endl;
+
+    bench_scaling();
+
+    //policy comparison over a recorded trace, one key per line, or a
+    //synthetic one
+    std::vector<std::string> trace;
+    if(argc > 1) {
+        std::ifstream trace_file(argv[1]);
+        std::string key;
+        while(std::getline(trace_file, key))
+            trace.push_back(key);
+        cout<<"\n~~~\nreplaying "<<trace.size()<<" accesses from "<<argv[1]<<endl;
+    } else {
+        synthetic_trace(trace);
+        cout<<"\n~~~\nreplaying "<<trace.size()<<" synthetic accesses"<<endl;
+    }
+    replay(trace, cache_lru, "lru");
+    replay(trace, cache_tinylfu, "tinylfu");
+
     return 0;
 }
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "page_data.hpp"
+#include "page_record.hpp"
+#include "record_compressor.hpp"
+#include "io_executor.hpp"
+
+#define TEST_PREFIX     "test_db/compress_bench"
+#define TEST_SITES      50
+#define TEST_PAGES      10000
+#define TEST_LINKS      40
+
+using std::cout;
+using std::endl;
+
+//pages of one site share a host, a title prefix and keywords, as crawled ones do
+static std::string make_record(int i)
+{
+    page_data_c page;
+    std::stringstream ss;
+    int site = i%TEST_SITES;
+
+    ss<<"http://www.site"<<site<<".com/articles/"<<i<<"/page.html";
+    page.url = ss.str();
+    page.rank = i%100;
+    page.crawl_count = i%7;
+
+    ss.str("");
+    ss<<"Site "<<site<<" News | Article number "<<i;
+    page.title = ss.str();
+    ss.str("");
+    ss<<"Read the latest on site "<<site<<", article "<<i<<" covers the story in depth.";
+    page.description = ss.str();
+
+    for(int l = 0; l < TEST_LINKS; ++l) {
+        ss.str("");
+        if(l%4)
+            ss<<"http://www.site"<<site<<".com/articles/"<<(i*7+l)%5000<<"/page.html";
+        else
+            ss<<"http://www.site"<<(site+l)%TEST_SITES<<".com/";
+        page.out_links.push_back(ss.str());
+    }
+    page.meta = {"news", "articles", "site", "latest"};
+
+    std::string record;
+    encode_page_record(page, record);
+    return record;
+}
+
+static void print_result(const char* name, size_t raw, size_t stored, std::chrono::microseconds us, size_t n)
+{
+    cout<<name<<": "<<raw/n<<" -> "<<stored/n<<" bytes/record ("
+        <<(stored ? (double)raw/stored : 0)<<"x), "<<(double)us.count()/n<<"us/record"<<endl;
+}
+
+int main(void)
+{
+    //start without dictionaries
+    for(int v = 1; v < 16; ++v) {
+        std::stringstream ss;
+        ss<<TEST_PREFIX<<"."<<v<<".dict";
+        remove(ss.str().c_str());
+    }
+
+    std::vector<std::string> records;
+    for(int i = 0; i < COMPRESS_TRAIN_SAMPLES+TEST_PAGES; ++i)
+        records.push_back(make_record(i));
+
+    //dictionaries are trained in the background, as memory_mgr does
+    io_executor executor(1);
+    record_compressor compressor(TEST_PREFIX);
+    compressor.set_executor(&executor);
+    std::vector<std::string> stored(records.size());
+
+    //sampled records are compressed without a dictionary
+    size_t raw = 0, out = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < COMPRESS_TRAIN_SAMPLES-1; ++i) {
+        compressor.compress(records[i], stored[i]);
+        raw += records[i].size();
+        out += stored[i].size();
+    }
+    std::chrono::microseconds plain = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    print_result("no dictionary", raw, out, plain, COMPRESS_TRAIN_SAMPLES-1);
+
+    //the last sample starts training, but does not wait for it
+    start = std::chrono::steady_clock::now();
+    compressor.compress(records[COMPRESS_TRAIN_SAMPLES-1], stored[COMPRESS_TRAIN_SAMPLES-1]);
+    std::chrono::microseconds completing = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    cout<<"record completing the sample took "<<completing.count()<<"us"<<endl;
+    while(!compressor.stats().dictionary)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::chrono::milliseconds trained = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    cout<<"trained dictionary "<<compressor.stats().dictionary<<" in "<<trained.count()<<"ms"<<endl;
+
+    raw = 0;
+    out = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = COMPRESS_TRAIN_SAMPLES; i < records.size(); ++i) {
+        compressor.compress(records[i], stored[i]);
+        raw += records[i].size();
+        out += stored[i].size();
+    }
+    std::chrono::microseconds with_dict = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    print_result("dictionary", raw, out, with_dict, TEST_PAGES);
+
+    //every record, with or without dictionary, reads back
+    int mismatched = 0;
+    std::string record;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < records.size(); ++i) {
+        compressor.decompress(stored[i].data(), stored[i].size(), record);
+        if(record != records[i])
+            ++mismatched;
+    }
+    std::chrono::microseconds decoded = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    cout<<"decompress: "<<(double)decoded.count()/records.size()<<"us/record, mismatched "<<mismatched<<endl;
+
+    //a new instance finds the saved dictionary
+    record_compressor reopened(TEST_PREFIX);
+    reopened.decompress(stored.back().data(), stored.back().size(), record);
+    cout<<"reopened with dictionary "<<reopened.stats().dictionary<<": "
+        <<(record == records.back() ? "ok" : "MISMATCH")<<endl;
+
+    struct compress_stats_s st = compressor.stats();
+    cout<<"total "<<st.records<<" records "<<st.raw_bytes<<" -> "<<st.stored_bytes<<" bytes"<<endl;
+
+    cout<<"done!"<<endl;
+    return 0;
+}
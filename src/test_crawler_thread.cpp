@@ -1,13 +1,15 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
 #include <thread>   //this_thread::sleep_for
 #include <chrono>   //ditto
-#include <boost/asio.hpp>   //ipc_client()
 
 #include "crawler_thread.hpp"
 #include "netio.hpp"
 #include "page_data.hpp"
 #include "ipc_common.hpp"
+#include "memory_mgr.hpp"
+#include "host_table.hpp"
 
 //for testing only
 #include "dummy_server.hpp"
@@ -16,6 +18,7 @@ using std::cout;
 using std::endl;
 
 #define INITIAL_CREDIT 100
+#define CRAWLER_THREADS 2
 #define CRAWL_TIME std::chrono::seconds(30*60)
 
 //uut
@@ -30,10 +33,10 @@ static struct worker_config_s worker_cfg = {
     .user_agent = "test_ipc_client",
     .day_max_crawls = 5,
 
-    .page_cache_max = 10,
-    .page_cache_res = 2,
-    .robots_cache_max = 3,
-    .robots_cache_res = 1,
+    .page_cache_max = 64*1024,  //KiB
+    .page_cache_res = 4*1024,
+    .robots_cache_max = 8*1024,
+    .robots_cache_res = 512,
 
     .db_path = "test_db",
     .page_table = "page_table",
@@ -74,22 +77,59 @@ int main(void)
     srv.set_worker_config(worker_cfg);
     cout<<">done.\n";
 
-    cout<<">creating crawler_thread\n";
-    boost::asio::io_service io_service;
-    ipc_client test_ipc_client(ipc_cfg, io_service);
-    crawler_thread test_crawler(&test_ipc_client);
+    //storage shared by all crawler threads
+    mmgr_config page_mgr_cfg = {
+        .database_path = worker_cfg.db_path,
+        .object_table = worker_cfg.page_table,
+        .user_agent = worker_cfg.user_agent,
+        .cache_policy = cache_tinylfu,
+        .cache_max = (size_t)worker_cfg.page_cache_max*1024,
+        .cache_res = (size_t)worker_cfg.page_cache_res*1024
+    };
+    mmgr_config robots_mgr_cfg = {
+        .database_path = worker_cfg.db_path,
+        .object_table = worker_cfg.robots_table,
+        .user_agent = worker_cfg.user_agent,
+        .cache_policy = cache_tinylfu,
+        .cache_max = (size_t)worker_cfg.robots_cache_max*1024,
+        .cache_res = (size_t)worker_cfg.robots_cache_res*1024
+    };
+    memory_mgr<page_data_c> page_mgr(page_mgr_cfg);
+    memory_mgr<robots_txt> robots_mgr(robots_mgr_cfg);
+    host_table hosts;
+
+    cout<<">creating "<<CRAWLER_THREADS<<" crawler_threads\n";
+    ipc_client test_ipc_client(ipc_cfg);
+
+    //cache budgets follow the master's config
+    test_ipc_client.on_config([&](worker_config_s& c)
+        {
+            page_mgr.resize_cache((size_t)c.page_cache_max*1024, (size_t)c.page_cache_res*1024);
+            robots_mgr.resize_cache((size_t)c.robots_cache_max*1024, (size_t)c.robots_cache_res*1024);
+        });
+    std::vector<crawler_thread*> test_crawlers;
+    for(int i = 0; i < CRAWLER_THREADS; ++i)
+        test_crawlers.push_back(new crawler_thread(&test_ipc_client, &page_mgr, &robots_mgr, &hosts));
 
     cout<<">begin timed crawl\n";
-    test_crawler.start(worker_cfg);
+    for(auto& c: test_crawlers)
+        c->start(worker_cfg);
 
     //sleep for a bit, to let crawler do its thing
     std::this_thread::sleep_for(CRAWL_TIME);
 
-    cout<<">stopping crawler\n";
-    test_crawler.stop();
+    cout<<">stopping crawlers\n";
+    for(auto& c: test_crawlers)
+        c->stop();
 
-    //sleep for a bit, to let crawler finish its last task
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    //wait for each to finish its last task, before the storage it uses goes
+    for(auto& c: test_crawlers)
+        delete c;
+    test_crawlers.clear();
+
+    struct cache_stats_s page_stats = page_mgr.cache_stats();
+    cout<<">page cache hits "<<page_stats.hits<<" misses "<<page_stats.misses
+        <<" rejected "<<page_stats.rejected<<" bytes "<<page_stats.bytes<<endl;
     cout<<"\n\n>done.\n";
 
     return 0;
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "host_scheduler.hpp"
+#include "host_table.hpp"
+#include "ipc_common.hpp"
+
+using std::cout;
+using std::endl;
+
+#define TEST_HOSTS      4
+#define ITEMS_PER_HOST  3
+#define CRAWL_DELAY     std::chrono::milliseconds(200)
+
+int main(void)
+{
+    host_scheduler test_scheduler;
+
+    //one host dominates the queue, as happens with real crawls
+    cout<<"queueing "<<TEST_HOSTS*ITEMS_PER_HOST+10<<" items over "<<TEST_HOSTS<<" hosts"<<endl;
+    for(unsigned int i = 0; i < 10; ++i) {
+        std::string host = "http://big_host.com";
+        struct queue_node_s n = {.credit = i, .url = host+"/page"+std::to_string(i)};
+        test_scheduler.push(n, host);
+    }
+    for(unsigned int h = 0; h < TEST_HOSTS; ++h) {
+        for(unsigned int i = 0; i < ITEMS_PER_HOST; ++i) {
+            std::string host = "http://host_"+std::to_string(h)+".com";
+            struct queue_node_s n = {.credit = i, .url = host+"/page"+std::to_string(i)};
+            test_scheduler.push(n, host);
+        }
+    }
+
+    //every host gets a crawl delay after each item, the scheduler should
+    //keep handing out items from other hosts instead of waiting
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int sleeps = 0;
+    while(test_scheduler.size() > 0) {
+        struct queue_node_s item;
+        std::string host;
+        std::chrono::microseconds wait;
+
+        if(test_scheduler.pop(item, host, wait)) {
+            std::chrono::milliseconds t = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            cout<<t.count()<<"ms: ["<<item.url<<"]"<<endl;
+            test_scheduler.complete(host, std::chrono::steady_clock::now() + CRAWL_DELAY);
+        } else {
+            ++sleeps;
+            std::this_thread::sleep_for(wait);
+        }
+    }
+    cout<<"scheduler slept "<<sleeps<<" times"<<endl;
+
+    //a failing host without a crawl delay is still backed off
+    host_table test_hosts;
+    std::string host = "http://failing_host.com";
+    struct host_state_s& state = test_hosts.get(host);
+    test_hosts.begin_fetch(state);
+    test_hosts.end_fetch(state, false);
+    std::chrono::milliseconds backoff = std::chrono::duration_cast<std::chrono::milliseconds>(test_hosts.next_fetch(state) - std::chrono::steady_clock::now());
+    cout<<"failed host with no crawl delay backed off "<<backoff.count()<<"ms"<<endl;
+    test_hosts.release(host);
+
+    //without a crawl delay, threads racing for a host still fetch one at a time
+    std::string racy = "http://racy_host.com";
+    struct host_state_s& racy_state = test_hosts.get(racy);
+    std::atomic<unsigned int> fetching(0), overlaps(0), fetches(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> racers;
+    for(unsigned int t = 0; t < 8; ++t) {
+        racers.push_back(std::thread([&]() {
+            while(!go);
+            for(unsigned int i = 0; i < 10000; ++i) {
+                if(!test_hosts.begin_fetch(racy_state))
+                    continue;
+                if(++fetching > 1)
+                    ++overlaps;
+                ++fetches;
+                --fetching;
+                test_hosts.end_fetch(racy_state, true);
+            }
+        }));
+    }
+    go = true;
+    for(auto& r: racers)
+        r.join();
+    cout<<"racing threads made "<<fetches<<" fetches, "<<overlaps<<" overlapping"<<endl;
+    test_hosts.release(racy);
+
+    //hosts not in use and long idle are dropped, those in use are kept
+    std::string kept = "http://kept_host.com";
+    test_hosts.get(kept).crawl_delay = 7;
+    for(unsigned int i = 0; i < HOST_TABLE_SHARDS*HOST_PRUNE_INTERVAL; ++i) {
+        std::string h = "http://idle_host_"+std::to_string(i)+".com";
+        test_hosts.get(h);
+        test_hosts.release(h);
+    }
+    cout<<"host table holds "<<test_hosts.size()<<" of "<<HOST_TABLE_SHARDS*HOST_PRUNE_INTERVAL+2<<" hosts seen"<<endl;
+    test_hosts.release(kept);
+    cout<<"host in use "<<(test_hosts.get(kept).crawl_delay == 7 ? "kept" : "DROPPED")<<endl;
+    test_hosts.release(kept);
+
+    cout<<"done"<<endl;
+    return 0;
+}
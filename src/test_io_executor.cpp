@@ -0,0 +1,103 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <atomic>
+
+#include "io_executor.hpp"
+#include "file_db.hpp"
+#include "page_data.hpp"
+
+#define TEST_PAGES      4000
+#define TEST_THREADS    {1, 4, 8, 16}
+
+using std::cout;
+using std::endl;
+
+static void free_pages(std::vector<page_data_c*>& pages)
+{
+    for(auto p: pages)
+        delete p;
+    pages.clear();
+}
+
+int main(void)
+{
+    //plain tasks, destruction runs everything submitted
+    std::atomic<int> ran(0);
+    {
+        io_executor executor(4);
+        for(int i = 0; i < 1000; ++i)
+            executor.submit([&ran]{ ++ran; });
+    }
+    cout<<"executor ran "<<ran<<"/1000 tasks"<<endl;
+
+    database<page_data_c> page_db("test_db", "page_table");
+    std::vector<std::string> keys;
+    std::vector<page_data_c*> pages;
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        std::stringstream ss;
+        ss<<"http://test_io_"<<i<<".com/page.html";
+        keys.push_back(ss.str());
+
+        page_data_c* page = new page_data_c;
+        page->url = ss.str();
+        page->crawl_count = i;
+        page->out_links.assign(20, ss.str());
+        pages.push_back(page);
+    }
+
+    //one request at a time, as the crawler threads used to
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i)
+        page_db.put_object(pages[i], keys[i]);
+    std::chrono::milliseconds put_one = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    cout<<"sequential put: "<<put_one.count()<<"ms"<<endl;
+
+    std::vector<page_data_c*> read(TEST_PAGES);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        read[i] = new page_data_c;
+        page_db.get_object(read[i], keys[i]);
+    }
+    std::chrono::milliseconds get_one = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    cout<<"sequential get: "<<get_one.count()<<"ms"<<endl;
+    free_pages(read);
+
+    for(unsigned int threads: TEST_THREADS) {
+        io_executor executor(threads);
+        page_db.set_executor(&executor);
+
+        start = std::chrono::steady_clock::now();
+        page_db.put_many(pages, keys).get();
+        std::chrono::milliseconds put_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        read.clear();
+        for(int i = 0; i < TEST_PAGES; ++i)
+            read.push_back(new page_data_c);
+
+        start = std::chrono::steady_clock::now();
+        std::future<void> done = page_db.get_many(read, keys);
+        //the caller is free until it needs the objects
+        done.get();
+        std::chrono::milliseconds get_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        int mismatched = 0;
+        for(int i = 0; i < TEST_PAGES; ++i) {
+            if(read[i]->crawl_count != (unsigned int)i || read[i]->url != keys[i])
+                ++mismatched;
+        }
+        free_pages(read);
+
+        cout<<threads<<" threads: put_many "<<put_ms.count()<<"ms get_many "<<get_ms.count()
+            <<"ms, mismatched "<<mismatched<<endl;
+        page_db.set_executor(0);
+    }
+
+    for(int i = 0; i < TEST_PAGES; ++i)
+        page_db.delete_object(keys[i]);
+    free_pages(pages);
+
+    cout<<"done!"<<endl;
+    return 0;
+}
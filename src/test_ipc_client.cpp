@@ -1,5 +1,9 @@
 #include <iostream>
-#include <boost/asio.hpp>   //ipc_client()
+#include <chrono>
+#include <thread>
+#include <future>
+#include <vector>
+#include <atomic>
 
 #include "ipc_common.hpp"
 #include "ipc_client.hpp"
@@ -13,11 +17,14 @@ using std::cerr;
 using std::endl;
 
 #define GET_SEND_LOOPS  2048
+#define BENCH_NODES     20000
+#define BENCH_REQUESTS  2000
+#define SHARED_THREADS  8
 
 //uut
 static struct ipc_config_s test_cfg = {
     .gbuff_min = 2,
-    .sbuff_max = 2,
+    .sbuff_max = 256,
     .sc = 2,
     .master_address = "127.0.0.1"
 };
@@ -34,6 +41,87 @@ static struct worker_config_s worker_test_cfg = {
     .db_path = "no db"
 };
 
+//sends BENCH_NODES, flushing every @batch, and waits for the server to have
+//them all. returns nodes/s
+static double send_nodes(ipc_client& client, dummy_server& srv, unsigned int batch)
+{
+    unsigned long expected = srv.received_nodes()+BENCH_NODES;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(unsigned int i = 0; i < BENCH_NODES; ++i) {
+        struct queue_node_s n = {.credit = i, .url = "http://bench_node.com/some/discovered/link.html"};
+        client.send_item(n);
+        if(batch && (i+1)%batch == 0)
+            client.flush();
+    }
+    client.flush();
+
+    while(srv.received_nodes() < expected)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+    double s = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()/1e6;
+    return BENCH_NODES/s;
+}
+
+//BENCH_REQUESTS config requests, one round trip at a time or all in flight
+//at once. returns requests/s
+static double request_configs(ipc_client& client, bool pipelined, unsigned int& mismatched)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<struct worker_config_s> configs;
+    if(pipelined) {
+        std::vector<std::future<struct worker_config_s>> replies;
+        for(unsigned int i = 0; i < BENCH_REQUESTS; ++i)
+            replies.push_back(client.request_config());
+        for(auto& r: replies)
+            configs.push_back(r.get());
+    } else {
+        for(unsigned int i = 0; i < BENCH_REQUESTS; ++i)
+            configs.push_back(client.get_config());
+    }
+
+    double s = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()/1e6;
+    for(auto& c: configs) {
+        if(c.user_agent != worker_test_cfg.user_agent || c.robots_cache_max != worker_test_cfg.robots_cache_max)
+            ++mismatched;
+    }
+    return BENCH_REQUESTS/s;
+}
+
+//SHARED_THREADS crawler threads sending BENCH_NODES between them and each
+//asking for config, all over the one connection. returns nodes/s
+static double shared_client(ipc_client& client, dummy_server& srv, unsigned int& mismatched)
+{
+    unsigned long expected = srv.received_nodes()+BENCH_NODES;
+    std::atomic<unsigned int> bad(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for(unsigned int t = 0; t < SHARED_THREADS; ++t) {
+        threads.push_back(std::thread([&client, &bad, t]()
+            {
+                std::future<struct worker_config_s> cfg = client.request_config();
+                for(unsigned int i = t; i < BENCH_NODES; i += SHARED_THREADS) {
+                    struct queue_node_s n = {.credit = i, .url = "http://shared_node.com/some/discovered/link.html"};
+                    client.send_item(n);
+                }
+                if(cfg.get().user_agent != worker_test_cfg.user_agent)
+                    ++bad;
+            }));
+    }
+    for(auto& t: threads)
+        t.join();
+    client.flush();
+
+    while(srv.received_nodes() < expected)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+    double s = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()/1e6;
+    mismatched += bad;
+    return BENCH_NODES/s;
+}
+
 int main(void)
 {
     cout<<">initialising test_server\n";
@@ -41,8 +129,7 @@ int main(void)
     srv.set_worker_config(worker_test_cfg);
 
     cout<<">initialising test_client\n";
-    boost::asio::io_service io_service;
-    ipc_client test_client(test_cfg, io_service);
+    ipc_client test_client(test_cfg);
 
     cout<<">pre-seeing "<<test_cfg.gbuff_min<<" queue_node_s to buffer\n";
     for(unsigned int i = 0; i< test_cfg.gbuff_min; ++i) {
@@ -60,6 +147,8 @@ int main(void)
         struct queue_node_s test_node = {.url = "test_url", .credit = i};
         cout<<"\n"<<i<<">SEND\n>sending test node, url=["<<test_node.url<<"] credit=["<<test_node.credit<<"]\n";
         test_client.send_item(test_node);
+        //must reach master before we ask for it back
+        test_client.flush();
 
         //reinitialise test node = reset data
         struct queue_node_s get_node;
@@ -69,5 +158,35 @@ int main(void)
         cout<<">test_node url=["<<get_node.url<<"] credit=["<<get_node.credit<<"]\n";
     }
     cout<<"\n---\n>done.\n";
+
+    //try_get_item() takes only what is buffered, never waiting on master
+    struct queue_node_s try_node;
+    unsigned int buffered = 0;
+    while(test_client.try_get_item(try_node))
+        ++buffered;
+    try_node.url = "try_url";
+    try_node.credit = 1;
+    test_client.send_item(try_node);
+    test_client.flush();
+    unsigned int empty_polls = 0;
+    while(!test_client.try_get_item(try_node)) {
+        ++empty_polls;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    cout<<">try_get_item took "<<buffered<<" buffered, then url=["<<try_node.url<<"] after "<<empty_polls<<" empty polls\n";
+
+    //a message per node, as send_item() used to, against batches of sbuff_max
+    cout<<">sending "<<BENCH_NODES<<" nodes to server\n";
+    cout<<">one per message: "<<(unsigned long)send_nodes(test_client, srv, 1)<<" nodes/s\n";
+    cout<<">batched by "<<test_cfg.sbuff_max<<": "<<(unsigned long)send_nodes(test_client, srv, 0)<<" nodes/s\n";
+
+    //replies are matched to requests by id, so they need not be waited on in turn
+    unsigned int mismatched = 0;
+    cout<<">requesting config "<<BENCH_REQUESTS<<" times\n";
+    cout<<">one at a time: "<<(unsigned long)request_configs(test_client, false, mismatched)<<" requests/s\n";
+    cout<<">pipelined: "<<(unsigned long)request_configs(test_client, true, mismatched)<<" requests/s\n";
+    cout<<">"<<SHARED_THREADS<<" threads sharing the client: "<<(unsigned long)shared_client(test_client, srv, mismatched)<<" nodes/s\n";
+    cout<<">mismatched replies: "<<mismatched<<"\n";
+
     return 0;
 }
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <fstream>
+#include <streambuf>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <curl/curl.h>  //CURL_MAX_WRITE_SIZE
+
+#include "parser.hpp"
+#include "link_scan.hpp"
+#include "ipc_common.hpp"
+
+using std::cout;
+using std::endl;
+
+//passes over the corpus per benchmark
+#define BENCH_RUNS 100
+
+//feeds @page to a streaming parser in netio sized chunks
+static unsigned int stream_parse(std::string& page, parse_profile& profile)
+{
+    parser p("http://www.xmlsoft.org/", profile);
+    for(size_t pos = 0; pos < page.size(); pos += CURL_MAX_WRITE_SIZE)
+        p.parse_chunk(page.data()+pos, std::min<size_t>(CURL_MAX_WRITE_SIZE, page.size()-pos));
+    p.parse(profile);
+
+    return p.data.size();
+}
+
+//usage: test_link_scan [saved pages..], defaults to test_file.html
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> corpus;
+    size_t corpus_size = 0;
+
+    for(int i = 1; i < argc || (argc == 1 && i == 1); ++i) {
+        std::ifstream file((argc > 1)?argv[i]:"test_file.html");
+        std::string web_page((std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+        corpus_size += web_page.size();
+        corpus.push_back(web_page);
+    }
+    cout<<"loaded "<<corpus.size()<<" pages, "<<corpus_size<<" bytes"<<endl;
+
+    std::vector<struct tagdb_s> parse_param;
+    struct tagdb_s param;
+    param.tag_type = tag_type_url;
+    param.xpath = "//a[@href]";
+    param.attr = "href";
+    parse_param.push_back(param);
+
+    parse_profile profile(parse_param);
+    cout<<"profile is links only: "<<profile.links_only<<endl;
+
+    //links found by each path should agree
+    for(auto& page: corpus) {
+        parser dom_parser(page, "http://www.xmlsoft.org/");
+        dom_parser.parse(profile);
+        cout<<"dom links: "<<dom_parser.data.size()<<" scanned links: "<<stream_parse(page, profile)<<endl;
+    }
+
+    cout<<"benchmarking "<<BENCH_RUNS<<" corpus passes"<<endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_RUNS; ++i) {
+        for(auto& page: corpus) {
+            parser dom_parser(page, "http://www.xmlsoft.org/");
+            dom_parser.parse(profile);
+        }
+    }
+    std::chrono::microseconds dom = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_RUNS; ++i) {
+        for(auto& page: corpus)
+            stream_parse(page, profile);
+    }
+    std::chrono::microseconds scan = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    double mbytes = static_cast<double>(corpus_size)*BENCH_RUNS/(1024*1024);
+    cout<<"parser::parse (dom + xpath): "<<mbytes/(dom.count()/1e6)<<" MB/s"<<endl;
+    cout<<"link scan: "<<mbytes/(scan.count()/1e6)<<" MB/s"<<endl;
+
+    cout<<"done"<<endl;
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+
+#include "log_db.hpp"
+#include "page_data.hpp"
+
+//small segments, so that updates leave some to compact
+#define TEST_SEGMENT_MAX    (1024*1024)
+#define TEST_PAGES          10000
+#define TEST_ROUNDS         3
+
+using std::cout;
+using std::endl;
+
+static std::string test_url(int i)
+{
+    std::stringstream ss;
+    ss<<"http://test_url_"<<i<<".com/?test_page"<<i<<".html";
+    return ss.str();
+}
+
+static void print_stats(log_database<page_data_c>& db)
+{
+    struct log_stats_s st = db.log_stats();
+    cout<<"keys "<<st.keys<<" segments "<<st.segments<<" bytes "<<st.bytes
+        <<" dead "<<st.dead_bytes<<" compactions "<<st.compactions<<endl;
+}
+
+//counts pages which read back as last written
+static int check_pages(log_database<page_data_c>& db)
+{
+    int good = 0;
+
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        std::string url = test_url(i);
+        page_data_c* page = new page_data_c;
+        db.get_object(page, url);
+
+        if(i%10 == 0) {
+            //deleted
+            if(page->url.empty())
+                ++good;
+        } else if(page->url == url && page->crawl_count == TEST_ROUNDS) {
+            ++good;
+        }
+        delete page;
+    }
+
+    return good;
+}
+
+int main(void)
+{
+    log_database<page_data_c>* page_db = new log_database<page_data_c>("test_db", "page_log", TEST_SEGMENT_MAX);
+    page_data_c* read_page = new page_data_c;
+    page_data_c* write_page = new page_data_c;
+
+    std::string url = "http://test_url.com/a_test_page.html";
+
+    //round trip
+    write_page->rank = 42;
+    write_page->crawl_count = 2;
+    write_page->last_crawl = std::chrono::system_clock::now();
+    write_page->out_links = {"link 1", "link 2", "link 3", "link 4"};
+    write_page->url = url;
+    write_page->title = "page title";
+    write_page->description = "multi-line description for\ntest page generated by test_log_db.cpp";
+    write_page->meta = {"some", "keywords", "for", "testing"};
+
+    cout<<"sending page to database.."<<endl;
+    page_db->put_object(write_page, url);
+
+    cout<<"reading from database.."<<endl;
+    page_db->get_object(read_page, url);
+    cout<<"page url: "<<read_page->url<<endl;
+    cout<<"page rank: "<<read_page->rank<<endl;
+    cout<<"crawl count: "<<read_page->crawl_count<<endl;
+    cout<<"page title: "<<read_page->title<<endl;
+    cout<<"description: ["<<read_page->description<<"]"<<endl;
+
+    page_db->delete_object(url);
+    delete read_page;
+    read_page = new page_data_c;
+    page_db->get_object(read_page, url);
+    cout<<"after delete, url: ["<<read_page->url<<"]"<<endl;
+    delete read_page;
+    delete write_page;
+
+    //every page rewritten each round, leaving earlier segments dead
+    cout<<"\n---\nwriting "<<TEST_PAGES<<" pages "<<TEST_ROUNDS<<" times"<<endl;
+    auto start = std::chrono::steady_clock::now();
+    for(int n = 1; n <= TEST_ROUNDS; ++n) {
+        for(int i = 0; i < TEST_PAGES; ++i) {
+            url = test_url(i);
+            page_data_c* page = new page_data_c;
+            page->url = url;
+            page->crawl_count = n;
+            page->title = "test page";
+            page_db->put_object(page, url);
+            delete page;
+        }
+    }
+    for(int i = 0; i < TEST_PAGES; i += 10) {
+        url = test_url(i);
+        page_db->delete_object(url);
+    }
+    cout<<"took "<<std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now()-start).count()<<"ms"<<endl;
+    print_stats(*page_db);
+
+    cout<<"compacted "<<page_db->compact()<<" segments"<<endl;
+    print_stats(*page_db);
+    cout<<"pages read back: "<<check_pages(*page_db)<<"/"<<TEST_PAGES<<endl;
+
+    //index is rebuilt from hint files
+    delete page_db;
+    start = std::chrono::steady_clock::now();
+    page_db = new log_database<page_data_c>("test_db", "page_log", TEST_SEGMENT_MAX);
+    cout<<"\n---\nreopened in "<<std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now()-start).count()<<"us"<<endl;
+    print_stats(*page_db);
+    cout<<"pages read back: "<<check_pages(*page_db)<<"/"<<TEST_PAGES<<endl;
+
+    struct db_filter_stats_s fs = page_db->filter_stats();
+    cout<<"lookups "<<fs.lookups<<" absent "<<fs.skipped<<" collisions "<<fs.false_positives<<endl;
+
+    cout<<"\n~~~\ndone!"<<endl;
+    delete page_db;
+    return 0;
+}
@@ -10,19 +10,46 @@
 using std::cout;
 using std::endl;
 
-int main(void)
+//pages created, enough to overflow the cache so that evictions write back
+#define MAX_RUNS        (20*1024)
+#define TEST_CACHE_MAX  (1024*1024)
+//times the last TEST_REPUTS pages are put again, to coalesce in cache
+#define TEST_REPUTS     100
+#define REPUT_COUNT     10
+
+int main(int argc, char* argv[])
 {
     //memory_mgr configuration
     mmgr_config config = {
         .database_path = "./test_db/",
         .object_table = "page_table",
-        .user_agent = "test_mem_mgr"
+        .user_agent = "test_mem_mgr",
+        .cache_policy = cache_lru,
+        .cache_max = TEST_CACHE_MAX,
+        .cache_res = 0,
+        .flush_interval = 1000,
+        .max_dirty = TEST_CACHE_MAX/2,
+        .db_type = db_file,
+        .compress = false,
+        .expected_keys = MAX_RUNS
     };
 
+    //"test_memory_mgr [log] [compress] [durable]" for the log structured
+    //engine, compressed records or a write-ahead logged file engine
+    for(int i = 1; i < argc; ++i) {
+        std::string opt = argv[i];
+        if(opt == "log")
+            config.db_type = db_log;
+        else if(opt == "compress")
+            config.compress = true;
+        else if(opt == "durable")
+            config.durable = true;
+    }
+
     memory_mgr<page_data_c> test_mgr(config);
     page_data_c* test_page;
     
-    int max_runs = CACHE_MAX*2;
+    int max_runs = MAX_RUNS;
 
     //fill cache&db
     cout<<"creating "<<max_runs<<" pages"<<endl;
@@ -80,10 +107,42 @@ int main(void)
         //free memory - this page will not be put back to memory_mgr for deletion
         //to preserve the ending memory structure after the generating stage.
         //
-        //real applications should put pages back..
-        test_mgr.put_object_nblk(test_page, test_url);
+        //real applications should put pages back.. unmodified pages are not
+        //written again.
+        test_mgr.put_object_nblk(test_page, test_url, false);
         cout<<"~~~"<<endl;
     }
 
+    //repeated updates of cached pages, written back once per flush
+    cout<<"updating "<<TEST_REPUTS<<" pages "<<REPUT_COUNT<<" times"<<endl;
+    for(int n = 0; n < REPUT_COUNT; ++n) {
+        for(int i = max_runs-TEST_REPUTS; i < max_runs; ++i) {
+            std::stringstream ss;
+            ss<<"http://test_url_"<<i<<".com/?test_page"<<i<<".html";
+            std::string test_url = ss.str();
+
+            test_page = test_mgr.get_object_nblk(test_url);
+            ++test_page->crawl_count;
+            test_mgr.put_object_nblk(test_page, test_url);
+        }
+    }
+
+    struct mmgr_stats_s st = test_mgr.write_stats();
+    cout<<"puts "<<st.puts<<" (modified "<<st.dirty_puts<<") database writes "<<st.writes
+        <<", saved "<<st.puts-st.writes<<endl;
+
+    //new pages are never looked up on disk
+    struct db_filter_stats_s fs = test_mgr.db_stats();
+    cout<<"database lookups "<<fs.lookups<<" skipped by filter "<<fs.skipped
+        <<" false positives "<<fs.false_positives;
+    if(fs.skipped+fs.false_positives)
+        cout<<" ("<<100.0*fs.false_positives/(fs.skipped+fs.false_positives)<<"%)";
+    cout<<endl;
+
+    struct compress_stats_s cs = test_mgr.compress_stats();
+    if(cs.records)
+        cout<<"compressed "<<cs.records<<" records "<<cs.raw_bytes<<" -> "<<cs.stored_bytes
+            <<" bytes, dictionary "<<cs.dictionary<<endl;
+
     cout<<"done!"<<endl;
 }
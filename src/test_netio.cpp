@@ -1,5 +1,7 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <chrono>
 
 #include "netio.hpp"
 
@@ -19,6 +21,31 @@ int main(void)
     if(stream != 0)
         stream<<web_page<<std::endl;
 
+    //async engine, all pages in flight at once
+    std::vector<std::string> urls = {
+        "http://www.xmlsoft.org/",
+        "http://www.xmlsoft.org/news.html",
+        "http://curl.haxx.se/",
+        "http://curl.haxx.se/libcurl/"
+    };
+    unsigned int completed = 0;
+
+    std::cout<<"async fetching "<<urls.size()<<" pages"<<std::endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(auto& u: urls) {
+        my_netio.fetch_async(u, [&completed](std::string& url, std::string& data, bool ok)
+            {
+                if(ok)
+                    std::cout<<"fetched ["<<url<<"] "<<data.size()<<" bytes"<<std::endl;
+                else
+                    std::cout<<"failed to fetch ["<<url<<"]: "<<data<<std::endl;
+                ++completed;
+            });
+    }
+    my_netio.run();
+    std::chrono::milliseconds elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout<<completed<<" async fetches completed in "<<elapsed.count()<<"ms"<<std::endl;
+
     std::cout<<"done"<<std::endl;
     return 0;
 }
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+
+#include "page_data.hpp"
+#include "page_record.hpp"
+#include "record_codec.hpp"
+
+#define TEST_PAGES      20000
+#define TEST_LINKS      40
+#define TEST_META       8
+
+using std::cout;
+using std::endl;
+
+static page_data_c* make_page(int i)
+{
+    page_data_c* page = new page_data_c;
+    std::stringstream ss;
+
+    ss<<"http://test_url_"<<i<<".com/?test_page"<<i<<".html";
+    page->url = ss.str();
+    page->rank = i%100;
+    page->crawl_count = i%7;
+    page->title = "test page title, with some utf-8 \xc3\xa9\xc3\xa8";
+    page->description = "a couple of sentences describing the page, as taken from its "
+        "meta description tag or the first paragraph of text found in it.";
+    for(int l = 0; l < TEST_LINKS; ++l) {
+        ss.str("");
+        ss<<"http://linked_"<<(i+l)%1000<<".com/path/to/page"<<l<<".html";
+        page->out_links.push_back(ss.str());
+    }
+    for(int m = 0; m < TEST_META; ++m) {
+        ss.str("");
+        ss<<"keyword"<<m;
+        page->meta.push_back(ss.str());
+    }
+
+    return page;
+}
+
+static bool same_page(page_data_c* a, page_data_c* b)
+{
+    return a->url == b->url && a->rank == b->rank && a->crawl_count == b->crawl_count &&
+        a->last_crawl == b->last_crawl && a->title == b->title &&
+        a->description == b->description && a->out_links == b->out_links && a->meta == b->meta;
+}
+
+int main(void)
+{
+    std::vector<page_data_c*> pages;
+    for(int i = 0; i < TEST_PAGES; ++i)
+        pages.push_back(make_page(i));
+
+    std::vector<std::string> archives(TEST_PAGES), records(TEST_PAGES);
+    size_t archive_bytes = 0, record_bytes = 0;
+
+    //encode
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        boost_codec<page_data_c>::encode(pages[i], archives[i]);
+        archive_bytes += archives[i].size();
+    }
+    std::chrono::microseconds archive_enc = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        record_codec<page_data_c>::encode(pages[i], records[i]);
+        record_bytes += records[i].size();
+    }
+    std::chrono::microseconds record_enc = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    //decode
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i)
+        delete boost_codec<page_data_c>::decode(archives[i].data(), archives[i].size());
+    std::chrono::microseconds archive_dec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    int mismatched = 0;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        page_data_c* page = record_codec<page_data_c>::decode(records[i].data(), records[i].size());
+        if(!same_page(page, pages[i]))
+            ++mismatched;
+        delete page;
+    }
+    std::chrono::microseconds record_dec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    //the fields a scheduler looks at, without building a page
+    unsigned long crawls = 0;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TEST_PAGES; ++i) {
+        page_view view(records[i].data(), records[i].size());
+        crawls += view.crawl_count() + view.url().size;
+    }
+    std::chrono::microseconds view_read = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    //old pages are still readable
+    page_data_c* old = record_codec<page_data_c>::decode(archives[0].data(), archives[0].size());
+    cout<<"boost archive read through record_codec: "<<(same_page(old, pages[0]) ? "ok" : "MISMATCH")<<endl;
+    delete old;
+
+    //truncated records are refused
+    page_view cut(records[0].data(), records[0].size()/2);
+    cout<<"truncated record valid: "<<cut.valid()<<endl;
+
+    cout<<"pages: "<<TEST_PAGES<<" mismatched: "<<mismatched<<" ("<<crawls<<")"<<endl;
+    cout<<"boost archive: "<<archive_bytes/TEST_PAGES<<" bytes/page, encode "<<archive_enc.count()
+        <<"us decode "<<archive_dec.count()<<"us"<<endl;
+    cout<<"page record:   "<<record_bytes/TEST_PAGES<<" bytes/page, encode "<<record_enc.count()
+        <<"us decode "<<record_dec.count()<<"us view "<<view_read.count()<<"us"<<endl;
+
+    for(auto p: pages)
+        delete p;
+
+    cout<<"done!"<<endl;
+    return 0;
+}
@@ -2,6 +2,9 @@
 #include <fstream>
 #include <streambuf>
 #include <vector>
+#include <chrono>
+#include <algorithm>
+#include <curl/curl.h>  //CURL_MAX_WRITE_SIZE
 
 #include "parser.hpp"
 #include "ipc_common.hpp"
@@ -9,6 +12,9 @@
 using std::cout;
 using std::endl;
 
+//pages parsed per xpath benchmark run
+#define BENCH_RUNS 1000
+
 int main(void)
 {
     cout<<"loading test page"<<endl;
@@ -16,11 +22,11 @@ int main(void)
     std::string web_page;
 
     file.seekg(0, std::ios::end);
-    //~ web_page.reserve(file.tellg());
+    web_page.reserve(file.tellg());
     file.seekg(0, std::ios::beg);
 
-    //~ web_page.assign((std::istreambuf_iterator<char>(file)),
-        //~ std::istreambuf_iterator<char>());
+    web_page.assign((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
 
     //html tags to look for
     cout<<"creating parser config"<<endl;
@@ -44,7 +50,7 @@ int main(void)
 
     //create parser
     cout<<"initialising parser"<<endl;
-    parser test_parser("http://www.xmlsoft.org/");
+    parser test_parser(web_page, "http://www.xmlsoft.org/");
 
     cout<<"parsing"<<endl;
     //try catch block here
@@ -62,6 +68,51 @@ int main(void)
         ++i;
     }
 
+    //benchmark per-page xpath compile against a precompiled profile. Both
+    //runs reuse the same document so only xpath work is measured
+    cout<<"benchmarking "<<BENCH_RUNS<<" xpath passes"<<endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(i = 0; i < BENCH_RUNS; ++i) {
+        test_parser.data.clear();
+        test_parser.parse(parse_param);
+    }
+    std::chrono::microseconds per_page_compile = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    parse_profile profile(parse_param);
+    start = std::chrono::steady_clock::now();
+    for(i = 0; i < BENCH_RUNS; ++i) {
+        test_parser.data.clear();
+        test_parser.parse(profile);
+    }
+    std::chrono::microseconds precompiled = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    cout<<"compiled per page: "<<per_page_compile.count()/BENCH_RUNS<<"us/page"<<endl;
+    cout<<"precompiled: "<<precompiled.count()/BENCH_RUNS<<"us/page"<<endl;
+
+    //single pass sax extraction, page fed in netio sized chunks. Unlike
+    //the runs above this includes parsing the html itself
+    cout<<"benchmarking "<<BENCH_RUNS<<" single pass sax parses"<<endl;
+    unsigned int sax_nodes = 0;
+    start = std::chrono::steady_clock::now();
+    for(i = 0; i < BENCH_RUNS; ++i) {
+        parser sax_parser("http://www.xmlsoft.org/", profile);
+        for(size_t pos = 0; pos < web_page.size(); pos += CURL_MAX_WRITE_SIZE)
+            sax_parser.parse_chunk(web_page.data()+pos, std::min<size_t>(CURL_MAX_WRITE_SIZE, web_page.size()-pos));
+        sax_parser.parse(profile);
+        sax_nodes = sax_parser.data.size();
+    }
+    std::chrono::microseconds sax = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+    for(i = 0; i < BENCH_RUNS; ++i) {
+        parser dom_parser(web_page, "http://www.xmlsoft.org/");
+        dom_parser.parse(profile);
+    }
+    std::chrono::microseconds dom = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    cout<<"dom + xpath: "<<test_parser.data.size()<<" nodes, "<<dom.count()/BENCH_RUNS<<"us/page"<<endl;
+    cout<<"single pass sax: "<<sax_nodes<<" nodes, "<<sax.count()/BENCH_RUNS<<"us/page"<<endl;
+
     cout<<"done"<<endl;
     return 0;
 }
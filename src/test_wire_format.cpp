@@ -0,0 +1,161 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/string.hpp>
+
+#include "ipc_common.hpp"
+#include "wire_format.hpp"
+
+#define TEST_MESSAGES   20000
+#define TEST_BATCH      256
+
+using std::cout;
+using std::endl;
+
+//header connection used to archive before each payload
+struct archive_header_s {
+    data_type_e data_type;
+    std::size_t data_size;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & data_type;
+        ar & data_size;
+    }
+};
+
+//a message sent and received the way connection did, returns its size
+template<typename T> size_t archive_message(const T& t, T& out)
+{
+    std::ostringstream data_oss;
+    {
+        boost::archive::binary_oarchive arch(data_oss);
+        arch<<t;
+    }
+    std::string data = data_oss.str();
+
+    struct archive_header_s header = {dt_queue_node, data.size()};
+    std::ostringstream header_oss;
+    {
+        boost::archive::binary_oarchive arch(header_oss);
+        arch<<header;
+    }
+    std::string raw_header = header_oss.str();
+
+    {
+        std::istringstream iss(raw_header);
+        boost::archive::binary_iarchive arch(iss);
+        arch>>header;
+    }
+    std::istringstream iss(data);
+    boost::archive::binary_iarchive arch(iss);
+    arch>>out;
+
+    return raw_header.size()+data.size();
+}
+
+//as connection does now, buffers kept between messages
+template<typename T> size_t wire_message(const T& t, T& out, std::string& data)
+{
+    char raw_header[WIRE_HEADER_SIZE];
+
+    data.clear();
+    wire_encode(data, t);
+    struct wire_header_s header = {WIRE_VERSION, dt_queue_node, 0, (uint32_t)data.size(), 0};
+    wire_put_header(raw_header, header);
+
+    wire_get_header(raw_header, header);
+    wire_reader in(data.data(), header.length);
+    wire_decode(in, out);
+
+    return WIRE_HEADER_SIZE+data.size();
+}
+
+template<typename T> void bench(const char* name, const T& t, int messages)
+{
+    T out;
+    std::string data;
+    size_t bytes = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < messages; ++i)
+        bytes = archive_message(t, out);
+    long long archive_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    cout<<name<<" archive: "<<bytes<<" bytes, "<<(long long)messages*1000000/(archive_us ? archive_us : 1)<<" msgs/s"<<endl;
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < messages; ++i)
+        bytes = wire_message(t, out, data);
+    long long wire_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    cout<<name<<" wire: "<<bytes<<" bytes, "<<(long long)messages*1000000/(wire_us ? wire_us : 1)<<" msgs/s"<<endl;
+}
+
+static struct queue_node_s make_node(int i)
+{
+    std::stringstream ss;
+    ss<<"http://www.site"<<i%50<<".com/articles/"<<i<<"/page.html";
+
+    struct queue_node_s n;
+    n.credit = i;
+    n.url = ss.str();
+    return n;
+}
+
+int main(void)
+{
+    struct queue_node_s node = make_node(1234);
+    std::vector<struct queue_node_s> nodes;
+    for(int i = 0; i < TEST_BATCH; ++i)
+        nodes.push_back(make_node(i));
+
+    struct worker_config_s cfg = worker_config_s();
+    cfg.user_agent = "test_crawler/1.0";
+    cfg.day_max_crawls = 5;
+    cfg.worker_id = 3;
+    cfg.page_cache_max = 64*1024;
+    cfg.page_cache_res = 4*1024;
+    cfg.robots_cache_max = 16*1024;
+    cfg.robots_cache_res = 1024;
+    cfg.db_path = "test_db";
+    cfg.page_table = "page_table";
+    cfg.robots_table = "robots_table";
+    cfg.parse_param = {{tag_type_url, "//a", "href"}, {tag_type_title, "//title", ""},
+                       {tag_type_meta, "//meta[@name='keywords']", "content"}};
+
+    bench("queue_node_s", node, TEST_MESSAGES);
+    bench("256 nodes", nodes, TEST_MESSAGES/TEST_BATCH);
+    bench("worker_config_s", cfg, TEST_MESSAGES);
+
+    //payloads read back as sent
+    struct queue_node_s n;
+    std::vector<struct queue_node_s> ns;
+    struct worker_config_s c;
+    std::string data;
+    wire_message(node, n, data);
+    wire_message(nodes, ns, data);
+    wire_message(cfg, c, data);
+    bool same = n.url == node.url && n.credit == node.credit && ns.size() == nodes.size() &&
+        ns.back().url == nodes.back().url && c.user_agent == cfg.user_agent &&
+        c.robots_cache_res == cfg.robots_cache_res && c.parse_param.size() == cfg.parse_param.size() &&
+        c.parse_param[2].xpath == cfg.parse_param[2].xpath;
+    cout<<"round trip: "<<(same ? "ok" : "MISMATCH")<<endl;
+
+    //a truncated payload is rejected, not read past
+    data.clear();
+    wire_encode(data, cfg);
+    try {
+        wire_reader in(data.data(), data.size()/2);
+        wire_decode(in, c);
+        cout<<"truncated: accepted"<<endl;
+    } catch(wire_exception& e) {
+        cout<<"truncated: "<<e.what()<<endl;
+    }
+
+    cout<<"done!"<<endl;
+    return 0;
+}
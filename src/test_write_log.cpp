@@ -0,0 +1,229 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "file_db.hpp"
+#include "page_data.hpp"
+
+#define TEST_TABLE      "page_table"
+#define TEST_THREADS    16
+#define TEST_PAGES      2000
+#define CRASH_PAGES     5000
+
+using std::cout;
+using std::endl;
+
+static std::string test_url(int i)
+{
+    std::stringstream ss;
+    ss<<"http://test_wal_"<<i<<".com/page.html";
+    return ss.str();
+}
+
+//TEST_PAGES puts spread over TEST_THREADS writers, as memory_mgr flushes
+static void put_pages(database<page_data_c>& db, unsigned int count)
+{
+    std::vector<std::thread> writers;
+    for(int w = 0; w < TEST_THREADS; ++w) {
+        writers.push_back(std::thread([&db, w, count]() {
+            page_data_c* page = new page_data_c;
+            page->crawl_count = count;
+            for(int i = w; i < TEST_PAGES; i += TEST_THREADS) {
+                std::string key = test_url(i);
+                page->url = key;
+                page->out_links.assign(20, key);
+                db.put_object(page, key);
+            }
+            delete page;
+        }));
+    }
+    for(auto& w: writers)
+        w.join();
+}
+
+static int count_mismatched(database<page_data_c>& db, int pages, unsigned int count)
+{
+    int mismatched = 0;
+    for(int i = 0; i < pages; ++i) {
+        page_data_c* page = new page_data_c;
+        std::string key = test_url(i);
+        db.get_object(page, key);
+        if(page->crawl_count != count || page->url != key)
+            ++mismatched;
+        delete page;
+    }
+    return mismatched;
+}
+
+//a regular file in place of the table, so every write fails, even as root
+static void break_table(void)
+{
+    rename("test_db/" TEST_TABLE, "test_db/" TEST_TABLE ".moved");
+    std::ofstream("test_db/" TEST_TABLE);
+}
+
+static void restore_table(void)
+{
+    remove("test_db/" TEST_TABLE);
+    rename("test_db/" TEST_TABLE ".moved", "test_db/" TEST_TABLE);
+}
+
+//times from @start until now
+static void print_wal(const char* name, database<page_data_c>& db, std::chrono::steady_clock::time_point start)
+{
+    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    struct wal_stats_s st = db.wal_stats();
+    cout<<name<<": "<<ms.count()<<"ms, "<<st.records<<" records in "<<st.commits<<" commits ("
+        <<(st.commits ? st.records/st.commits : 0)<<" per fsync)"<<endl;
+}
+
+int main(void)
+{
+    //in place writes, neither durable nor logged
+    {
+        database<page_data_c> db("test_db", TEST_TABLE);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        put_pages(db, 1);
+        std::chrono::milliseconds in_place = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        cout<<"in place: "<<in_place.count()<<"ms"<<endl;
+    }
+
+    //a failed in place write is reported, for write behind to retry
+    {
+        database<page_data_c> db("test_db", TEST_TABLE);
+        break_table();
+        page_data_c* page = new page_data_c;
+        std::string key = test_url(0);
+        page->url = key;
+        try {
+            db.put_object(page, key);
+            cout<<"broken table put: accepted"<<endl;
+        } catch(db_exception& e) {
+            cout<<"broken table put: "<<e.what()<<endl;
+        }
+        delete page;
+    }
+    restore_table();
+
+    //a commit, so an fsync, per put
+    {
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true, 0, 1);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        put_pages(db, 2);
+        print_wal("fsync per put", db, start);
+    }
+
+    //concurrent puts grouped
+    {
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        put_pages(db, 3);
+        print_wal("group commit", db, start);
+
+        //logged records read back before they reach their files
+        cout<<"read back mismatched "<<count_mismatched(db, TEST_PAGES, 3)<<endl;
+    }
+
+    //a worker killed with records logged but not applied
+    pid_t pid = fork();
+    if(pid == 0) {
+        database<page_data_c>* db = new database<page_data_c>("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        page_data_c* page = new page_data_c;
+        page->crawl_count = 4;
+        for(int i = 0; i < CRASH_PAGES; ++i) {
+            std::string key = test_url(i);
+            page->url = key;
+            page->out_links.assign(20, key);
+            db->put_object(page, key);
+        }
+        //no destructors, whatever is still in the log stays there
+        _exit(0);
+    }
+    waitpid(pid, 0, 0);
+
+    {
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        struct wal_stats_s st = db.wal_stats();
+        cout<<"replayed "<<st.replayed<<" records in "<<st.replay_ms<<"ms"<<endl;
+        cout<<"after crash mismatched "<<count_mismatched(db, CRASH_PAGES, 4)<<endl;
+
+        for(int i = 0; i < CRASH_PAGES; ++i) {
+            std::string key = test_url(i);
+            db.delete_object(key);
+        }
+    }
+
+    //records failing to apply are kept, across a restart too
+    {
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        break_table();
+        put_pages(db, 5);
+        cout<<"failing read back mismatched "<<count_mismatched(db, TEST_PAGES, 5)<<endl;
+    }
+    restore_table();
+
+    {
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        struct wal_stats_s st = db.wal_stats();
+        cout<<"kept log replayed "<<st.replayed<<" records, "<<st.apply_failures<<" failed"<<endl;
+        cout<<"after kept log mismatched "<<count_mismatched(db, TEST_PAGES, 5)<<endl;
+
+        //and retried whilst running, once the store is back
+        break_table();
+        put_pages(db, 6);
+        restore_table();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while(db.wal_stats().applied < TEST_PAGES && std::chrono::steady_clock::now() - start < std::chrono::milliseconds(10*WAL_RETRY_INTERVAL))
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        st = db.wal_stats();
+        cout<<"retried "<<st.applied<<" of "<<TEST_PAGES<<" records, "<<st.apply_failures<<" failures"<<endl;
+    }
+
+    {
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        cout<<"after retry replayed "<<db.wal_stats().replayed<<", mismatched "
+            <<count_mismatched(db, TEST_PAGES, 6)<<endl;
+    }
+
+    //a flush's batch logged at once, rather than a put per executor thread
+    {
+        io_executor executor;
+        database<page_data_c> db("test_db", TEST_TABLE, DB_FILTER_KEYS, false, true);
+        db.set_executor(&executor);
+
+        std::vector<page_data_c*> pages;
+        std::vector<std::string> keys;
+        for(int i = 0; i < TEST_PAGES; ++i) {
+            keys.push_back(test_url(i));
+            page_data_c* page = new page_data_c;
+            page->url = keys.back();
+            page->crawl_count = 7;
+            page->out_links.assign(20, keys.back());
+            pages.push_back(page);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        db.put_many(pages, keys).get();
+        print_wal("put_many", db, start);
+        cout<<"put_many read back mismatched "<<count_mismatched(db, TEST_PAGES, 7)<<endl;
+
+        for(auto page: pages)
+            delete page;
+
+        for(int i = 0; i < TEST_PAGES; ++i) {
+            std::string key = test_url(i);
+            db.delete_object(key);
+        }
+    }
+
+    cout<<"done!"<<endl;
+    return 0;
+}
@@ -2,9 +2,13 @@
 #include <chrono>
 #include <fstream>
 #include <sstream>
+#include <cstdlib>
 #include <boost/archive/binary_iarchive.hpp>
 
 #include "page_data.hpp"
+#include "page_record.hpp"
+#include "mapped_file.hpp"
+#include "record_compressor.hpp"
 
 using std::cout;
 using std::endl;
@@ -29,6 +33,53 @@ int main(int argc, char* argv[])
         cout<<"---"<<endl;
 
         //iterate through all given pages. try to retrieve and dump each one
+        mapped_file file(argv[i]);
+        const char* data = file.data();
+        size_t size = file.size();
+
+        //dictionaries are kept beside the table directory
+        std::string record;
+        if(file.is_open() && record_compressor::is_compressed(data, size)) {
+            char* abs_path = realpath(argv[i], 0);
+            std::string path = abs_path ? abs_path : argv[i];
+            free(abs_path);
+            std::string table = path.substr(0, path.find_last_of('/'));
+            record_compressor compressor(table);
+            try {
+                compressor.decompress(data, size, record);
+            } catch(std::exception& e) {
+                cout<<e.what()<<endl;
+                continue;
+            }
+            data = record.data();
+            size = record.size();
+        }
+
+        if(file.is_open() && is_page_record(data, size)) {
+            //read in place
+            page_view page(data, size);
+            if(!page.valid()) {
+                cout<<"corrupt page record"<<endl;
+                continue;
+            }
+
+            cout<<"url: ["<<page.url()<<"]"<<endl;
+            cout<<"rank: ["<<page.rank()<<"]"<<endl;
+            cout<<"crawl count: ["<<page.crawl_count()<<"]"<<endl;
+            cout<<"last crawl: ["<<std::chrono::system_clock::to_time_t(page.last_crawl())<<"]"<<endl;
+            cout<<"title: ["<<page.title()<<"]"<<endl;
+            cout<<"description: ["<<page.description()<<"]"<<endl;
+            cout<<"out links:"<<endl;
+            for(auto x: page.out_links())
+                cout<<"\t"<<x<<endl;
+            cout<<"\nmeta:"<<endl;
+            for(auto x: page.meta())
+                cout<<"\t"<<x<<endl;
+            cout<<"\n----"<<endl;
+            continue;
+        }
+
+        //pages stored before page records
         std::ifstream file_data(argv[i]);
         if(file_data) {
             page_data_c page;
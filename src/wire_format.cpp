@@ -0,0 +1,210 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "wire_format.hpp"
+#include "ipc_common.hpp"
+#include "debug.hpp"
+
+//Local defines
+#define MAX_VARINT      10
+
+static void put_fixed(char* out, uint64_t v, int bytes)
+{
+    for(int i = 0; i < bytes; ++i)
+        out[i] = (char)(v>>(i*8));
+}
+
+static uint64_t get_fixed(const char* p, int bytes)
+{
+    uint64_t v = 0;
+    for(int i = 0; i < bytes; ++i)
+        v |= (uint64_t)(unsigned char)p[i]<<(i*8);
+    return v;
+}
+
+static void put_varint(std::string& out, uint64_t v)
+{
+    while(v >= 0x80) {
+        out.push_back((char)(v|0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static void put_string(std::string& out, const std::string& s)
+{
+    put_varint(out, s.size());
+    out.append(s);
+}
+
+void wire_put_header(char* out, const struct wire_header_s& h)
+{
+    put_fixed(out, h.version, 1);
+    put_fixed(out+1, h.type, 1);
+    put_fixed(out+2, h.flags, 2);
+    put_fixed(out+4, h.length, 4);
+    put_fixed(out+8, h.request_id, 8);
+}
+
+bool wire_get_header(const char* in, struct wire_header_s& h)
+{
+    h.version = get_fixed(in, 1);
+    h.type = get_fixed(in+1, 1);
+    h.flags = get_fixed(in+2, 2);
+    h.length = get_fixed(in+4, 4);
+    h.request_id = get_fixed(in+8, 8);
+
+    return h.version == WIRE_VERSION;
+}
+
+wire_reader::wire_reader(const char* data, size_t size)
+{
+    pos = data;
+    end = data+size;
+}
+
+uint64_t wire_reader::varint(void) throw(wire_exception)
+{
+    uint64_t v = 0;
+    for(int i = 0; i < MAX_VARINT && pos < end; ++i) {
+        unsigned char b = *pos++;
+        v |= (uint64_t)(b & 0x7f)<<(i*7);
+        if(!(b & 0x80))
+            return v;
+    }
+    throw wire_exception("truncated varint in message");
+}
+
+void wire_reader::string(std::string& s) throw(wire_exception)
+{
+    uint64_t len = varint();
+    if(len > (uint64_t)(end-pos))
+        throw wire_exception("truncated string in message");
+
+    s.assign(pos, len);
+    pos += len;
+}
+
+//
+// encoders, fields in declaration order
+void wire_encode(std::string& out, unsigned int v)
+{
+    put_varint(out, v);
+}
+
+void wire_encode(std::string& out, ctrl_instruction_e v)
+{
+    put_varint(out, v);
+}
+
+void wire_encode(std::string& out, worker_status_e v)
+{
+    put_varint(out, v);
+}
+
+void wire_encode(std::string& out, const struct worker_capabilities_s& c)
+{
+    put_varint(out, c.parsers);
+    put_varint(out, c.total_threads);
+}
+
+void wire_encode(std::string& out, const struct worker_config_s& c)
+{
+    put_string(out, c.user_agent);
+    put_varint(out, c.day_max_crawls);
+    put_varint(out, c.worker_id);
+    put_varint(out, c.page_cache_max);
+    put_varint(out, c.page_cache_res);
+    put_varint(out, c.robots_cache_max);
+    put_varint(out, c.robots_cache_res);
+    put_string(out, c.db_path);
+    put_string(out, c.page_table);
+    put_string(out, c.robots_table);
+
+    put_varint(out, c.parse_param.size());
+    for(auto& t: c.parse_param) {
+        put_varint(out, t.tag_type);
+        put_string(out, t.xpath);
+        put_string(out, t.attr);
+    }
+}
+
+void wire_encode(std::string& out, const struct queue_node_s& n)
+{
+    put_varint(out, n.credit);
+    put_string(out, n.url);
+}
+
+void wire_encode(std::string& out, const std::vector<struct queue_node_s>& nodes)
+{
+    put_varint(out, nodes.size());
+    for(auto& n: nodes)
+        wire_encode(out, n);
+}
+
+//
+// decoders
+void wire_decode(wire_reader& in, unsigned int& v)
+{
+    v = in.varint();
+}
+
+void wire_decode(wire_reader& in, ctrl_instruction_e& v)
+{
+    v = (ctrl_instruction_e)in.varint();
+}
+
+void wire_decode(wire_reader& in, worker_status_e& v)
+{
+    v = (worker_status_e)in.varint();
+}
+
+void wire_decode(wire_reader& in, struct worker_capabilities_s& c)
+{
+    c.parsers = in.varint();
+    c.total_threads = in.varint();
+}
+
+void wire_decode(wire_reader& in, struct worker_config_s& c)
+{
+    in.string(c.user_agent);
+    c.day_max_crawls = in.varint();
+    c.worker_id = in.varint();
+    c.page_cache_max = in.varint();
+    c.page_cache_res = in.varint();
+    c.robots_cache_max = in.varint();
+    c.robots_cache_res = in.varint();
+    in.string(c.db_path);
+    in.string(c.page_table);
+    in.string(c.robots_table);
+
+    //not reserved, a bogus count runs out of payload first
+    uint64_t count = in.varint();
+    c.parse_param.clear();
+    for(uint64_t i = 0; i < count; ++i) {
+        struct tagdb_s t;
+        t.tag_type = (tag_type_e)in.varint();
+        in.string(t.xpath);
+        in.string(t.attr);
+        c.parse_param.push_back(t);
+    }
+}
+
+void wire_decode(wire_reader& in, struct queue_node_s& n)
+{
+    n.credit = in.varint();
+    in.string(n.url);
+}
+
+void wire_decode(wire_reader& in, std::vector<struct queue_node_s>& nodes)
+{
+    uint64_t count = in.varint();
+    nodes.clear();
+    for(uint64_t i = 0; i < count; ++i) {
+        struct queue_node_s n;
+        wire_decode(in, n);
+        nodes.push_back(n);
+    }
+}
@@ -0,0 +1,531 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "write_log.hpp"
+#include "io_executor.hpp"
+#include "mapped_file.hpp"
+#include "debug.hpp"
+
+//Local defines
+#define WAL_TOMBSTONE   1
+
+//on disk record header, followed by key then record
+struct wal_record_s {
+    uint32_t checksum;      //of everything after this field
+    uint32_t flags;
+    uint32_t key_size;
+    uint32_t record_size;
+};
+
+#define CHECKED_OFFSET  sizeof(uint32_t)
+
+//FNV-1a, as log_store
+static uint32_t checksum(const char* data, size_t len)
+{
+    uint32_t h = 0x811c9dc5;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)data[i];
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+static bool write_all(int fd, const char* buf, size_t len, uint64_t offset)
+{
+    while(len) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+write_log::write_log(std::string path, apply_handler apply_fn, sync_handler sync_fn,
+    unsigned int window, unsigned int batch, unsigned int replay_threads) throw(db_exception)
+{
+    dir = path;
+    commit_window = window;
+    commit_batch = batch ? batch : WAL_COMMIT_BATCH;
+    apply = apply_fn;
+    sync = sync_fn;
+    fd = -1;
+    file = 0;
+    file_size = 0;
+    next_seq = 0;
+    commit_stopping = false;
+    apply_stopping = false;
+    st = wal_stats_s();
+
+    if(mkdir(dir.c_str(), 0755) && errno != EEXIST)
+        throw db_exception("failed to create log directory: "+dir);
+
+    DIR* d = opendir(dir.c_str());
+    if(!d)
+        throw db_exception("failed to open log directory: "+dir);
+
+    //log files are named by sequence number, oldest first
+    std::vector<uint32_t> ids;
+    struct dirent* ent;
+    while((ent = readdir(d)) != 0) {
+        char* end;
+        unsigned long id = strtoul(ent->d_name, &end, 10);
+        if(end != ent->d_name && !strcmp(end, ".log"))
+            ids.push_back((uint32_t)id);
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+
+    //replay may keep the old files
+    oldest = ids.empty() ? 1 : ids.back()+1;
+    if(!ids.empty())
+        replay(ids, replay_threads);
+    open_file(ids.empty() ? 1 : ids.back()+1);
+
+    commit_thread = std::thread(&write_log::committer, this);
+    apply_thread = std::thread(&write_log::applier, this);
+}
+
+write_log::~write_log(void)
+{
+    //committer drains the queue first, then the applier what it committed
+    log_lock.lock();
+    commit_stopping = true;
+    log_lock.unlock();
+    commit_cv.notify_one();
+    commit_thread.join();
+
+    log_lock.lock();
+    apply_stopping = true;
+    log_lock.unlock();
+    apply_cv.notify_one();
+    apply_thread.join();
+
+    //everything is in the store, once synced the log is not needed
+    close(fd);
+    if(!unapplied.empty() || !sync()) {
+        std::cerr<<"keeping write log "<<dir<<", not all of it reached the store"<<std::endl;
+        return;
+    }
+    for(uint32_t id = oldest; id <= file; ++id)
+        ::remove(file_path(id).c_str());
+    sync_dir();
+}
+
+void write_log::append(std::string& key, const std::string& record) throw(db_exception)
+{
+    std::vector<commit_s> records = {{0, 0, key, record, 0, 0}};
+    enqueue(records);
+}
+
+void write_log::append_many(std::vector<std::string>& keys, std::vector<std::string>& records) throw(db_exception)
+{
+    std::vector<commit_s> batch;
+    batch.reserve(keys.size());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        commit_s c = {0, 0, keys[i], std::move(records[i]), 0, 0};
+        batch.push_back(std::move(c));
+    }
+
+    if(!batch.empty())
+        enqueue(batch);
+}
+
+void write_log::remove(std::string& key) throw(db_exception)
+{
+    std::vector<commit_s> records = {{0, WAL_TOMBSTONE, key, "", 0, 0}};
+    enqueue(records);
+}
+
+bool write_log::lookup(std::string& key, std::string& record, bool& deleted)
+{
+    std::lock_guard<std::mutex> lock(log_lock);
+
+    auto it = pending.find(key);
+    if(it == pending.end())
+        return false;
+
+    record = it->second.record;
+    deleted = it->second.deleted;
+    return true;
+}
+
+struct wal_stats_s write_log::stats(void)
+{
+    std::lock_guard<std::mutex> lock(log_lock);
+    return st;
+}
+
+std::string write_log::file_path(uint32_t id)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%08u.log", id);
+    return dir+"/"+name;
+}
+
+//only called by the committer, or before it starts
+void write_log::open_file(uint32_t id) throw(db_exception)
+{
+    std::string path = file_path(id);
+    int f = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(f < 0)
+        throw db_exception("failed to open log file: "+path);
+
+    //the previous file was synced with its last commit
+    if(fd >= 0)
+        close(fd);
+    fd = f;
+    file = id;
+    file_size = 0;
+
+    //records committed to a file the directory does not list are lost
+    sync_dir();
+}
+
+void write_log::sync_dir(void)
+{
+    int d = open(dir.c_str(), O_RDONLY);
+    if(d < 0 || fsync(d))
+        std::cerr<<"failed to sync log directory "<<dir<<std::endl;
+    if(d >= 0)
+        close(d);
+}
+
+//queues @records for the next commits, then waits for all of them
+void write_log::enqueue(std::vector<commit_s>& records) throw(db_exception)
+{
+    size_t waiting = records.size();
+    bool failed = false;
+
+    std::unique_lock<std::mutex> lock(log_lock);
+    if(commit_stopping)
+        throw db_exception("write log closed: "+dir);
+
+    bool opens = queue.empty();
+    for(auto& c: records) {
+        c.seq = ++next_seq;
+        c.waiting = &waiting;
+        c.failed = &failed;
+        queue.push_back(std::move(c));
+    }
+
+    //the first record opens the commit window, a full batch closes it
+    if(opens || queue.size() >= commit_batch)
+        commit_cv.notify_one();
+
+    done_cv.wait(lock, [&waiting]{ return waiting == 0; });
+    if(failed)
+        throw db_exception("failed to commit to write log: "+dir);
+}
+
+//appends @batch to the log file with one write and one fsync, committer
+//only. Returns the bytes written, 0 if it failed
+size_t write_log::write_batch(std::vector<commit_s>& batch)
+{
+    size_t len = 0;
+    for(auto& c: batch)
+        len += sizeof(wal_record_s)+c.key.size()+c.record.size();
+
+    if(file_size && file_size+len > WAL_FILE_MAX) {
+        try {
+            open_file(file+1);
+        } catch(db_exception& e) {
+            std::cerr<<e.what()<<std::endl;
+            return 0;
+        }
+    }
+
+    std::string buf(len, 0);
+    size_t offset = 0;
+    for(auto& c: batch) {
+        wal_record_s r = {0, c.flags, (uint32_t)c.key.size(), (uint32_t)c.record.size()};
+        size_t rec_len = sizeof(r)+c.key.size()+c.record.size();
+
+        memcpy(&buf[offset], &r, sizeof(r));
+        memcpy(&buf[offset+sizeof(r)], c.key.data(), c.key.size());
+        memcpy(&buf[offset+sizeof(r)+c.key.size()], c.record.data(), c.record.size());
+        r.checksum = checksum(buf.data()+offset+CHECKED_OFFSET, rec_len-CHECKED_OFFSET);
+        memcpy(&buf[offset], &r.checksum, sizeof(r.checksum));
+
+        offset += rec_len;
+    }
+
+    //a failed commit is overwritten by the next one
+    if(!write_all(fd, buf.data(), len, file_size) || fdatasync(fd)) {
+        std::cerr<<"failed to commit "<<batch.size()<<" records to "<<file_path(file)<<std::endl;
+        return 0;
+    }
+    file_size += len;
+
+    return len;
+}
+
+//applies the latest record of each key left in log files @ids, then
+//removes them
+void write_log::replay(std::vector<uint32_t>& ids, unsigned int threads)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_map<std::string, pending_s> latest;
+    unsigned long records = 0;
+
+    for(auto id: ids) {
+        mapped_file log_file(file_path(id));
+        if(!log_file.is_open())
+            continue;
+
+        const char* data = log_file.data();
+        size_t size = log_file.size();
+        size_t offset = 0;
+        while(offset+sizeof(wal_record_s) <= size) {
+            wal_record_s r;
+            memcpy(&r, data+offset, sizeof(r));
+
+            uint64_t len = sizeof(r)+(uint64_t)r.key_size+r.record_size;
+            if(offset+len > size || r.checksum != checksum(data+offset+CHECKED_OFFSET, len-CHECKED_OFFSET))
+                break;
+
+            pending_s& p = latest[std::string(data+offset+sizeof(r), r.key_size)];
+            p.seq = ++records;
+            p.deleted = r.flags & WAL_TOMBSTONE;
+            p.record.assign(data+offset+sizeof(r)+r.key_size, r.record_size);
+            offset += len;
+        }
+
+        //whatever follows was being committed when we died, never acknowledged
+        if(offset != size)
+            std::cerr<<"dropping "<<size-offset<<" bytes of torn records from "<<file_path(id)<<std::endl;
+    }
+
+    //keys are independent, each is applied once on its own
+    std::mutex failed_lock;
+    std::vector<std::string> failed;
+    {
+        io_executor executor(threads);
+        std::vector<std::function<void()>> tasks;
+        for(auto& l: latest) {
+            tasks.push_back([this, &l, &failed_lock, &failed]() {
+                std::string key = l.first;
+                if(!apply(key, l.second.record, l.second.deleted)) {
+                    std::lock_guard<std::mutex> lock(failed_lock);
+                    failed.push_back(key);
+                }
+            });
+        }
+        executor.submit_many(tasks);
+    }
+
+    //records not in the store are retried by the applier, and the files
+    //kept until they are
+    for(auto& key: failed) {
+        pending_s& p = pending[key];
+        p = latest[key];
+        p.seq = ++next_seq;
+
+        unapplied_s u = {ids.front(), p.seq, key};
+        unapplied.push_back(u);
+    }
+    st.apply_failures = failed.size();
+
+    if(failed.empty() && sync()) {
+        for(auto id: ids)
+            ::remove(file_path(id).c_str());
+        sync_dir();
+    } else {
+        std::cerr<<"keeping "<<ids.size()<<" replayed log files, "<<failed.size()<<" records failed to apply"<<std::endl;
+        oldest = ids.front();
+    }
+
+    st.replayed = records;
+    st.replay_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-start).count();
+    dbg<<"replayed "<<records<<" records, "<<latest.size()<<" keys from "<<ids.size()
+       <<" log files in "<<st.replay_ms<<"ms\n";
+}
+
+//background thread grouping queued records into commits
+void write_log::committer(void)
+{
+    std::unique_lock<std::mutex> lock(log_lock);
+
+    while(true) {
+        commit_cv.wait(lock, [this]{ return commit_stopping || !queue.empty(); });
+        if(queue.empty())
+            break;
+
+        //give concurrent writers the window to join this commit
+        commit_cv.wait_for(lock, std::chrono::microseconds(commit_window),
+            [this]{ return commit_stopping || queue.size() >= commit_batch; });
+
+        size_t n = std::min(queue.size(), (size_t)commit_batch);
+        std::vector<commit_s> batch(std::make_move_iterator(queue.begin()),
+                                    std::make_move_iterator(queue.begin()+n));
+        queue.erase(queue.begin(), queue.begin()+n);
+        lock.unlock();
+
+        size_t written = write_batch(batch);
+        bool ok = written != 0;
+
+        lock.lock();
+        for(auto& c: batch) {
+            --*c.waiting;
+            if(!ok)
+                *c.failed = true;
+        }
+        done_cv.notify_all();
+
+        if(!ok)
+            continue;
+
+        ++st.commits;
+        st.records += n;
+        st.bytes += written;
+
+        //readable from here until applied
+        batch_s b;
+        b.file = file;
+        for(auto& c: batch) {
+            pending_s& p = pending[c.key];
+            p.seq = c.seq;
+            p.deleted = c.flags & WAL_TOMBSTONE;
+            p.record = std::move(c.record);
+
+            c.record.clear();
+            b.records.push_back(std::move(c));
+        }
+        applying.push_back(std::move(b));
+        apply_cv.notify_one();
+    }
+}
+
+//applies the pending record of @key if it is still commit @seq, then
+//drops it from pending. Returns false if the store failed, applier only
+bool write_log::apply_pending(std::string& key, uint64_t seq)
+{
+    std::unique_lock<std::mutex> lock(log_lock);
+    auto it = pending.find(key);
+
+    //a later commit replaced it, that one is applied instead
+    if(it == pending.end() || it->second.seq != seq)
+        return true;
+    std::string record = it->second.record;
+    bool deleted = it->second.deleted;
+    lock.unlock();
+
+    if(!apply(key, record, deleted)) {
+        lock.lock();
+        ++st.apply_failures;
+        return false;
+    }
+
+    //only once in the store, lookups fall through to it
+    lock.lock();
+    it = pending.find(key);
+    if(it != pending.end() && it->second.seq == seq)
+        pending.erase(it);
+    ++st.applied;
+    return true;
+}
+
+//applies records which failed before, in commit order, applier only
+void write_log::retry_unapplied(void)
+{
+    std::vector<unapplied_s> retry;
+    retry.swap(unapplied);
+
+    for(auto& u: retry) {
+        if(!apply_pending(u.key, u.seq))
+            unapplied.push_back(u);
+    }
+
+    if(!unapplied.empty())
+        dbg<<unapplied.size()<<" records still not applied\n";
+}
+
+//retires log files before @upto once the store is synced, keeping any
+//holding a record not yet applied. Applier only
+void write_log::checkpoint(uint32_t upto)
+{
+    for(auto& u: unapplied)
+        upto = std::min(upto, u.file);
+    if(upto <= oldest)
+        return;
+
+    //tried again at the next batch
+    if(!sync()) {
+        std::cerr<<"failed to sync store, keeping log files from "<<file_path(oldest)<<std::endl;
+        return;
+    }
+
+    for(; oldest < upto; ++oldest)
+        ::remove(file_path(oldest).c_str());
+
+    std::lock_guard<std::mutex> lock(log_lock);
+    ++st.checkpoints;
+}
+
+//background thread applying committed records to the store
+void write_log::applier(void)
+{
+    std::unique_lock<std::mutex> lock(log_lock);
+    auto retry_at = std::chrono::steady_clock::now();
+
+    while(true) {
+        auto ready = [this]{ return apply_stopping || !applying.empty(); };
+        if(unapplied.empty())
+            apply_cv.wait(lock, ready);
+        else
+            apply_cv.wait_until(lock, retry_at, ready);
+
+        //stopping, once all committed has been tried
+        bool have_batch = !applying.empty();
+        bool stopping = apply_stopping;
+        batch_s b;
+        if(have_batch) {
+            b = std::move(applying.front());
+            applying.pop_front();
+        }
+        lock.unlock();
+
+        //a failing store is only tried again every WAL_RETRY_INTERVAL
+        auto now = std::chrono::steady_clock::now();
+        if(!unapplied.empty() && (now >= retry_at || stopping)) {
+            retry_unapplied();
+            retry_at = now+std::chrono::milliseconds(WAL_RETRY_INTERVAL);
+        }
+
+        if(have_batch) {
+            //batches are applied in commit order, so every record of older
+            //files has been through the store, which once synced leaves
+            //them only what failed to apply
+            checkpoint(b.file);
+
+            for(auto& c: b.records) {
+                if(!apply_pending(c.key, c.seq)) {
+                    if(unapplied.empty())
+                        retry_at = now+std::chrono::milliseconds(WAL_RETRY_INTERVAL);
+                    unapplied_s u = {b.file, c.seq, c.key};
+                    unapplied.push_back(u);
+                }
+            }
+        }
+
+        lock.lock();
+        if(!have_batch && stopping)
+            break;
+    }
+}